@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <sys/time.h>
+
+#include "inifile.h"
+
+#define BENCH_FILE	"bench_load.ini"
+#define BENCH_ROUNDS	5
+
+// һעͺܶļ: ÿsectionǰ˵, ÿʵβע
+static int make_file (const char *name, int numSections, int numKeys)
+{
+    FILE *fp;
+    int i, j;
+
+    if ((fp = fopen (name, "w")) == NULL)
+        return -1;
+    fprintf (fp, "; generated by bench_load\n;\n");
+    for (i = 0; i < numSections; i++) {
+        fprintf (fp, "\n; ----------------------------------------\n");
+        fprintf (fp, "; section %d: settings of service %d\n", i, i);
+        fprintf (fp, "; ----------------------------------------\n");
+        fprintf (fp, "[service%d]\t; service %d\n", i, i);
+        for (j = 0; j < numKeys; j++) {
+            if (j % 4 == 0)
+                fprintf (fp, ";   the following keys tune group %d\n", j / 4);
+            fprintf (fp, "key%d = value%d_%d\t; default is %d\n", j, i, j, j);
+        }
+    }
+    return fclose (fp);
+}
+
+static double now (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// flagsʽBENCH_ROUNDS, ʱһռõĶڴ
+static void bench (const char *label, int flags)
+{
+    PCONFIG pCfg;
+    struct mallinfo2 before, after;
+    double best = 0, t;
+    char buf[CFG_MAX_LINE_LENGTH];
+    int i;
+
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        t = now ();
+        if (cfg_open (&pCfg, BENCH_FILE, flags)) {
+            printf ("%-8s open failed\n", label);
+            return;
+        }
+        t = now () - t;
+        if (i == 0 || t < best)
+            best = t;
+        cfg_done (pCfg);
+    }
+
+    before = mallinfo2 ();
+    cfg_open (&pCfg, BENCH_FILE, flags);
+    cfg_getstring (pCfg, "service1", "key1", buf);
+    after = mallinfo2 ();
+    printf ("%-8s %10.2f ms %12zu KB\n", label, best * 1000,
+            (after.uordblks + after.hblkhd - before.uordblks - before.hblkhd) / 1024);
+    cfg_done (pCfg);
+}
+
+int main (int argc, char *argv[])
+{
+    int numSections = argc > 1 ? atoi (argv[1]) : 20000;
+    int numKeys = argc > 2 ? atoi (argv[2]) : 20;
+
+    if (make_file (BENCH_FILE, numSections, numKeys)) {
+        printf ("cannot create %s\n", BENCH_FILE);
+        return 1;
+    }
+    printf ("%d sections x %d keys\n", numSections, numKeys);
+    printf ("%-8s %13s %15s\n", "mode", "load", "heap");
+    bench ("default", 0);
+    bench ("lazy", CFG_OPEN_LAZY);
+    bench ("lean", CFG_OPEN_LEAN);
+
+    remove (BENCH_FILE);
+    return 0;
+}
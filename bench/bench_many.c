@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "inifile.h"
+
+#define BENCH_DIR	"bench_many.d"
+#define BENCH_ROUNDS	5
+
+static int cold;
+
+// numFilesСļ(ÿ⻧һ), ļpaths
+static int make_files (char **paths, int numFiles, int numKeys)
+{
+    FILE *fp;
+    int i, j;
+
+    mkdir (BENCH_DIR, 0755);
+    for (i = 0; i < numFiles; i++) {
+        paths[i] = (char *) malloc (sizeof (BENCH_DIR) + 32);
+        sprintf (paths[i], "%s/tenant%d.ini", BENCH_DIR, i);
+        if ((fp = fopen (paths[i], "w")) == NULL)
+            return -1;
+        fprintf (fp, "; tenant %d\n[tenant]\nid = %d\nname = tenant%d\n", i, i, i);
+        fprintf (fp, "\n[limits]\n");
+        for (j = 0; j < numKeys; j++)
+            fprintf (fp, "limit%d = %d\t; per second\n", j, (i + 1) * j);
+        if (fclose (fp))
+            return -1;
+    }
+    return 0;
+}
+
+// 仺: ÿǰҳĿ¼, ҪrootȨ
+static void drop_caches (void)
+{
+    FILE *fp;
+
+    sync ();
+    if ((fp = fopen ("/proc/sys/vm/drop_caches", "w")) == NULL) {
+        printf ("cannot drop caches (not root?)\n");
+        exit (1);
+    }
+    fputs ("3", fp);
+    fclose (fp);
+}
+
+static double now (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// cfg_initһcfg_init_manyȫļ, ȡBENCH_ROUNDSеʱ
+static double bench (char **paths, PCONFIG *handles, int numFiles, int batch)
+{
+    double best = 0, t;
+    int i, j, rc;
+
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        if (cold)
+            drop_caches ();
+        t = now ();
+        if (batch)
+            rc = cfg_init_many (handles, (const char **) paths, numFiles, 0);
+        else
+            for (j = 0, rc = 0; j < numFiles; j++)
+                rc |= cfg_init (&handles[j], paths[j], 0);
+        t = now () - t;
+        if (rc) {
+            printf ("load failed\n");
+            exit (1);
+        }
+        if (i == 0 || t < best)
+            best = t;
+        for (j = 0; j < numFiles; j++)
+            cfg_done (handles[j]);
+    }
+    return best;
+}
+
+int main (int argc, char *argv[])
+{
+    int numFiles = argc > 1 ? atoi (argv[1]) : 3000;
+    int numKeys = argc > 2 ? atoi (argv[2]) : 10;
+    char **paths;
+    PCONFIG *handles;
+    double seq, many;
+
+    paths = (char **) calloc (numFiles, sizeof (char *));
+    handles = (PCONFIG *) calloc (numFiles, sizeof (PCONFIG));
+    if (make_files (paths, numFiles, numKeys)) {
+        printf ("cannot create %s\n", BENCH_DIR);
+        return 1;
+    }
+
+    cold = argc > 3 && strcmp (argv[3], "cold") == 0;
+    printf ("%d files, %d keys each, %s cache\n", numFiles, numKeys + 2,
+            cold ? "cold" : "warm");
+    seq = bench (paths, handles, numFiles, 0);
+    many = bench (paths, handles, numFiles, 1);
+    printf ("%-14s %10.2f ms\n", "cfg_init", seq * 1000);
+    printf ("%-14s %10.2f ms %8.2fx\n", "cfg_init_many", many * 1000, seq / many);
+    return 0;
+}
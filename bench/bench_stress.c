@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "inifile.h"
+
+#define BENCH_FILE	"bench_stress.ini"
+#define BENCH_SECTIONS	100
+#define BENCH_KEYS	20
+#define BENCH_REFRESH	4096	// cloneģʽÿ߳ÿôˢһ
+#define MAX_THREADS	64
+#define BENCH_WRITERS	4	// concurrentģʽύд߳, дһsection
+
+// ӳֱͼ: ÿ2ݷ16, 1/16
+#define HIST_SUB	16
+#define HIST_BUCKETS	(64 * HIST_SUB)
+
+typedef struct {
+    uint64_t count[HIST_BUCKETS];
+    uint64_t total;
+} HIST;
+
+enum { MODE_MUTEX, MODE_CLONE, MODE_FROZEN, MODE_CONCURRENT };
+enum { WRITER_COMMIT, WRITER_REFRESH };
+
+static const char *modeNames[] = { "mutex", "clone", "frozen", "concurrent" };
+static const char *writerNames[] = { "commit", "refresh" };
+
+typedef struct {
+    pthread_t thread;
+    PCONFIG pconfig;		// ߳ʹõľ
+    unsigned int seed;
+    uint64_t ops;
+    HIST lookup;
+    HIST reload;		// cloneģʽ±̵߳ˢ
+    unsigned int seen;		// frozenģʽ: һκ󿴵Ŀմ
+} READER;
+
+typedef struct {
+    pthread_t thread;
+    PCONFIG editor;		// дļõľ, ֱдĹ
+    int index;			// дsection<index>
+    HIST writes;		// ÿֵӳ
+} WTHREAD;
+
+static int mode, writer, openFlags;
+static int stop;			// __atomicд
+static PCONFIG shared;		// mutex/frozenģʽĹ, cloneģʽԭ
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static READER readers[MAX_THREADS];
+static int numReaders;
+static unsigned int generation;	// frozenģʽ: Ŀ, __atomicд
+static PCONFIG retired;		// frozenģʽ: ûȵж߳뿪ľɿ
+
+static int make_file (const char *name)
+{
+    FILE *fp;
+    int i, j;
+
+    if ((fp = fopen (name, "w")) == NULL)
+        return -1;
+    fprintf (fp, "; generated by bench_stress\n");
+    for (i = 0; i < BENCH_SECTIONS; i++) {
+        fprintf (fp, "\n[section%d]\n", i);
+        // һkeyñsectionkey0, ʱҪչ
+        for (j = 0; j < BENCH_KEYS - 1; j++)
+            fprintf (fp, "key%d = %d\t; tunable %d\n", j, i * 1000 + j, j);
+        fprintf (fp, "key%d = ${section%d:key0}\n", j, i);
+    }
+    return fclose (fp);
+}
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void hist_add (HIST *h, uint64_t ns)
+{
+    int lg, b;
+
+    if (ns < HIST_SUB)
+        b = (int) ns;
+    else {
+        lg = 63 - __builtin_clzll (ns);
+        b = (lg - 3) * HIST_SUB + (int) ((ns >> (lg - 4)) & (HIST_SUB - 1));
+    }
+    h->count[b]++;
+    h->total++;
+}
+
+static void hist_merge (HIST *to, const HIST *from)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        to->count[i] += from->count[i];
+    to->total += from->total;
+}
+
+// qλڸ½()
+static uint64_t hist_pct (const HIST *h, double q)
+{
+    uint64_t want, seen = 0;
+    int b;
+
+    if (h->total == 0)
+        return 0;
+    want = (uint64_t) (q * h->total);
+    if (want >= h->total)
+        want = h->total - 1;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->count[b];
+        if (seen > want)
+            break;
+    }
+    if (b < HIST_SUB)
+        return b;
+    return (uint64_t) (HIST_SUB + b % HIST_SUB) << (b / HIST_SUB - 1);
+}
+
+static unsigned int next_rand (unsigned int *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+// һkey, cfg_getstringcfg_getint
+static void *reader_main (void *arg)
+{
+    READER *r = (READER *) arg;
+    PCONFIG pconfig;
+    char section[32], id[32], buf[CFG_MAX_LINE_LENGTH];
+    unsigned int x;
+    uint64_t t;
+    int v;
+
+    while (!__atomic_load_n (&stop, __ATOMIC_RELAXED)) {
+        x = next_rand (&r->seed);
+        sprintf (section, "section%u", x % BENCH_SECTIONS);
+        sprintf (id, "key%u", (x >> 8) % BENCH_KEYS);
+
+        t = now_ns ();
+        if (mode == MODE_MUTEX)
+            pthread_mutex_lock (&lock);
+        // frozenģʽÿȡд߳·Ŀ
+        pconfig = mode == MODE_FROZEN
+            ? __atomic_load_n (&shared, __ATOMIC_ACQUIRE) : r->pconfig;
+        if (r->ops & 1)
+            cfg_getint (pconfig, section, id, &v);
+        else
+            cfg_getstring (pconfig, section, id, buf);
+        if (mode == MODE_MUTEX)
+            pthread_mutex_unlock (&lock);
+        hist_add (&r->lookup, now_ns () - t);
+        r->ops++;
+        // βѽ, ֮ĲֻõһµĿ
+        if (mode == MODE_FROZEN)
+            __atomic_store_n (&r->seen,
+                __atomic_load_n (&generation, __ATOMIC_ACQUIRE),
+                __ATOMIC_RELEASE);
+
+        if (mode == MODE_CLONE && r->ops % BENCH_REFRESH == 0) {
+            t = now_ns ();
+            cfg_refresh (r->pconfig);
+            hist_add (&r->reload, now_ns () - t);
+        }
+    }
+    return NULL;
+}
+
+// frozenģʽ: ¿շ, ж̶߳һΡõɿͷ
+// ɿ; ֹͣʱûȵľɿrunͷ
+static void retire (PCONFIG old)
+{
+    unsigned int gen;
+    int i;
+
+    gen = __atomic_add_fetch (&generation, 1, __ATOMIC_ACQ_REL);
+    retired = old;
+    for (i = 0; i < numReaders; i++)
+        while (__atomic_load_n (&readers[i].seen, __ATOMIC_ACQUIRE) < gen)
+            if (__atomic_load_n (&stop, __ATOMIC_RELAXED))
+                return;
+            else
+                sched_yield ();
+    cfg_done (old);
+    retired = NULL;
+}
+
+// д߳: ͣд벢ύ, дļ롣frozenģʽĿղ޸,
+// д̸߳editor, ؼļ¿ղ, ύҲͬ
+// concurrentģʽ¼д̲߳дͬһĲͬsectionύ
+static void *writer_main (void *arg)
+{
+    WTHREAD *w = (WTHREAD *) arg;
+    PCONFIG editor = w->editor, fresh, old, target;
+    char section[32], value[32];
+    unsigned int n = 0;
+    uint64_t t;
+
+    sprintf (section, "section%d", w->index);
+    while (!__atomic_load_n (&stop, __ATOMIC_RELAXED)) {
+        sprintf (value, "%u", n++);
+        target = mode == MODE_FROZEN ? editor : shared;
+        if (writer == WRITER_REFRESH) {
+            cfg_write (editor, section, "key0", value);
+            cfg_commit (editor);
+        }
+
+        // ʱݶԶ߳̿ɼΪֹ, ȴɿ
+        t = now_ns ();
+        fresh = NULL;
+        old = shared;
+        if (mode == MODE_MUTEX)
+            pthread_mutex_lock (&lock);
+        if (writer == WRITER_COMMIT) {
+            cfg_write (target, section, "key0", value);
+            cfg_commit (target);
+        }
+        if (mode == MODE_FROZEN) {
+            if (cfg_open (&fresh, BENCH_FILE, openFlags) == 0
+                && cfg_freeze (fresh) == 0)
+                __atomic_store_n (&shared, fresh, __ATOMIC_RELEASE);
+            else if (fresh) {
+                cfg_done (fresh);
+                fresh = NULL;
+            }
+        }
+        else if (writer == WRITER_REFRESH)
+            cfg_refresh (shared);
+        if (mode == MODE_MUTEX)
+            pthread_mutex_unlock (&lock);
+        hist_add (&w->writes, now_ns () - t);
+        if (fresh)
+            retire (old);
+    }
+    return NULL;
+}
+
+static void run (int numThreads, double seconds)
+{
+    static WTHREAD writers[BENCH_WRITERS];
+    PCONFIG editor;
+    HIST lookup, reload, writes;
+    uint64_t total = 0, minOps = 0;
+    double mops;
+    int i, numWriters;
+
+    if (make_file (BENCH_FILE) || cfg_open (&shared, BENCH_FILE, openFlags
+            | (mode == MODE_CONCURRENT ? CFG_OPEN_CONCURRENT : 0))
+        || cfg_open (&editor, BENCH_FILE, 0)) {
+        printf ("cannot create %s\n", BENCH_FILE);
+        exit (1);
+    }
+    if (mode == MODE_FROZEN)
+        cfg_freeze (shared);
+
+    memset (readers, 0, sizeof (readers));
+    memset (writers, 0, sizeof (writers));
+    numReaders = numThreads;
+    generation = 0;
+    retired = NULL;
+    __atomic_store_n (&stop, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < numThreads; i++) {
+        readers[i].seed = 2463534242U + i * 7919;
+        readers[i].pconfig = shared;
+        if (mode == MODE_CLONE && cfg_clone (shared, &readers[i].pconfig)) {
+            printf ("clone failed\n");
+            exit (1);
+        }
+    }
+    for (i = 0; i < numThreads; i++)
+        pthread_create (&readers[i].thread, NULL, reader_main, &readers[i]);
+    // ֻһд̸߳дļ
+    numWriters = mode == MODE_CONCURRENT && writer == WRITER_COMMIT
+        ? BENCH_WRITERS : 1;
+    for (i = 0; i < numWriters; i++) {
+        writers[i].editor = writer == WRITER_REFRESH || mode == MODE_FROZEN
+            ? editor : shared;
+        writers[i].index = i;
+        pthread_create (&writers[i].thread, NULL, writer_main, &writers[i]);
+    }
+
+    usleep ((useconds_t) (seconds * 1e6));
+    __atomic_store_n (&stop, 1, __ATOMIC_RELAXED);
+    memset (&writes, 0, sizeof (writes));
+    for (i = 0; i < numWriters; i++) {
+        pthread_join (writers[i].thread, NULL);
+        hist_merge (&writes, &writers[i].writes);
+    }
+
+    memset (&lookup, 0, sizeof (lookup));
+    memset (&reload, 0, sizeof (reload));
+    for (i = 0; i < numThreads; i++) {
+        pthread_join (readers[i].thread, NULL);
+        hist_merge (&lookup, &readers[i].lookup);
+        hist_merge (&reload, &readers[i].reload);
+        total += readers[i].ops;
+        if (i == 0 || readers[i].ops < minOps)
+            minOps = readers[i].ops;
+        if (mode == MODE_CLONE)
+            cfg_done (readers[i].pconfig);
+    }
+    // cloneģʽڶ߳, ģʽд߳
+    if (mode != MODE_CLONE)
+        reload = writes;
+
+    mops = total / seconds / 1e6;
+    printf ("%-10s %-8s %3d %9.2f %9.1f %9.1f %7lu %7lu %7lu %8.1f %8.1f %7lu\n",
+        modeNames[mode], writerNames[writer], numThreads, mops,
+        total / seconds / numThreads / 1e3, minOps / seconds / 1e3,
+        (unsigned long) hist_pct (&lookup, 0.5),
+        (unsigned long) hist_pct (&lookup, 0.99),
+        (unsigned long) hist_pct (&lookup, 0.999),
+        hist_pct (&reload, 0.5) / 1e3, hist_pct (&reload, 0.99) / 1e3,
+        (unsigned long) reload.total);
+    fflush (stdout);
+
+    cfg_done (editor);
+    cfg_done (shared);
+    if (retired)
+        cfg_done (retired);
+}
+
+// ÷: bench_stress [mutex|clone|frozen|concurrent|all] [commit|refresh]
+//       [߳] [ÿ] [lazy]
+int main (int argc, char *argv[])
+{
+    const char *modeArg = argc > 1 ? argv[1] : "all";
+    int maxThreads = argc > 3 ? atoi (argv[3]) : MAX_THREADS;
+    double seconds = argc > 4 ? atof (argv[4]) : 0.5;
+    int m, n;
+
+    writer = argc > 2 && strcmp (argv[2], "refresh") == 0
+        ? WRITER_REFRESH : WRITER_COMMIT;
+    if (argc > 5 && strcmp (argv[5], "lazy") == 0)
+        openFlags = CFG_OPEN_LAZY;
+    if (maxThreads < 1 || maxThreads > MAX_THREADS)
+        maxThreads = MAX_THREADS;
+
+    printf ("%d sections x %d keys%s, %.2f s per run, lookup ns, reload us\n",
+        BENCH_SECTIONS, BENCH_KEYS, openFlags ? " (lazy)" : "", seconds);
+    printf ("%-10s %-8s %3s %9s %9s %9s %7s %7s %7s %8s %8s %7s\n", "mode",
+        "writer", "thr", "Mops/s", "Kops/thr", "Kops/min", "p50", "p99",
+        "p999", "rl p50", "rl p99", "reloads");
+    for (m = MODE_MUTEX; m <= MODE_CONCURRENT; m++) {
+        if (strcmp (modeArg, "all") && strcmp (modeArg, modeNames[m]))
+            continue;
+        mode = m;
+        for (n = 1; n <= maxThreads; n *= 2)
+            run (n, seconds);
+    }
+
+    remove (BENCH_FILE);
+    return 0;
+}
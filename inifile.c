@@ -23,7 +23,11 @@ Boston, MA 02111-1307, USA.
 
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* F_OFD_SETLKW */
+#endif
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #ifndef _MAC
@@ -32,13 +36,151 @@ Boston, MA 02111-1307, USA.
 #include <stdlib.h>
 #endif
 #include <unistd.h>
+#include <fcntl.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <dirent.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__linux__) && !defined(CFG_NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CFG_HAVE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#endif
+#endif
+
+#if !defined(CFG_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define CFG_HAVE_SDT
+#include <sys/sdt.h>
+#endif
+#endif
 
 #include "inifile.h"
 
+/*
+ *  USDT probes of provider inifile. Each is a single nop until a
+ *  tracer attaches to it; without <sys/sdt.h> they are not compiled.
+ *
+ *  refresh_entry (file)	refresh_return (file, rc, bytes, entries)
+ *  parse_entry (file, bytes)	parse_return (file, rc, entries)
+ *  find_entry (section, id)	find_return (section, id, rc)
+ *  write_entry (file, section, id, value)
+ *				write_return (file, section, id, rc)
+ *  commit_entry (file, dirty)	commit_return (file, rc)
+ *
+ *  tools/bpftrace has scripts built on them.
+ */
+#ifdef CFG_HAVE_SDT
+#define CFG_PROBE1(name, a)		DTRACE_PROBE1 (inifile, name, a)
+#define CFG_PROBE2(name, a, b)		DTRACE_PROBE2 (inifile, name, a, b)
+#define CFG_PROBE3(name, a, b, c)	DTRACE_PROBE3 (inifile, name, a, b, c)
+#define CFG_PROBE4(name, a, b, c, d)	DTRACE_PROBE4 (inifile, name, a, b, c, d)
+#else
+#define CFG_PROBE1(name, a)
+#define CFG_PROBE2(name, a, b)
+#define CFG_PROBE3(name, a, b, c)
+#define CFG_PROBE4(name, a, b, c, d)
+#endif
+
 
-static PCFGENTRY _cfg_poolalloc (PCONFIG p, unsigned int count);
+static PCFGENTRY _cfg_poolalloc (PCONFIG p, PCFGSECT s, unsigned int count);
+static PCFGSECT _cfg_newsect (PCONFIG p);
+static PCFGSECT _cfg_sect (PCONFIG pconfig, unsigned int pos);
+static int _cfg_loadall (PCONFIG pconfig);
+static PCFGENTRY _cfg_storeat (PCONFIG pconfig, PCFGSECT s, char *section,
+    char *id, char *value, char *comment, int dynamic);
+static int _cfg_resize (PCFGSECT s, unsigned int max);
+static int _cfg_reserve (PCFGSECT s, unsigned int count);
+static void _cfg_freesect (PCFGSECT s);
+static void _cfg_sectinsert (PCONFIG p, unsigned int pos);
+static void _cfg_keyinsert (PCFGSECT s, unsigned int idx);
+static void _cfg_reset (PCONFIG pconfig);
+static unsigned int _cfg_sectfind (PCONFIG pconfig, const char *section);
+static int _cfg_keyindex (PCFGSECT s);
+static int _cfg_keyfind (PCFGSECT s, const char *id);
 static int _cfg_parse (PCONFIG pconfig);
+static char *_cfg_expand (PCONFIG pconfig, PCFGSECT s, PCFGENTRY e,
+    const char *section, int depth, char **pFree);
+static PCFGSECT _cfg_own (PCONFIG pconfig, unsigned int pos);
+static int _cfg_shared (PCONFIG pconfig, PCFGSECT s);
+static void _cfg_dropkeyorder (PCFGSECT s);
+static void _cfg_dropsectorder (PCONFIG p);
+static void _cfg_dirfree (struct TCFGDIR *dir);
+static int _cfg_dirrefresh (PCONFIG pconfig);
+static int _cfg_dircommit (PCONFIG pconfig, int compact);
+static PCONFIG _cfg_new (const char *filename, int flags);
+static int _cfg_adopt (PCONFIG pconfig, char *mem, size_t size, time_t mtime,
+    int rebase);
+static int _cfg_settle (PCONFIG pconfig);
+static void _cfg_asyncfree (PCONFIG pconfig);
+static int _cfg_replace (const char *fileName, PCONFIG pconfig,
+    const char *buf, size_t size, struct stat *psb);
+static int _cfg_writeatomic (PCONFIG pconfig, struct stat *psb);
+static int _cfg_ownspine (PCONFIG pconfig);
+static int _cfg_adddep (PCONFIG pconfig, const char *refSection,
+    const char *refId, const char *section, const char *id);
+static void _cfg_invalidate (PCONFIG pconfig, const char *section,
+    const char *id, int depth);
+static void _cfg_freedeps (PCONFIG pconfig);
+static void _cfg_freechanges (PCONFIG pconfig);
+static void _cfg_pack (PCONFIG pconfig, size_t used);
+static int _cfg_writable (PCONFIG pconfig);
+static int _cfg_diff (PCONFIG old, PCONFIG pconfig);
+static struct TCFGSUBS *_cfg_subsalloc (void);
+static void _cfg_subsfree (struct TCFGSUBS *subs);
+static void _cfg_notify (PCONFIG pconfig, const char *section,
+    const char *id, int kind);
+static int _cfg_write (PCONFIG pconfig, char *section, char *id,
+    char *value);
+static int _cfg_writesect (PCONFIG pconfig, unsigned int pos,
+    char *section, char *id, char *value);
+static int _cfg_replay (PCONFIG pconfig);
+static int _cfg_addop (PCONFIG pconfig, char *section, char *id,
+    char *value);
+static int _cfg_reserveop (PCONFIG pconfig, char *section, char *id,
+    char *value);
+static int _cfg_endop (PCONFIG pconfig, int rc);
+static int _cfg_loggedwrite (PCONFIG pconfig, char *section, char *id,
+    char *value);
+static void _cfg_freeops (PCONFIG pconfig);
+static const char *_cfg_lookup (PCONFIG pconfig, const char *section,
+    const char *id, PCFGSECT *ps, PCFGENTRY *pe, size_t *pLen);
+static const char *_cfg_frozenfind (struct TCFGFROZEN *f,
+    const char *section, const char *id, size_t *pLen);
+static void _cfg_frozenfree (PCONFIG pconfig);
+static int _cfg_register (PCONFIG pconfig);
+static void _cfg_unregister (PCONFIG pconfig);
+static struct TCFGLOCKS *_cfg_locksalloc (void);
+static void _cfg_locksfree (struct TCFGLOCKS *l);
+static void _cfg_lockall (struct TCFGLOCKS *l);
+static void _cfg_unlockall (struct TCFGLOCKS *l);
+static int _cfg_lockedwrite (PCONFIG pconfig, char *section, char *id,
+    char *value);
+static int _cfg_writegroups (PCONFIG pconfig, PCFGOP ops,
+    unsigned int numOps);
+static int _cfg_writemany (PCONFIG pconfig, PCFGOP ops,
+    unsigned int numOps);
+static int _cfg_lockedmany (PCONFIG pconfig, PCFGOP ops,
+    unsigned int numOps);
+static int _cfg_lockedget (PCONFIG pconfig, const char *section,
+    const char *id, char *valptr, size_t size, long *pLong);
+static int _cfg_lockedcommit (PCONFIG pconfig);
+static int _cfg_logged (PCONFIG pconfig);
+static int _cfg_reapply (PCONFIG pconfig, PCONFIG old);
+static void _cfg_setversion (PCONFIG pconfig, struct stat *psb);
+static int _cfg_lockfd (int fd);
+static void _cfg_unlockfd (int fd);
+static int _cfg_optcommit (PCONFIG pconfig);
+static int _cfg_walknext (PCFGITER it);
 
 /*** READ MODULE ****/
 
@@ -84,6 +226,71 @@ remove_quotes(const char *szString)
   return szWork;
 }
 
+
+/*
+ *  Compare two ids, ignoring case and quotes the same
+ *  way remove_quotes does, but without allocating
+ */
+static int
+_cfg_idcmp (const char *entryId, const char *id)
+{
+  while (*entryId == '\'' || *entryId == '\"')
+    entryId++;
+  while (*id == '\'' || *id == '\"')
+    id++;
+  if (!*entryId)
+    return -1;
+
+  while (*entryId && *entryId != '\'' && *entryId != '\"')
+    {
+      if (tolower ((unsigned char) *entryId) != tolower ((unsigned char) *id))
+	return 1;
+      entryId++;
+      id++;
+    }
+  return *id && *id != '\'' && *id != '\"' ? 1 : 0;
+}
+
+
+static unsigned int
+_cfg_hashmem (unsigned int h, const char *s, size_t n)
+{
+  while (n--)
+    h = (h ^ (unsigned char) *s++) * 16777619u;
+  return h;
+}
+
+
+static unsigned int
+_cfg_hashstr (unsigned int h, const char *s)
+{
+  while (*s)
+    h = (h ^ (unsigned char) tolower ((unsigned char) *s++)) * 16777619u;
+  return h;
+}
+
+
+/*
+ *  Continue hash h over an id, ignoring quotes like _cfg_idcmp does
+ */
+static unsigned int
+_cfg_idhash (unsigned int h, const char *id)
+{
+  while (*id == '\'' || *id == '\"')
+    id++;
+  while (*id && *id != '\'' && *id != '\"')
+    h = (h ^ (unsigned char) tolower ((unsigned char) *id++)) * 16777619u;
+  return h;
+}
+
+
+static unsigned int
+_cfg_keyhash (const char *section, const char *id)
+{
+  return _cfg_idhash (_cfg_hashstr (2166136261u, section) * 16777619u, id);
+}
+
+
 int
 cfg_file_exist (const char *filename)
 {
@@ -96,28 +303,91 @@ cfg_file_exist (const char *filename)
  */
 int
 cfg_init (PCONFIG *ppconf, const char *filename, int doCreate)
+{
+  return cfg_open (ppconf, filename, doCreate ? CFG_OPEN_CREATE : 0);
+}
+
+
+int
+cfg_open (PCONFIG *ppconf, const char *filename, int flags)
 {
   PCONFIG pconfig;
 
   *ppconf = NULL;
 
-  if (!filename)
+  if ((pconfig = _cfg_new (filename, flags)) == NULL)
     return -1;
 
+  if (cfg_refresh (pconfig) == -1)
+    {
+      cfg_done (pconfig);
+      return -1;
+    }
+  *ppconf = pconfig;
+
+  return 0;
+}
+
+
+/*
+ *  A handle for filename with nothing loaded yet
+ */
+static PCONFIG
+_cfg_new (const char *filename, int flags)
+{
+  PCONFIG pconfig;
+
+  if (!filename)
+    return NULL;
+
   if ((pconfig = (PCONFIG) calloc (1, sizeof (TCONFIG))) == NULL)
-    return -1;
+    return NULL;
 
   //strdup:ַƣstrdupѶ̬ڴʵԼڲ
   //ͷstrdupڲ̬ڴҪɵȥ.
   pconfig->fileName = strdup (filename);
-  if (pconfig->fileName == NULL)
+  pconfig->subs = _cfg_subsalloc ();
+  pconfig->openFlags = flags;
+  pconfig->journalLimit = CFG_JOURNAL_LIMIT;
+  if (pconfig->fileName == NULL || pconfig->subs == NULL
+      || _cfg_register (pconfig) == -1)
     {
       cfg_done (pconfig);
-      return -1;
+      return NULL;
+    }
+
+  if ((flags & CFG_OPEN_OPTIMISTIC)
+      && (flags & (CFG_OPEN_JOURNAL | CFG_OPEN_DIR)))
+    {
+      errno = EINVAL;
+      cfg_done (pconfig);
+      return NULL;
+    }
+  if (flags & CFG_OPEN_CONCURRENT)
+    {
+      if (flags & (CFG_OPEN_JOURNAL | CFG_OPEN_LEAN))
+	errno = EINVAL;
+      if ((flags & (CFG_OPEN_JOURNAL | CFG_OPEN_LEAN))
+	  || (pconfig->locks = _cfg_locksalloc ()) == NULL)
+	{
+	  cfg_done (pconfig);
+	  return NULL;
+	}
+    }
+
+  if (flags & CFG_OPEN_JOURNAL)
+    {
+      pconfig->journalName = (char *) malloc (strlen (filename) + 9);
+      if (pconfig->journalName == NULL)
+	{
+	  cfg_done (pconfig);
+	  return NULL;
+	}
+      sprintf (pconfig->journalName, "%s.journal", filename);
     }
 
   /* If the file does not exist, try to create it */
-  if (doCreate && access (pconfig->fileName, 0) == -1)
+  if ((flags & CFG_OPEN_CREATE) && access (pconfig->fileName, 0) == -1)
     {
       int fd;
 
@@ -126,14 +396,7 @@ cfg_init (PCONFIG *ppconf, const char *filename, int doCreate)
 	close (fd);
     }
 
-  if (cfg_refresh (pconfig) == -1)
-    {
-      cfg_done (pconfig);
-      return -1;
-    }
-  *ppconf = pconfig;
-
-  return 0;
+  return pconfig;
 }
 
 
@@ -145,9 +408,15 @@ cfg_done (PCONFIG pconfig)
 {
   if (pconfig)
     {
+      _cfg_asyncfree (pconfig);
       cfg_freeimage (pconfig);
+      _cfg_dirfree (pconfig->dir);
       if (pconfig->fileName)
 	free (pconfig->fileName);
+      _cfg_subsfree (pconfig->subs);
+      free (pconfig->journalName);
+      _cfg_unregister (pconfig);
+      _cfg_locksfree (pconfig->locks);
       free (pconfig);
     }
 
@@ -161,65 +430,101 @@ cfg_done (PCONFIG pconfig)
 int
 cfg_freeimage (PCONFIG pconfig)
 {
-  char *saveName;
-  PCFGENTRY e;
   unsigned int i;
 
-  if (pconfig->image)
-    free (pconfig->image);
-  if (pconfig->entries)
+  /* shared with a clone: the last handle frees, blocks before the
+     slab they may live in */
+  if (pconfig->spineRefs == NULL
+      || __atomic_sub_fetch (pconfig->spineRefs, 1, __ATOMIC_ACQ_REL) == 0)
     {
-      e = pconfig->entries;
-      for (i = 0; i < pconfig->numEntries; i++, e++)
-	{
-	  if (e->flags & CFE_MUST_FREE_SECTION)
-	    free (e->section);
-	  if (e->flags & CFE_MUST_FREE_ID)
-	    free (e->id);
-	  if (e->flags & CFE_MUST_FREE_VALUE)
-	    free (e->value);
-	  if (e->flags & CFE_MUST_FREE_COMMENT)
-	    free (e->comment);
-	}
-      free (pconfig->entries);
+      for (i = 0; i < pconfig->numSections; i++)
+	if (__atomic_sub_fetch (&pconfig->sections[i]->refs, 1,
+		__ATOMIC_ACQ_REL) == 0)
+	  _cfg_freesect (pconfig->sections[i]);
+      free (pconfig->sections);
+      free (pconfig->sectIndex);
+      free (pconfig->spineRefs);
     }
-
-  saveName = pconfig->fileName;
-  memset (pconfig, 0, sizeof (TCONFIG));
-  pconfig->fileName = saveName;
+  if (pconfig->imageRefs == NULL
+      || __atomic_sub_fetch (pconfig->imageRefs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      free (pconfig->image);
+      free (pconfig->slab);
+      free (pconfig->imageRefs);
+    }
+  free (pconfig->sectOrder);
+  free (pconfig->scratch);
+  free (pconfig->scratchList);
+  _cfg_frozenfree (pconfig);
+  _cfg_freedeps (pconfig);
+  _cfg_freechanges (pconfig);
+  _cfg_freeops (pconfig);
+  _cfg_reset (pconfig);
 
   return 0;
 }
 
 
+/*
+ *  Forget the content without freeing it,
+ *  keeping what belongs to the handle rather than to the image
+ */
+static void
+_cfg_reset (PCONFIG pconfig)
+{
+  TCONFIG save;
+
+  save = *pconfig;
+  memset (pconfig, 0, offsetof (TCONFIG, locks));
+  pconfig->fileName = save.fileName;
+  pconfig->openFlags = save.openFlags;
+  pconfig->subs = save.subs;
+  pconfig->async = save.async;
+  pconfig->dir = save.dir;
+  pconfig->journalName = save.journalName;
+  pconfig->journalLimit = save.journalLimit;
+  pconfig->live = save.live;
+}
+
+
 /*
  *  This procedure reads an copy of the file into memory
  *  caching the content based on stat
  */
-int
-cfg_refresh (PCONFIG pconfig)
+static int
+_cfg_refresh (PCONFIG pconfig)
 {
   //sb : stat buf
-  struct stat sb;
+  struct stat sb, jb;
   char *mem;
   int fd;
 
   //stat()fileName ָļ״̬, Ƶsb ָĽṹ
-  if (pconfig == NULL || stat (pconfig->fileName, &sb) == -1)
+  if (pconfig == NULL)
+    return -1;
+  if (pconfig->frozen)
+    return 0;
+  if (pconfig->openFlags & CFG_OPEN_DIR)
+    return _cfg_dirrefresh (pconfig);
+  _cfg_settle (pconfig);
+  if (stat (pconfig->fileName, &sb) == -1)
     return -1;
 
+  _cfg_freechanges (pconfig);
+
+  memset (&jb, 0, sizeof (jb));
+  if (pconfig->journalName)
+    stat (pconfig->journalName, &jb);
+
   /*
+   *  Check to see if our incore image is still valid.
    *  If our image is dirty, ignore all local changes
    *  and force a reread of the image, thus ignoring all mods
    */
-  if (pconfig->dirty)
-    cfg_freeimage (pconfig);
-
-  /*
-   *  Check to see if our incore image is still valid
-   */
-  if (pconfig->image && sb.st_size == pconfig->size
-      && sb.st_mtime == pconfig->mtime)
+  if (!pconfig->dirty && pconfig->image && sb.st_size == pconfig->size
+      && sb.st_mtime == pconfig->mtime
+      && (size_t) jb.st_size == pconfig->journalSize
+      && jb.st_mtime == pconfig->journalMtime)
     return 0;
 
   /*
@@ -240,696 +545,7217 @@ cfg_refresh (PCONFIG pconfig)
 
   close (fd);
 
-  /*
-   *  Store the new copy
-   */
-  cfg_freeimage (pconfig);
-  pconfig->image = mem;
-  pconfig->size = sb.st_size;
-  pconfig->mtime = sb.st_mtime;
-
-  if (_cfg_parse (pconfig) == -1)
-    {
-      cfg_freeimage (pconfig);
-      return -1;
-    }
-
+  if (_cfg_adopt (pconfig, mem, sb.st_size, sb.st_mtime, 0) == -1)
+    return -1;
+  _cfg_setversion (pconfig, &sb);
   return 1;
 }
 
 
-#define iseolchar(C) (strchr ("\n\r\x1a", C) != NULL)
-#define iswhite(C) (strchr ("\f\t ", C) != NULL)
-
-
-static char *
-_cfg_skipwhite (char *s)
+int
+cfg_refresh (PCONFIG pconfig)
 {
-  while (*s && iswhite (*s))
-    s++;
-  return s;
+  int rc;
+
+  CFG_PROBE1 (refresh_entry, pconfig ? pconfig->fileName : NULL);
+  if (pconfig && pconfig->locks)
+    _cfg_lockall (pconfig->locks);
+  rc = _cfg_refresh (pconfig);
+  CFG_PROBE4 (refresh_return, pconfig ? pconfig->fileName : NULL, rc,
+      pconfig ? pconfig->size : 0, pconfig ? pconfig->numEntries : 0);
+  if (pconfig && pconfig->locks)
+    _cfg_unlockall (pconfig->locks);
+  return rc;
 }
 
 
+/*
+ *  Parse mem, the NUL terminated content of the file, as the new image.
+ *  Takes ownership of mem, even on failure. With rebase, the writes
+ *  pending on the old image are applied again on top of the new one.
+ */
 static int
-_cfg_getline (char **pCp, char **pLinePtr)
+_cfg_adopt (PCONFIG pconfig, char *mem, size_t size, time_t mtime,
+    int rebase)
 {
-  char *start;
-  char *cp = *pCp;
-
-  while (*cp && iseolchar (*cp))
-    cp++;
-  start = cp;
-  if (pLinePtr)
-    *pLinePtr = cp;
+  TCONFIG old;
+  unsigned int i;
 
-  while (*cp && !iseolchar (*cp))
-    cp++;
-  if (*cp)
+  /*
+   *  Store the new copy, keeping the old one until
+   *  the change set has been computed
+   */
+  old = *pconfig;
+  _cfg_reset (pconfig);
+  pconfig->image = mem;
+  pconfig->size = size;
+  pconfig->imageAlloc = size + 1;
+  pconfig->mtime = mtime;
+  /* parsing cuts the image up */
+  if (pconfig->openFlags & CFG_OPEN_OPTIMISTIC)
+    pconfig->hash = _cfg_hashmem (2166136261u, mem, size);
+
+  if (_cfg_parse (pconfig) == -1 || _cfg_replay (pconfig) == -1
+      || (rebase && _cfg_reapply (pconfig, &old) == -1))
     {
-      *cp++ = 0;
-      *pCp = cp;
-
-      while (--cp >= start && iswhite (*cp));
-      cp[1] = 0;
+      cfg_freeimage (&old);
+      cfg_freeimage (pconfig);
+      return -1;
     }
-  else
-    *pCp = cp;
 
-  return *start ? 1 : 0;
+  if (old.image && _cfg_diff (&old, pconfig) == -1)
+    _cfg_freechanges (pconfig);
+  cfg_freeimage (&old);
+
+  for (i = 0; i < pconfig->numChanges; i++)
+    _cfg_notify (pconfig, pconfig->changes[i].section,
+	pconfig->changes[i].id, pconfig->changes[i].kind);
+
+  return 1;
 }
 
 
 static char *
-rtrim (char *str)
+_cfg_packstr (char **pPool, char *str)
 {
-  char *endPtr;
+  char *cp = *pPool;
+  size_t len;
 
-  if (str == NULL || *str == '\0')
+  if (str == NULL)
     return NULL;
-
-  for (endPtr = &str[strlen (str) - 1]; endPtr >= str && isspace (*endPtr);
-      endPtr--);
-  endPtr[1] = 0;
-  return endPtr >= str ? endPtr : NULL;
+  len = strlen (str) + 1;
+  memmove (cp, str, len);
+  *pPool = cp + len;
+  return cp;
 }
 
 
 /*
- *  Parse the in-memory copy of the configuration data
+ *  Lean mode, after parsing: the strings in use were moved to the
+ *  first used bytes of the image. Shrink it and the parse slab to what
+ *  is kept. Shrinking normally keeps the address; if it does not, the
+ *  entries are pointed at the new place.
  */
-static int
-_cfg_parse (PCONFIG pconfig)
+static void
+_cfg_pack (PCONFIG pconfig, size_t used)
 {
-  int isContinue, inString;
-  char *imgPtr;
-  char *endPtr;
-  char *lp;
-  char *section;
-  char *id;
-  char *value;
-  char *comment;
-
-  if (cfg_valid (pconfig))
-    return 0;
+  PCFGSECT s;
+  PCFGENTRY slab, e;
+  uintptr_t oldImage;
+  char *image;
+  unsigned int pos, i, n = 0;
+  int contiguous = 1;
+
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    {
+      s = pconfig->sections[pos];
+      if (!(s->flags & CFS_SLAB) || s->entries != pconfig->slab + n)
+	contiguous = 0;
+      n += s->numEntries;
+    }
 
-  endPtr = pconfig->image + pconfig->size;
-  for (imgPtr = pconfig->image; imgPtr < endPtr;)
+  oldImage = (uintptr_t) pconfig->image;
+  pconfig->image[used] = 0;
+  if ((image = (char *) realloc (pconfig->image, used + 1)) != NULL)
     {
-      if (!_cfg_getline (&imgPtr, &lp))
-	continue;
+      pconfig->image = image;
+      pconfig->imageAlloc = used + 1;
+    }
 
-      section = id = value = comment = NULL;
+  /* blocks in the slab sit one after another from its start */
+  slab = NULL;
+  if (contiguous && pconfig->slab && n)
+    slab = (PCFGENTRY) realloc (pconfig->slab, n * sizeof (TCFGENTRY));
 
-      /*
-         *  Skip leading spaces
-       */
-      if (iswhite (*lp))
+  n = 0;
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    {
+      s = pconfig->sections[pos];
+      if (slab)
 	{
-	  lp = _cfg_skipwhite (lp);
-	  isContinue = 1;
+	  s->entries = &slab[n];
+	  s->maxEntries = s->numEntries;
+	  n += s->numEntries;
 	}
-      else
-	isContinue = 0;
-
-      /*
-       *  Parse Section
-       */
-      if (*lp == '[')
+      if ((uintptr_t) pconfig->image == oldImage)
+	continue;
+      for (i = 0, e = s->entries; i < s->numEntries; i++, e++)
 	{
-	  section = _cfg_skipwhite (lp + 1);
-	  if ((lp = strchr (section, ']')) == NULL)
-	    continue;
-	  *lp++ = 0;
-	  if (rtrim (section) == NULL)
-	    {
-	      section = NULL;
-	      continue;
-	    }
-	  lp = _cfg_skipwhite (lp);
+	  if (e->section)
+	    e->section = pconfig->image + ((uintptr_t) e->section - oldImage);
+	  if (e->id)
+	    e->id = pconfig->image + ((uintptr_t) e->id - oldImage);
+	  if (e->value)
+	    e->value = pconfig->image + ((uintptr_t) e->value - oldImage);
 	}
-      else if (*lp != ';')
-	{
-	  /* Try to parse
-	   *   1. Key = Value
-	   *   2. Value (iff isContinue)
-	   */
-	  if (!isContinue)
-	    {
-	      /* Parse `<Key> = ..' */
-	      id = lp;
-	      if ((lp = strchr (id, '=')) == NULL)
-		continue;
-	      *lp++ = 0;
-	      rtrim (id);
-	      lp = _cfg_skipwhite (lp);
-	    }
+    }
+  if (slab)
+    {
+      pconfig->slab = slab;
+      pconfig->slabSize = pconfig->slabUsed = n;
+    }
+}
 
-	  /* Parse value */
-	  inString = 0;
-	  value = lp;
-	  while (*lp)
-	    {
-	      if (inString)
-		{
-		  if (*lp == inString)
-		    inString = 0;
-		}
-	      else if (*lp == '"' || *lp == '\'')
-		inString = *lp;
-	      else if (*lp == ';' && iswhite (lp[-1]))
-		{
-		  *lp = 0;
-		  comment = lp + 1;
-		  rtrim (value);
-		  break;
-		}
-	      lp++;
-	    }
-	}
 
-      /*
-       *  Parse Comment
-       */
-      if (*lp == ';')
-	comment = lp + 1;
+/*
+ *  Slot of the (section, key) table used to diff two images
+ */
+typedef struct
+  {
+    PCFGENTRY e;
+    char *section;
+    unsigned int hash;
+    unsigned int vhash;
+    int seen;
+  }
+TCFGSLOT;
 
-      if (cfg_storeentry (pconfig, section, id, value, comment,
-	      0) == -1)
-	{
-	  pconfig->dirty = 1;
-	  return -1;
-	}
-    }
 
-  pconfig->flags |= CFG_VALID;
+static TCFGSLOT *
+_cfg_slotfind (TCFGSLOT *tab, unsigned int mask, unsigned int h,
+    const char *section, const char *id)
+{
+  TCFGSLOT *t;
 
-  return 0;
+  for (t = &tab[h & mask]; t->e; t = &tab[(t - tab + 1) & mask])
+    if (t->hash == h && !strcasecmp (t->section, section)
+	&& !strcasecmp (t->e->id, id))
+      return t;
+  return t;
 }
 
 
-int
-cfg_storeentry (
-    PCONFIG pconfig,
-    char *section,
-    char *id,
-    char *value,
-    char *comment,
-    int dynamic)
+/*
+ *  Hash every definition of a configuration, first occurrence wins
+ */
+static TCFGSLOT *
+_cfg_keytable (PCONFIG pconfig, unsigned int *pMask)
 {
-  PCFGENTRY data;
+  TCFGSLOT *tab, *t;
+  PCFGSECT s;
+  PCFGENTRY e;
+  char *section;
+  unsigned int pos, i, size;
 
-  if ((data = _cfg_poolalloc (pconfig, 1)) == NULL)
-    return -1;
+  if (_cfg_loadall (pconfig) == -1)
+    return NULL;
+  for (size = 16; size < 2 * pconfig->numEntries; size *= 2)
+    ;
+  if ((tab = (TCFGSLOT *) calloc (size, sizeof (TCFGSLOT))) == NULL)
+    return NULL;
 
-  data->flags = 0;
-  if (dynamic)
+  for (pos = 1; pos < pconfig->numSections; pos++)
+    {
+      s = pconfig->sections[pos];
+      section = s->entries[0].section;
+      for (i = 1, e = &s->entries[1]; i < s->numEntries; i++, e++)
+	{
+	  unsigned int h;
+
+	  if (!e->id || !e->value)
+	    continue;
+	  h = _cfg_keyhash (section, e->id);
+
+	  t = _cfg_slotfind (tab, size - 1, h, section, e->id);
+	  if (t->e)
+	    continue;
+	  t->e = e;
+	  t->section = section;
+	  t->hash = h;
+	  t->vhash = _cfg_hashstr (2166136261u, e->value);
+	}
+    }
+
+  *pMask = size - 1;
+  return tab;
+}
+
+
+static int
+_cfg_addchange (PCONFIG pconfig, const char *section, const char *id,
+    int kind)
+{
+  PCFGCHANGE c;
+  unsigned int newMax;
+
+  if (pconfig->numChanges >= pconfig->maxChanges)
+    {
+      newMax = pconfig->maxChanges ? pconfig->maxChanges * 2 : 16;
+      c = (PCFGCHANGE) realloc (pconfig->changes,
+	  newMax * sizeof (TCFGCHANGE));
+      if (c == NULL)
+	return -1;
+      pconfig->changes = c;
+      pconfig->maxChanges = newMax;
+    }
+
+  c = &pconfig->changes[pconfig->numChanges];
+  if ((c->section = strdup (section)) == NULL)
+    return -1;
+  if ((c->id = strdup (id)) == NULL)
+    {
+      free (c->section);
+      return -1;
+    }
+  c->kind = kind;
+  pconfig->numChanges++;
+
+  return 0;
+}
+
+
+static void
+_cfg_freechanges (PCONFIG pconfig)
+{
+  unsigned int i;
+
+  for (i = 0; i < pconfig->numChanges; i++)
+    {
+      free (pconfig->changes[i].section);
+      free (pconfig->changes[i].id);
+    }
+  free (pconfig->changes);
+  pconfig->changes = NULL;
+  pconfig->numChanges = pconfig->maxChanges = 0;
+}
+
+
+/*
+ *  Compute the keys added, removed or modified between
+ *  the old and the new image, in linear time
+ */
+static int
+_cfg_diff (PCONFIG old, PCONFIG pconfig)
+{
+  TCFGSLOT *oldTab, *newTab, *t;
+  unsigned int oldMask, newMask, pos, i;
+  PCFGSECT s;
+  PCFGENTRY e;
+  char *section;
+  int rc = 0;
+
+  oldTab = _cfg_keytable (old, &oldMask);
+  newTab = _cfg_keytable (pconfig, &newMask);
+  if (oldTab == NULL || newTab == NULL)
+    {
+      free (oldTab);
+      free (newTab);
+      return -1;
+    }
+
+  /* added and modified keys, in the order of the new file */
+  for (pos = 1; rc == 0 && pos < pconfig->numSections; pos++)
+    {
+      s = pconfig->sections[pos];
+      section = s->entries[0].section;
+      for (i = 1, e = &s->entries[1]; rc == 0 && i < s->numEntries; i++, e++)
+	{
+	  unsigned int h;
+
+	  if (!e->id || !e->value)
+	    continue;
+	  h = _cfg_keyhash (section, e->id);
+
+	  t = _cfg_slotfind (newTab, newMask, h, section, e->id);
+	  if (t->e != e)
+	    continue;
+	  t = _cfg_slotfind (oldTab, oldMask, h, section, e->id);
+	  if (!t->e)
+	    rc = _cfg_addchange (pconfig, section, e->id, CFG_ADDED);
+	  else
+	    {
+	      t->seen = 1;
+	      if (t->vhash != _cfg_hashstr (2166136261u, e->value)
+		  || strcmp (t->e->value, e->value))
+		rc = _cfg_addchange (pconfig, section, e->id, CFG_MODIFIED);
+	    }
+	}
+    }
+
+  /* removed keys, in the order of the old file */
+  for (pos = 1; rc == 0 && pos < old->numSections; pos++)
+    {
+      s = old->sections[pos];
+      section = s->entries[0].section;
+      for (i = 1, e = &s->entries[1]; rc == 0 && i < s->numEntries; i++, e++)
+	{
+	  if (!e->id || !e->value)
+	    continue;
+	  t = _cfg_slotfind (oldTab, oldMask, _cfg_keyhash (section, e->id),
+	      section, e->id);
+	  if (t->e == e && !t->seen)
+	    rc = _cfg_addchange (pconfig, section, e->id, CFG_REMOVED);
+	}
+    }
+
+  free (oldTab);
+  free (newTab);
+  return rc;
+}
+
+
+/*
+ *  Iterate the change set of the last cfg_refresh
+ */
+PCFGCHANGE
+cfg_next_change (PCONFIG pconfig, unsigned int *pos)
+{
+  if (pconfig == NULL || *pos >= pconfig->numChanges)
+    return NULL;
+  return &pconfig->changes[(*pos)++];
+}
+
+
+#define iseolchar(C) (strchr ("\n\r\x1a", C) != NULL)
+#define iswhite(C) (strchr ("\f\t ", C) != NULL)
+
+
+static char *
+_cfg_skipwhite (char *s)
+{
+  while (*s && iswhite (*s))
+    s++;
+  return s;
+}
+
+
+static int
+_cfg_getline (char **pCp, char **pLinePtr)
+{
+  char *start;
+  char *cp = *pCp;
+
+  while (*cp && iseolchar (*cp))
+    cp++;
+  start = cp;
+  if (pLinePtr)
+    *pLinePtr = cp;
+
+  while (*cp && !iseolchar (*cp))
+    cp++;
+  if (*cp)
+    *cp++ = 0;
+  *pCp = cp;
+
+  while (--cp >= start && (*cp == 0 || iswhite (*cp)));
+  cp[1] = 0;
+
+  return *start ? 1 : 0;
+}
+
+
+static char *
+rtrim (char *str)
+{
+  char *endPtr;
+
+  if (str == NULL || *str == '\0')
+    return NULL;
+
+  for (endPtr = &str[strlen (str) - 1]; endPtr >= str && isspace (*endPtr);
+      endPtr--);
+  endPtr[1] = 0;
+  return endPtr >= str ? endPtr : NULL;
+}
+
+
+/*
+ *  Count the newlines and '[' characters in buf
+ */
+static void
+_cfg_count (const char *buf, size_t size, size_t *pLines, size_t *pBrackets)
+{
+  size_t lines = 0, brackets = 0, i = 0;
+
+#ifdef __SSE2__
+  __m128i nl = _mm_set1_epi8 ('\n');
+  __m128i br = _mm_set1_epi8 ('[');
+
+  for (; i + 16 <= size; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (buf + i));
+
+      lines += __builtin_popcount (_mm_movemask_epi8 (
+	      _mm_cmpeq_epi8 (v, nl)));
+      brackets += __builtin_popcount (_mm_movemask_epi8 (
+	      _mm_cmpeq_epi8 (v, br)));
+    }
+#endif
+  for (; i < size; i++)
+    {
+      lines += buf[i] == '\n';
+      brackets += buf[i] == '[';
+    }
+
+  *pLines = lines;
+  *pBrackets = brackets;
+}
+
+
+/*
+ *  Size the block array, the section index and the entry slab for the
+ *  image before parsing it, so that _cfg_parse does not grow them.
+ *  The counts are upper bounds for usual files; a file that exceeds
+ *  them only makes the blocks grow as they otherwise would.
+ */
+static void
+_cfg_presize (PCONFIG p)
+{
+  size_t lines, brackets;
+  unsigned int n;
+
+  if (p->numSections || p->image == NULL)
+    return;
+  _cfg_count (p->image, p->size, &lines, &brackets);
+  if (lines + 1 > UINT_MAX / sizeof (TCFGENTRY) || brackets + 2 > UINT_MAX / 4)
+    return;
+
+  n = (unsigned int) brackets + 2;
+  if ((p->sections = (PCFGSECT *) malloc (n * sizeof (PCFGSECT))) != NULL)
+    p->maxSections = n;
+  if (brackets)
+    {
+      for (n = 64; n < 2 * (brackets + 1);)
+	n *= 2;
+      if ((p->sectIndex = (unsigned int *) calloc (n, sizeof (unsigned int)))
+	  != NULL)
+	p->sectSize = n;
+    }
+  if (p->openFlags & CFG_OPEN_LAZY)
+    return;
+  n = (unsigned int) lines + 1;
+  if ((p->slab = (PCFGENTRY) malloc (n * sizeof (TCFGENTRY))) != NULL)
+    p->slabSize = n;
+}
+
+
+/*
+ *  Split one line into its parts. Returns 0 if the line holds nothing.
+ */
+static int
+_cfg_parseline (char *lp, char **pSection, char **pId, char **pValue,
+    char **pComment)
+{
+  int isContinue, inString;
+  char *section;
+  char *id;
+  char *value;
+  char *comment;
+
+  section = id = value = comment = NULL;
+
+  /*
+   *  Skip leading spaces
+   */
+  if (iswhite (*lp))
+    {
+      lp = _cfg_skipwhite (lp);
+      isContinue = 1;
+    }
+  else
+    isContinue = 0;
+
+  /*
+   *  Parse Section
+   */
+  if (*lp == '[')
+    {
+      section = _cfg_skipwhite (lp + 1);
+      if ((lp = strchr (section, ']')) == NULL)
+	return 0;
+      *lp++ = 0;
+      if (rtrim (section) == NULL)
+	return 0;
+      lp = _cfg_skipwhite (lp);
+    }
+  else if (*lp != ';')
+    {
+      /* Try to parse
+       *   1. Key = Value
+       *   2. Value (iff isContinue)
+       */
+      if (!isContinue)
+	{
+	  /* Parse `<Key> = ..' */
+	  id = lp;
+	  if ((lp = strchr (id, '=')) == NULL)
+	    return 0;
+	  *lp++ = 0;
+	  rtrim (id);
+	  lp = _cfg_skipwhite (lp);
+	}
+
+      /* Parse value */
+      inString = 0;
+      value = lp;
+      while (*lp)
+	{
+	  if (inString)
+	    {
+	      if (*lp == inString)
+		inString = 0;
+	    }
+	  else if (*lp == '"' || *lp == '\'')
+	    inString = *lp;
+	  else if (*lp == ';' && iswhite (lp[-1]))
+	    {
+	      *lp = 0;
+	      comment = lp + 1;
+	      rtrim (value);
+	      break;
+	    }
+	  lp++;
+	}
+    }
+
+  /*
+   *  Parse Comment
+   */
+  if (*lp == ';')
+    comment = lp + 1;
+
+  *pSection = section;
+  *pId = id;
+  *pValue = value;
+  *pComment = comment;
+  return 1;
+}
+
+
+/*
+ *  Is the line at lp, ending at eol, a [section] header?
+ */
+static int
+_cfg_isheader (char *lp, char *eol)
+{
+  char *cp;
+
+  lp = _cfg_skipwhite (lp);
+  if (*lp != '[')
+    return 0;
+  lp = _cfg_skipwhite (lp + 1);
+  if ((cp = (char *) memchr (lp, ']', eol - lp)) == NULL)
+    return 0;
+  for (; lp < cp; lp++)
+    if (!isspace (*lp))
+      return 1;
+  return 0;
+}
+
+
+/*
+ *  Lazy parse: store only the [section] lines, leaving the lines of
+ *  each block to _cfg_load
+ */
+static int
+_cfg_scan (PCONFIG pconfig)
+{
+  char *imgPtr, *endPtr, *lp, *cp;
+  char *section, *id, *value, *comment;
+  PCFGSECT s;
+
+  if ((s = _cfg_newsect (pconfig)) == NULL)
+    return -1;
+  s->body = pconfig->image;
+
+  endPtr = pconfig->image + pconfig->size;
+  for (imgPtr = pconfig->image; imgPtr < endPtr;)
+    {
+      for (lp = imgPtr; *lp && iseolchar (*lp); lp++)
+	;
+      imgPtr = cp = lp + strcspn (lp, "\n\r\x1a");
+      if (!_cfg_isheader (lp, cp))
+	continue;
+
+      /* end the block before at the eol character ahead of this line */
+      s->bodyEnd = lp;
+      if (lp > s->body)
+	*--s->bodyEnd = 0;
+
+      imgPtr = lp;
+      _cfg_getline (&imgPtr, &lp);
+      _cfg_parseline (lp, &section, &id, &value, &comment);
+      if (pconfig->openFlags & CFG_OPEN_LEAN)
+	comment = NULL;
+      if (cfg_storeentry (pconfig, section, NULL, NULL, comment, 0) == -1)
+	return -1;
+      s = pconfig->sections[pconfig->numSections - 1];
+      s->body = imgPtr;
+    }
+  s->bodyEnd = endPtr;
+
+  return 0;
+}
+
+
+/*
+ *  Parse the lines of block s left by _cfg_scan
+ */
+static int
+_cfg_load (PCONFIG pconfig, PCFGSECT s)
+{
+  char *lp;
+  char *section;
+  char *id;
+  char *value;
+  char *comment;
+
+  while (s->body && s->body < s->bodyEnd)
+    {
+      /* room first: the line is cut up as it is parsed, so it has to
+	 be stored then, or lost to the next try */
+      if (s->numEntries == s->maxEntries
+	  && _cfg_reserve (s, s->maxEntries / 2 + 7) == -1)
+	return -1;
+      if (!_cfg_getline (&s->body, &lp)
+	  || !_cfg_parseline (lp, &section, &id, &value, &comment))
+	continue;
+      if (pconfig->openFlags & CFG_OPEN_LEAN)
+	{
+	  if (!value)
+	    continue;
+	  comment = NULL;
+	}
+      _cfg_storeat (pconfig, s, NULL, id, value, comment, 0);
+    }
+  s->body = s->bodyEnd = NULL;
+
+  return 0;
+}
+
+
+/*
+ *  Block pos, parsed; NULL if its lines could not be parsed, which
+ *  are then tried again on the next call
+ */
+static PCFGSECT
+_cfg_sect (PCONFIG pconfig, unsigned int pos)
+{
+  PCFGSECT s = pconfig->sections[pos];
+
+  if (s->body && _cfg_load (pconfig, s) == -1)
+    return NULL;
+  return s;
+}
+
+
+/*
+ *  Parse every block still deferred
+ */
+static int
+_cfg_loadall (PCONFIG pconfig)
+{
+  unsigned int pos;
+
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    if (_cfg_sect (pconfig, pos) == NULL)
+      return -1;
+  return 0;
+}
+
+
+/*
+ *  Parse the in-memory copy of the configuration data
+ */
+static int
+_cfg_parseimage (PCONFIG pconfig)
+{
+  char *imgPtr;
+  char *endPtr;
+  char *packPtr;
+  char *lp;
+  char *section;
+  char *id;
+  char *value;
+  char *comment;
+
+  if (cfg_valid (pconfig))
+    return 0;
+
+  _cfg_presize (pconfig);
+  if (pconfig->openFlags & CFG_OPEN_LAZY)
+    {
+      if (_cfg_scan (pconfig) == -1)
+	{
+	  pconfig->dirty = 1;
+	  return -1;
+	}
+      pconfig->flags |= CFG_VALID;
+      return 0;
+    }
+
+  endPtr = pconfig->image + pconfig->size;
+  packPtr = pconfig->image;
+  for (imgPtr = pconfig->image; imgPtr < endPtr;)
+    {
+      if (!_cfg_getline (&imgPtr, &lp)
+	  || !_cfg_parseline (lp, &section, &id, &value, &comment))
+	continue;
+      if (pconfig->openFlags & CFG_OPEN_LEAN)
+	{
+	  /* keep only the strings in use, moved down in file order */
+	  if (!section && !value)
+	    continue;
+	  comment = NULL;
+	  section = _cfg_packstr (&packPtr, section);
+	  id = _cfg_packstr (&packPtr, id);
+	  value = _cfg_packstr (&packPtr, value);
+	}
+
+      if (cfg_storeentry (pconfig, section, id, value, comment,
+	      0) == -1)
+	{
+	  pconfig->dirty = 1;
+	  return -1;
+	}
+    }
+
+  if (pconfig->openFlags & CFG_OPEN_LEAN)
+    _cfg_pack (pconfig, packPtr - pconfig->image);
+  pconfig->flags |= CFG_VALID;
+
+  return 0;
+}
+
+
+static int
+_cfg_parse (PCONFIG pconfig)
+{
+  int rc;
+
+  CFG_PROBE2 (parse_entry, pconfig->fileName, pconfig->size);
+  rc = _cfg_parseimage (pconfig);
+  CFG_PROBE3 (parse_return, pconfig->fileName, rc, pconfig->numEntries);
+  return rc;
+}
+
+
+int
+cfg_storeentry (
+    PCONFIG pconfig,
+    char *section,
+    char *id,
+    char *value,
+    char *comment,
+    int dynamic)
+{
+  PCFGSECT s;
+
+  if (_cfg_ownspine (pconfig) == -1)
+    return -1;
+
+  /* block 0 holds what comes before the first section */
+  if (pconfig->numSections == 0 && _cfg_newsect (pconfig) == NULL)
+    return -1;
+  if (section && _cfg_newsect (pconfig) == NULL)
+    return -1;
+  if ((s = _cfg_own (pconfig, pconfig->numSections - 1)) == NULL)
+    return -1;
+
+  if (_cfg_storeat (pconfig, s, section, id, value, comment, dynamic) == NULL)
+    return -1;
+  if (section)
+    _cfg_sectinsert (pconfig, pconfig->numSections - 1);
+
+  return 0;
+}
+
+
+/*
+ *  Append an entry to block s
+ */
+static PCFGENTRY
+_cfg_storeat (
+    PCONFIG pconfig,
+    PCFGSECT s,
+    char *section,
+    char *id,
+    char *value,
+    char *comment,
+    int dynamic)
+{
+  PCFGENTRY data;
+
+  if ((data = _cfg_poolalloc (pconfig, s, 1)) == NULL)
+    return NULL;
+
+  data->flags = 0;
+  if (dynamic)
     {
       if (section)
 	section = strdup (section);
       if (id)
 	id = strdup (id);
       if (value)
-	value = strdup (value);
-      if (comment)
-	comment = strdup (value);
+	value = strdup (value);
+      if (comment)
+	comment = strdup (comment);
+
+      if (section)
+	data->flags |= CFE_MUST_FREE_SECTION;
+      if (id)
+	data->flags |= CFE_MUST_FREE_ID;
+      if (value)
+	data->flags |= CFE_MUST_FREE_VALUE;
+      if (comment)
+	data->flags |= CFE_MUST_FREE_COMMENT;
+    }
+
+  data->section = section;
+  data->id = id;
+  data->value = value;
+  data->comment = comment;
+  data->expanded = NULL;
+  data->list = NULL;
+  data->source = 0;
+  data->valueCap = 0;
+
+  if (!section && id && value)
+    {
+      _cfg_keyinsert (s, s->numEntries - 1);
+      _cfg_dropkeyorder (s);
+    }
+
+  return data;
+}
+
+
+/*
+ *  Make room for count more entries at the end of block s
+ */
+static PCFGENTRY
+_cfg_poolalloc (PCONFIG p, PCFGSECT s, unsigned int count)
+{
+  PCFGENTRY newBase;
+  unsigned int newMax;
+
+  if (s->numEntries + count > s->maxEntries)
+    {
+      newMax = s->maxEntries ? count + s->maxEntries + s->maxEntries / 2 :
+	  count + 7;
+      if (_cfg_resize (s, newMax) == -1)
+	return NULL;
+    }
+
+  newBase = &s->entries[s->numEntries];
+  s->numEntries += count;
+  __atomic_add_fetch (&p->numEntries, count, __ATOMIC_RELAXED);
+  /* a slot freed by a delete and taken again is not more of the slab */
+  if ((s->flags & CFS_SLAB) && s->entries + s->numEntries > p->slab
+      + p->slabUsed)
+    p->slabUsed = s->entries + s->numEntries - p->slab;
+
+  return newBase;
+}
+
+
+/*
+ *  Give block s room for max entries. Blocks in the slab move out of
+ *  it into their own array; the rest grow with realloc, which for
+ *  large arrays remaps the pages instead of copying them.
+ */
+static int
+_cfg_resize (PCFGSECT s, unsigned int max)
+{
+  PCFGENTRY newBase;
+
+  if (s->flags & CFS_SLAB)
+    {
+      if ((newBase = (PCFGENTRY) malloc (max * sizeof (TCFGENTRY))) == NULL)
+	return -1;
+      memcpy (newBase, s->entries, s->numEntries * sizeof (TCFGENTRY));
+      s->flags &= ~CFS_SLAB;
+    }
+  else if ((newBase = (PCFGENTRY) realloc (s->entries,
+	      max * sizeof (TCFGENTRY))) == NULL)
+    return -1;
+  s->entries = newBase;
+  s->maxEntries = max;
+  return 0;
+}
+
+
+/*
+ *  Append an empty block to the configuration. While parsing, the
+ *  block takes the rest of the slab, and the block before it is cut
+ *  down to the entries it has.
+ */
+static PCFGSECT
+_cfg_newsect (PCONFIG p)
+{
+  PCFGSECT *newBase, s;
+  unsigned int newMax;
+
+  if (p->numSections >= p->maxSections)
+    {
+      newMax = p->maxSections ? p->maxSections * 2 : 16;
+      newBase = (PCFGSECT *) realloc (p->sections, newMax * sizeof (PCFGSECT));
+      if (newBase == NULL)
+	return NULL;
+      p->sections = newBase;
+      p->maxSections = newMax;
+    }
+  if ((s = (PCFGSECT) calloc (1, sizeof (TCFGSECT))) == NULL)
+    return NULL;
+  s->refs = 1;
+  if (p->slab && !cfg_valid (p))
+    {
+      if (p->numSections && (p->sections[p->numSections - 1]->flags & CFS_SLAB))
+	p->sections[p->numSections - 1]->maxEntries =
+	    p->sections[p->numSections - 1]->numEntries;
+      s->entries = p->slab + p->slabUsed;
+      s->maxEntries = p->slabSize - p->slabUsed;
+      s->flags = CFS_SLAB;
+    }
+  p->sections[p->numSections++] = s;
+
+  return s;
+}
+
+
+static void
+_cfg_freeentry (PCFGENTRY e)
+{
+  if (e->flags & CFE_MUST_FREE_SECTION)
+    free (e->section);
+  if (e->flags & CFE_MUST_FREE_ID)
+    free (e->id);
+  if (e->flags & CFE_MUST_FREE_VALUE)
+    free (e->value);
+  if (e->flags & CFE_MUST_FREE_COMMENT)
+    free (e->comment);
+  if (e->expanded)
+    free (e->expanded);
+  if (e->list)
+    free (e->list);
+}
+
+
+static void
+_cfg_freesect (PCFGSECT s)
+{
+  unsigned int i;
+
+  for (i = 0; i < s->numEntries; i++)
+    _cfg_freeentry (&s->entries[i]);
+  if (!(s->flags & CFS_SLAB))
+    free (s->entries);
+  free (s->keyIndex);
+  free (s->keyOrder);
+  free (s);
+}
+
+
+/*
+ *  Remove entries [first, last) of block s
+ */
+static void
+_cfg_delentries (PCONFIG p, PCFGSECT s, unsigned int first,
+    unsigned int last)
+{
+  unsigned int i;
+
+  if (first >= last)
+    return;
+  for (i = first; i < last; i++)
+    _cfg_freeentry (&s->entries[i]);
+  memmove (&s->entries[first], &s->entries[last],
+      (s->numEntries - last) * sizeof (TCFGENTRY));
+  s->numEntries -= last - first;
+  __atomic_sub_fetch (&p->numEntries, last - first, __ATOMIC_RELAXED);
+
+  /* indices moved: rebuild the key index on the next lookup */
+  free (s->keyIndex);
+  s->keyIndex = NULL;
+  s->keySize = s->numKeys = 0;
+  _cfg_dropkeyorder (s);
+}
+
+
+/*** INDEX MODULE ****/
+
+
+/*
+ *  Add block pos to the section name index, unless an earlier
+ *  section of the same name is there already
+ */
+static void
+_cfg_sectinsert (PCONFIG p, unsigned int pos)
+{
+  unsigned int *newIndex, mask, h, i, n;
+  char *section = p->sections[pos]->entries[0].section;
+
+  _cfg_dropsectorder (p);
+  if (2 * p->numSections > p->sectSize)
+    {
+      for (n = p->sectSize ? p->sectSize * 2 : 64; n < 2 * p->numSections;)
+	n *= 2;
+      if ((newIndex = (unsigned int *) calloc (n, sizeof (unsigned int)))
+	  == NULL)
+	{
+	  /* no index: lookups fall back to a scan */
+	  free (p->sectIndex);
+	  p->sectIndex = NULL;
+	  p->sectSize = 0;
+	  return;
+	}
+      free (p->sectIndex);
+      p->sectIndex = newIndex;
+      p->sectSize = n;
+      for (i = 1; i < pos; i++)
+	_cfg_sectinsert (p, i);
+    }
+
+  mask = p->sectSize - 1;
+  h = _cfg_hashstr (2166136261u, section);
+  for (i = h & mask; p->sectIndex[i]; i = (i + 1) & mask)
+    if (!strcasecmp (p->sections[p->sectIndex[i]]->entries[0].section,
+	    section))
+      return;
+  p->sectIndex[i] = pos;
+}
+
+
+/*
+ *  Rebuild the section name index after blocks moved
+ */
+static void
+_cfg_sectreindex (PCONFIG p)
+{
+  unsigned int pos;
+
+  _cfg_dropsectorder (p);
+  if (p->sectIndex)
+    memset (p->sectIndex, 0, p->sectSize * sizeof (unsigned int));
+  for (pos = 1; pos < p->numSections; pos++)
+    _cfg_sectinsert (p, pos);
+}
+
+
+/*
+ *  Returns the position of the first block named section, 0 if none
+ */
+static unsigned int
+_cfg_sectfind (PCONFIG p, const char *section)
+{
+  unsigned int mask, i;
+
+  if (p->sectIndex == NULL)
+    {
+      for (i = 1; i < p->numSections; i++)
+	if (!strcasecmp (p->sections[i]->entries[0].section, section))
+	  return i;
+      return 0;
+    }
+
+  mask = p->sectSize - 1;
+  for (i = _cfg_hashstr (2166136261u, section) & mask; p->sectIndex[i];
+      i = (i + 1) & mask)
+    if (!strcasecmp (p->sections[p->sectIndex[i]]->entries[0].section,
+	    section))
+      return p->sectIndex[i];
+  return 0;
+}
+
+
+/*
+ *  Add entry idx of block s to its key index, if the index is built;
+ *  the first of several equal keys wins
+ */
+static void
+_cfg_keyinsert (PCFGSECT s, unsigned int idx)
+{
+  unsigned int *newIndex, mask, i, n;
+  char *id = s->entries[idx].id;
+
+  if (s->keyIndex == NULL)
+    return;
+  if (2 * (s->numKeys + 1) > s->keySize)
+    {
+      for (n = s->keySize * 2; n < 2 * (s->numKeys + 1);)
+	n *= 2;
+      if ((newIndex = (unsigned int *) calloc (n, sizeof (unsigned int)))
+	  == NULL)
+	{
+	  free (s->keyIndex);
+	  s->keyIndex = NULL;
+	  s->keySize = s->numKeys = 0;
+	  return;
+	}
+      mask = n - 1;
+      for (i = 0; i < s->keySize; i++)
+	if (s->keyIndex[i])
+	  {
+	    unsigned int j = _cfg_idhash (2166136261u,
+		s->entries[s->keyIndex[i] - 1].id) & mask;
+
+	    while (newIndex[j])
+	      j = (j + 1) & mask;
+	    newIndex[j] = s->keyIndex[i];
+	  }
+      free (s->keyIndex);
+      s->keyIndex = newIndex;
+      s->keySize = n;
+    }
+
+  mask = s->keySize - 1;
+  for (i = _cfg_idhash (2166136261u, id) & mask; s->keyIndex[i];
+      i = (i + 1) & mask)
+    if (!_cfg_idcmp (s->entries[s->keyIndex[i] - 1].id, id))
+      return;
+  s->keyIndex[i] = idx + 1;
+  s->numKeys++;
+}
+
+
+/*
+ *  Build the key index of block s if it is large enough to want one.
+ *  Returns -1 on no memory.
+ */
+static int
+_cfg_keyindex (PCFGSECT s)
+{
+  unsigned int i;
+
+  if (s->keyIndex || s->numEntries < CFG_INDEX_MIN)
+    return 0;
+  for (i = 16; i < 2 * s->numEntries; i *= 2)
+    ;
+  if ((s->keyIndex = (unsigned int *) calloc (i, sizeof (unsigned int)))
+      == NULL)
+    return -1;
+  s->keySize = i;
+  s->numKeys = 0;
+  for (i = 0; i < s->numEntries; i++)
+    if (s->entries[i].id && s->entries[i].value)
+      _cfg_keyinsert (s, i);
+  return 0;
+}
+
+
+/*
+ *  Returns the index of key id in block s, -1 if none.
+ *  Large blocks get a key index on their first lookup.
+ */
+static int
+_cfg_keyfind (PCFGSECT s, const char *id)
+{
+  unsigned int mask, i;
+  PCFGENTRY e;
+
+  _cfg_keyindex (s);
+  if (s->keyIndex == NULL)
+    {
+      for (i = 0, e = s->entries; i < s->numEntries; i++, e++)
+	if (e->id && e->value && !_cfg_idcmp (e->id, id))
+	  return i;
+      return -1;
+    }
+
+  mask = s->keySize - 1;
+  for (i = _cfg_idhash (2166136261u, id) & mask; s->keyIndex[i];
+      i = (i + 1) & mask)
+    if (!_cfg_idcmp (s->entries[s->keyIndex[i] - 1].id, id))
+      return s->keyIndex[i] - 1;
+  return -1;
+}
+
+
+/*** ORDER MODULE ****/
+
+
+/* sort key of one section or key while building an order array */
+typedef struct
+  {
+    const char *name;
+    unsigned int pos;
+  }
+TCFGSORT;
+
+/* last generation given to an order array; each array built gets a new
+   one, so a walk can tell a rebuilt array that malloc placed at the
+   address of the old one */
+static unsigned int _cfg_ordergen;
+
+
+/*
+ *  Order of ids, ignoring case and quotes like _cfg_idcmp; only the
+ *  first n characters of id count
+ */
+static int
+_cfg_idorder (const char *entryId, const char *id, size_t n)
+{
+  int c1, c2;
+
+  while (*entryId == '\'' || *entryId == '\"')
+    entryId++;
+  while (*id == '\'' || *id == '\"')
+    id++;
+
+  for (; n; n--)
+    {
+      c1 = *entryId == '\'' || *entryId == '\"' ? 0
+	  : tolower ((unsigned char) *entryId);
+      c2 = *id == '\'' || *id == '\"' ? 0 : tolower ((unsigned char) *id);
+      if (c1 != c2 || c1 == 0)
+	return c1 - c2;
+      entryId++;
+      id++;
+    }
+  return 0;
+}
+
+
+static int
+_cfg_sectsort (const void *a, const void *b)
+{
+  return strcasecmp (((const TCFGSORT *) a)->name,
+      ((const TCFGSORT *) b)->name);
+}
+
+
+static int
+_cfg_keysort (const void *a, const void *b)
+{
+  return _cfg_idorder (((const TCFGSORT *) a)->name,
+      ((const TCFGSORT *) b)->name, (size_t) -1);
+}
+
+
+/*
+ *  Sort count names into order[]
+ */
+static unsigned int *
+_cfg_sortorder (TCFGSORT *sort, unsigned int count,
+    int (*compare) (const void *, const void *))
+{
+  unsigned int *order, i;
+
+  if ((order = (unsigned int *) malloc ((count ? count : 1)
+	      * sizeof (unsigned int))) == NULL)
+    return NULL;
+  qsort (sort, count, sizeof (TCFGSORT), compare);
+  for (i = 0; i < count; i++)
+    order[i] = sort[i].pos;
+  return order;
+}
+
+
+/*
+ *  Block positions by section name, built on first use. A name
+ *  repeated later in the file is left out, as lookups do not see it.
+ */
+static int
+_cfg_sectorder (PCONFIG p)
+{
+  TCFGSORT *sort;
+  unsigned int pos, n = 0;
+
+  if (p->sectOrder)
+    return 0;
+  if ((sort = (TCFGSORT *) malloc (p->numSections * sizeof (TCFGSORT)))
+      == NULL)
+    return -1;
+  for (pos = 1; pos < p->numSections; pos++)
+    if (_cfg_sectfind (p, p->sections[pos]->entries[0].section) == pos)
+      {
+	sort[n].name = p->sections[pos]->entries[0].section;
+	sort[n++].pos = pos;
+      }
+  p->sectOrder = _cfg_sortorder (sort, n, _cfg_sectsort);
+  p->numSectOrder = n;
+  p->sectOrderGen = __atomic_add_fetch (&_cfg_ordergen, 1, __ATOMIC_RELAXED);
+  free (sort);
+  return p->sectOrder ? 0 : -1;
+}
+
+
+/*
+ *  Entry indexes of block s by key, built on first use; the first of
+ *  equal keys only
+ */
+static int
+_cfg_keyorder (PCFGSECT s)
+{
+  TCFGSORT *sort;
+  unsigned int i, n = 0;
+
+  if (s->keyOrder)
+    return 0;
+  if ((sort = (TCFGSORT *) malloc ((s->numEntries ? s->numEntries : 1)
+	      * sizeof (TCFGSORT))) == NULL)
+    return -1;
+  for (i = 1; i < s->numEntries; i++)
+    if (s->entries[i].id && s->entries[i].value
+	&& _cfg_keyfind (s, s->entries[i].id) == (int) i)
+      {
+	sort[n].name = s->entries[i].id;
+	sort[n++].pos = i;
+      }
+  s->keyOrder = _cfg_sortorder (sort, n, _cfg_keysort);
+  s->numOrdered = n;
+  s->orderGen = __atomic_add_fetch (&_cfg_ordergen, 1, __ATOMIC_RELAXED);
+  free (sort);
+  return s->keyOrder ? 0 : -1;
+}
+
+
+static void
+_cfg_dropkeyorder (PCFGSECT s)
+{
+  free (s->keyOrder);
+  s->keyOrder = NULL;
+  s->numOrdered = 0;
+}
+
+
+static void
+_cfg_dropsectorder (PCONFIG p)
+{
+  free (p->sectOrder);
+  p->sectOrder = NULL;
+  p->numSectOrder = 0;
+}
+
+
+/*
+ *  First slot of the order array whose name is not below key (upper:
+ *  above key), comparing the first n characters; binary search
+ */
+static unsigned int
+_cfg_bound (PCONFIG p, PCFGSECT s, const char *key, size_t n, int upper)
+{
+  unsigned int lo = 0, hi, mid;
+  const char *name;
+  int c;
+
+  hi = s ? s->numOrdered : p->numSectOrder;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (s)
+	{
+	  name = s->entries[s->keyOrder[mid]].id;
+	  c = _cfg_idorder (name, key, n);
+	}
+      else
+	{
+	  name = p->sections[p->sectOrder[mid]]->entries[0].section;
+	  c = n == (size_t) -1 ? strcasecmp (name, key)
+	      : strncasecmp (name, key, n);
+	}
+      if (c < 0 || (upper && c == 0))
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+
+/*
+ *  Set up it for the names in [from, to), or starting with prefix
+ *  if to is NULL and prefix is set
+ */
+static int
+_cfg_iterinit (PCONFIG pconfig, PCFGITER it, const char *section,
+    const char *from, const char *to, const char *prefix)
+{
+  PCFGSECT s = NULL;
+  unsigned int pos = 0, count;
+
+  memset (it, 0, sizeof (TCFGITER));
+  if (!cfg_valid (pconfig))
+    return -1;
+
+  if (section)
+    {
+      if ((pos = _cfg_sectfind (pconfig, section)) == 0)
+	return -1;
+      if ((s = _cfg_sect (pconfig, pos)) == NULL
+	  || _cfg_keyorder (s) == -1)
+	return -1;
+      count = s->numOrdered;
+      it->order = s->keyOrder;
+      it->gen = s->orderGen;
+    }
+  else
+    {
+      if (_cfg_sectorder (pconfig) == -1)
+	return -1;
+      count = pconfig->numSectOrder;
+      it->order = pconfig->sectOrder;
+      it->gen = pconfig->sectOrderGen;
+    }
+
+  it->pconfig = pconfig;
+  it->pos = pos;
+  if (prefix)
+    {
+      it->cur = _cfg_bound (pconfig, s, prefix, strlen (prefix), 0);
+      it->end = _cfg_bound (pconfig, s, prefix, strlen (prefix), 1);
+      return 0;
+    }
+  it->cur = from ? _cfg_bound (pconfig, s, from, (size_t) -1, 0) : 0;
+  it->end = to ? _cfg_bound (pconfig, s, to, (size_t) -1, 0) : count;
+  if (it->end < it->cur)
+    it->end = it->cur;
+  return 0;
+}
+
+
+int
+cfg_sections_range (PCONFIG pconfig, PCFGITER it, const char *from,
+    const char *to)
+{
+  return _cfg_iterinit (pconfig, it, NULL, from, to, NULL);
+}
+
+
+int
+cfg_sections_prefix (PCONFIG pconfig, PCFGITER it, const char *prefix)
+{
+  return _cfg_iterinit (pconfig, it, NULL, NULL, NULL, prefix ? prefix : "");
+}
+
+
+int
+cfg_keys_range (PCONFIG pconfig, PCFGITER it, const char *section,
+    const char *from, const char *to)
+{
+  if (section == NULL)
+    return -1;
+  return _cfg_iterinit (pconfig, it, section, from, to, NULL);
+}
+
+
+int
+cfg_keys_prefix (PCONFIG pconfig, PCFGITER it, const char *section,
+    const char *prefix)
+{
+  if (section == NULL)
+    return -1;
+  return _cfg_iterinit (pconfig, it, section, NULL, NULL,
+      prefix ? prefix : "");
+}
+
+
+/*
+ *  Step to the next name; the walk ends early if the handle changed
+ *  since it started
+ */
+int
+cfg_iter_next (PCFGITER it)
+{
+  PCONFIG pconfig = it->pconfig;
+  PCFGSECT s;
+  PCFGENTRY e;
+  char *value, *scratch;
+
+  if (pconfig == NULL)
+    return -1;
+  if (it->walk)
+    return _cfg_walknext (it);
+  if (it->cur >= it->end)
+    return -1;
+
+  if (it->pos == 0)
+    {
+      if (pconfig->sectOrder == NULL || pconfig->sectOrderGen != it->gen
+	  || it->cur >= pconfig->numSectOrder)
+	return -1;
+      s = pconfig->sections[pconfig->sectOrder[it->cur++]];
+      it->section = s->entries[0].section;
+      it->id = it->value = NULL;
+      return 0;
+    }
+
+  if (it->pos >= pconfig->numSections
+      || (s = pconfig->sections[it->pos])->keyOrder == NULL
+      || s->orderGen != it->gen || it->cur >= s->numOrdered)
+    return -1;
+  e = &s->entries[s->keyOrder[it->cur++]];
+  it->section = s->entries[0].section;
+  it->id = e->id;
+
+  /* expanded like cfg_find, in the same scratch */
+  if ((value = _cfg_expand (pconfig, s, e, it->section, 0,
+	      &scratch)) == NULL)
+    value = e->value;
+  else
+    {
+      free (pconfig->scratch);
+      pconfig->scratch = scratch;
+    }
+  it->value = value;
+  return 0;
+}
+
+
+/*** ITERATOR MODULE ****/
+
+
+/* what a file order walk goes over, in TCFGITER.walk */
+#define CFG_WALK_SECTIONS	1
+#define CFG_WALK_KEYS		2
+#define CFG_WALK_ENTRIES	3
+
+
+/* shared state of one cfg_for_each_section call */
+typedef struct TCFGEACH
+  {
+    PCONFIG pconfig;
+    cfg_section_t fn;
+    void *arg;
+    unsigned int next;		/* Next block to hand out */
+    int rc;			/* First non-zero result of fn */
+  }
+TCFGEACH;
+
+/* a thread of cfg_for_each_section and the handle it reads through */
+typedef struct TCFGEACHWORKER
+  {
+    TCFGEACH *each;
+    PCONFIG view;
+    pthread_t thread;
+  }
+TCFGEACHWORKER;
+
+
+int
+cfg_sections_begin (PCONFIG pconfig, PCFGITER it)
+{
+  memset (it, 0, sizeof (TCFGITER));
+  if (!cfg_valid (pconfig))
+    return -1;
+
+  it->pconfig = pconfig;
+  it->walk = CFG_WALK_SECTIONS;
+  it->cur = 1;
+  return 0;
+}
+
+
+int
+cfg_keys_begin (PCONFIG pconfig, PCFGITER it, const char *section)
+{
+  memset (it, 0, sizeof (TCFGITER));
+  if (!cfg_valid (pconfig) || section == NULL)
+    return -1;
+  if ((it->pos = _cfg_sectfind (pconfig, section)) == 0)
+    return -1;
+
+  it->pconfig = pconfig;
+  it->walk = CFG_WALK_KEYS;
+  it->cur = 1;
+  return 0;
+}
+
+
+int
+cfg_entries_begin (PCONFIG pconfig, PCFGITER it)
+{
+  memset (it, 0, sizeof (TCFGITER));
+  if (!cfg_valid (pconfig))
+    return -1;
+
+  it->pconfig = pconfig;
+  it->walk = CFG_WALK_ENTRIES;
+  return 0;
+}
+
+
+/*
+ *  Step a file order walk; the position is only kept in it, and checked
+ *  against the handle on every step, so a walk that outlives a write or
+ *  reload may skip or repeat but never reads past the end
+ */
+static int
+_cfg_walknext (PCFGITER it)
+{
+  PCONFIG pconfig = it->pconfig;
+  PCFGSECT s;
+  PCFGENTRY e;
+  char *value, *scratch;
+
+  it->id = it->value = NULL;
+  it->flags = 0;
+  if (!cfg_valid (pconfig))
+    return -1;
+
+  switch (it->walk)
+    {
+    case CFG_WALK_SECTIONS:
+      /* a repeated section is left out, as lookups do not see it */
+      while (it->cur < pconfig->numSections)
+	{
+	  s = pconfig->sections[it->cur++];
+	  if (_cfg_sectfind (pconfig, s->entries[0].section) == it->cur - 1)
+	    {
+	      it->section = s->entries[0].section;
+	      it->flags = CFG_SECTION;
+	      return 0;
+	    }
+	}
+      return -1;
+
+    case CFG_WALK_KEYS:
+      if (it->pos >= pconfig->numSections
+	  || (s = _cfg_sect (pconfig, it->pos)) == NULL)
+	return -1;
+      while (it->cur < s->numEntries)
+	{
+	  e = &s->entries[it->cur++];
+	  if (e->id == NULL || e->value == NULL)
+	    continue;
+	  it->section = s->entries[0].section;
+	  it->id = e->id;
+	  it->flags = CFG_DEFINE;
+	  if ((value = _cfg_expand (pconfig, s, e, it->section, 0,
+		      &scratch)) == NULL)
+	    value = e->value;
+	  else
+	    {
+	      free (pconfig->scratch);
+	      pconfig->scratch = scratch;
+	    }
+	  it->value = value;
+	  return 0;
+	}
+      return -1;
+
+    case CFG_WALK_ENTRIES:
+      /* the same steps as cfg_nextentry, with the cursor kept in it */
+      while (it->pos < pconfig->numSections)
+	{
+	  if ((s = _cfg_sect (pconfig, it->pos)) == NULL)
+	    return -1;
+	  if (it->cur >= s->numEntries)
+	    {
+	      it->pos++;
+	      it->cur = 0;
+	      continue;
+	    }
+	  e = &s->entries[it->cur++];
+	  if (e->section)
+	    {
+	      it->section = e->section;
+	      it->flags = CFG_SECTION;
+	      return 0;
+	    }
+	  if (e->value)
+	    {
+	      it->section = it->pos ? s->entries[0].section : NULL;
+	      it->value = e->value;
+	      if (e->id)
+		{
+		  it->id = e->id;
+		  it->flags = CFG_DEFINE;
+		}
+	      else
+		it->flags = CFG_CONTINUE;
+	      return 0;
+	    }
+	}
+      return -1;
+    }
+  return -1;
+}
+
+
+/*
+ *  Hand out the next section to fn until none is left or one fails
+ */
+static void
+_cfg_eachrun (TCFGEACH *each, PCONFIG view)
+{
+  unsigned int pos;
+  char *section;
+  int rc, none;
+
+  while (__atomic_load_n (&each->rc, __ATOMIC_RELAXED) == 0)
+    {
+      pos = __atomic_fetch_add (&each->next, 1, __ATOMIC_RELAXED);
+      if (pos >= view->numSections)
+	return;
+      section = view->sections[pos]->entries[0].section;
+      if (_cfg_sectfind (view, section) != pos)
+	continue;
+      if ((rc = each->fn (view, section, each->arg)) != 0)
+	{
+	  none = 0;
+	  __atomic_compare_exchange_n (&each->rc, &none, rc, 0,
+	      __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	  return;
+	}
+    }
+}
+
+
+static void *
+_cfg_eachwork (void *arg)
+{
+  TCFGEACHWORKER *w = (TCFGEACHWORKER *) arg;
+
+  _cfg_eachrun (w->each, w->view);
+  return NULL;
+}
+
+
+int
+cfg_for_each_section (PCONFIG pconfig, cfg_section_t fn, void *arg,
+    int numThreads)
+{
+  TCFGEACH each;
+  TCFGEACHWORKER *workers = NULL;
+  unsigned int i, n = 0, started = 0;
+  long cpus;
+
+  if (!cfg_valid (pconfig) || fn == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  memset (&each, 0, sizeof (each));
+  each.pconfig = pconfig;
+  each.fn = fn;
+  each.arg = arg;
+  each.next = 1;
+
+  if (numThreads <= 0)
+    {
+      cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      numThreads = cpus < 1 ? 1 : (int) cpus;
+    }
+  if ((unsigned int) numThreads >= pconfig->numSections)
+    numThreads = pconfig->numSections > 1 ? pconfig->numSections - 1 : 1;
+
+  /* every other thread reads through a clone of its own, all made
+     before any thread runs; a directory handle cannot be cloned and
+     is walked by the calling thread alone */
+  if (numThreads > 1 && pconfig->dir == NULL)
+    workers = (TCFGEACHWORKER *) malloc ((numThreads - 1)
+	* sizeof (TCFGEACHWORKER));
+  for (; workers && n < (unsigned int) numThreads - 1; n++)
+    {
+      workers[n].each = &each;
+      if (cfg_clone (pconfig, &workers[n].view) == -1)
+	break;
+    }
+  for (; started < n; started++)
+    if (pthread_create (&workers[started].thread, NULL, _cfg_eachwork,
+	    &workers[started]) != 0)
+      break;
+
+  /* the calling thread takes sections too, and all if no thread started */
+  _cfg_eachrun (&each, pconfig);
+  for (i = 0; i < started; i++)
+    pthread_join (workers[i].thread, NULL);
+  for (i = 0; i < n; i++)
+    cfg_done (workers[i].view);
+  free (workers);
+
+  return each.rc;
+}
+
+
+/*** COMPATIBILITY LAYER ***/
+
+
+int
+cfg_rewind (PCONFIG pconfig)
+{
+  if (!cfg_valid (pconfig))
+    return -1;
+
+  pconfig->flags = CFG_VALID;
+  pconfig->sectCursor = 0;
+  pconfig->cursor = 0;
+
+  return 0;
+}
+
+
+/*
+ *  returns:
+ *	 0 success
+ *	-1 no next entry
+ *
+ *	section	id	value	flags		meaning
+ *	!0	0	!0	SECTION		[value]
+ *	!0	!0	!0	DEFINE		id = value|id="value"|id='value'
+ *	!0	0	!0	0		value
+ *	0	0	0	EOF		end of file encountered
+ */
+int
+cfg_nextentry (PCONFIG pconfig)
+{
+  PCFGSECT s;
+  PCFGENTRY e;
+
+  if (!cfg_valid (pconfig) || cfg_eof (pconfig))
+    return -1;
+
+  pconfig->flags &= ~(CFG_TYPEMASK);
+  pconfig->id = pconfig->value = NULL;
+
+  while (1)
+    {
+      if (pconfig->sectCursor >= pconfig->numSections)
+	{
+	  pconfig->flags |= CFG_EOF;
+	  return -1;
+	}
+      if ((s = _cfg_sect (pconfig, pconfig->sectCursor)) == NULL)
+	return -1;
+      if (pconfig->cursor >= s->numEntries)
+	{
+	  pconfig->sectCursor++;
+	  pconfig->cursor = 0;
+	  continue;
+	}
+      e = &s->entries[pconfig->cursor++];
+
+      if (e->section)
+	{
+	  pconfig->section = e->section;
+	  pconfig->flags |= CFG_SECTION;
+	  return 0;
+	}
+      if (e->value)
+	{
+	  pconfig->value = e->value;
+	  if (e->id)
+	    {
+	      pconfig->id = e->id;
+	      pconfig->flags |= CFG_DEFINE;
+	    }
+	  else
+	    pconfig->flags |= CFG_CONTINUE;
+	  return 0;
+	}
+    }
+}
+
+
+/*
+ *  Locate a definition without touching the iteration cursor
+ */
+static PCFGENTRY
+_cfg_findentry (PCONFIG pconfig, const char *section, const char *id,
+    PCFGSECT *ps)
+{
+  PCFGSECT s;
+  unsigned int pos;
+  int idx;
+
+  if ((pos = _cfg_sectfind (pconfig, section)) == 0
+      || (s = _cfg_sect (pconfig, pos)) == NULL)
+    return NULL;
+  if ((idx = _cfg_keyfind (s, id)) < 0)
+    return NULL;
+  if (ps)
+    *ps = s;
+  return &s->entries[idx];
+}
+
+
+/*
+ *  Position the cursor on section:id, or on [section] if id is NULL
+ */
+static int
+_cfg_find (PCONFIG pconfig, char *section, char *id)
+{
+  PCFGSECT s;
+  PCFGENTRY e;
+  unsigned int pos;
+  char *value, *scratch;
+  int idx;
+
+  if (!cfg_valid (pconfig) || cfg_rewind (pconfig))
+    return -1;
+
+  if ((pos = _cfg_sectfind (pconfig, section)) == 0
+      || (s = _cfg_sect (pconfig, pos)) == NULL)
+    return -1;
+  pconfig->section = s->entries[0].section;
+
+  if (id == NULL)
+    {
+      pconfig->sectCursor = pos;
+      pconfig->cursor = 1;
+      pconfig->flags |= CFG_SECTION;
+      return 0;
+    }
+
+  if ((idx = _cfg_keyfind (s, id)) < 0)
+    return -1;
+  e = &s->entries[idx];
+  if ((value = _cfg_expand (pconfig, s, e, pconfig->section, 0,
+	      &scratch)) == NULL)
+    return -1;
+  free (pconfig->scratch);
+  pconfig->scratch = scratch;
+
+  pconfig->sectCursor = pos;
+  pconfig->cursor = idx + 1;
+  pconfig->flags |= CFG_DEFINE;
+  pconfig->id = e->id;
+  pconfig->value = value;
+  return 0;
+}
+
+
+int
+cfg_find (PCONFIG pconfig, char *section, char *id)
+{
+  int rc;
+
+  CFG_PROBE2 (find_entry, section, id);
+  rc = _cfg_find (pconfig, section, id);
+  CFG_PROBE3 (find_return, section, id, rc);
+  return rc;
+}
+
+
+/*** EXPANSION MODULE ****/
+
+
+/*
+ *  Remember that the expansion of section:id used refSection:refId,
+ *  so that a write to the latter can drop the cached expansion
+ */
+static int
+_cfg_adddep (PCONFIG pconfig, const char *refSection, const char *refId,
+    const char *section, const char *id)
+{
+  PCFGDEP d, next, *newTable;
+  unsigned int h, i, newSize;
+
+  h = _cfg_keyhash (refSection, refId);
+  if (pconfig->depTable)
+    for (d = pconfig->depTable[h % pconfig->depSize]; d; d = d->next)
+      if (d->hash == h && !strcasecmp (d->refSection, refSection)
+	  && !strcasecmp (d->refId, refId)
+	  && !strcasecmp (d->section, section) && !strcasecmp (d->id, id))
+	return 0;
+
+  if (pconfig->numDeps >= pconfig->depSize)
+    {
+      newSize = pconfig->depSize ? pconfig->depSize * 2 : 64;
+      newTable = (PCFGDEP *) calloc (newSize, sizeof (PCFGDEP));
+      if (newTable == NULL)
+	return -1;
+      for (i = 0; i < pconfig->depSize; i++)
+	for (d = pconfig->depTable[i]; d; d = next)
+	  {
+	    next = d->next;
+	    d->next = newTable[d->hash % newSize];
+	    newTable[d->hash % newSize] = d;
+	  }
+      free (pconfig->depTable);
+      pconfig->depTable = newTable;
+      pconfig->depSize = newSize;
+    }
+
+  if ((d = (PCFGDEP) calloc (1, sizeof (TCFGDEP))) == NULL)
+    return -1;
+  d->hash = h;
+  d->refSection = strdup (refSection);
+  d->refId = strdup (refId);
+  d->section = strdup (section);
+  d->id = strdup (id);
+  if (!d->refSection || !d->refId || !d->section || !d->id)
+    {
+      free (d->refSection);
+      free (d->refId);
+      free (d->section);
+      free (d->id);
+      free (d);
+      return -1;
+    }
+  d->next = pconfig->depTable[h % pconfig->depSize];
+  pconfig->depTable[h % pconfig->depSize] = d;
+  pconfig->numDeps++;
+
+  return 0;
+}
+
+
+static void
+_cfg_freedeps (PCONFIG pconfig)
+{
+  PCFGDEP d, next;
+  unsigned int i;
+
+  for (i = 0; i < pconfig->depSize; i++)
+    for (d = pconfig->depTable[i]; d; d = next)
+      {
+	next = d->next;
+	free (d->refSection);
+	free (d->refId);
+	free (d->section);
+	free (d->id);
+	free (d);
+      }
+  free (pconfig->depTable);
+  pconfig->depTable = NULL;
+  pconfig->depSize = pconfig->numDeps = 0;
+}
+
+
+/*
+ *  Forget the cached expansion of an entry, and its split
+ */
+static void
+_cfg_dropcache (PCFGENTRY e)
+{
+  if (e->expanded)
+    {
+      free (e->expanded);
+      e->expanded = NULL;
+    }
+  if (e->list)
+    {
+      free (e->list);
+      e->list = NULL;
+    }
+  e->flags &= ~CFE_PLAIN;
+}
+
+
+/*
+ *  Drop the cached expansions depending on section:id, and
+ *  transitively everything that was expanded from those
+ */
+static void
+_cfg_invalidate (PCONFIG pconfig, const char *section, const char *id,
+    int depth)
+{
+  PCFGDEP d;
+  PCFGSECT s;
+  unsigned int h, pos;
+  int idx;
+
+  if (!pconfig->depTable || depth > CFG_MAX_EXPAND_DEPTH)
+    return;
+
+  h = _cfg_keyhash (section, id);
+  for (d = pconfig->depTable[h % pconfig->depSize]; d; d = d->next)
+    {
+      if (d->hash != h || strcasecmp (d->refSection, section)
+	  || strcasecmp (d->refId, id))
+	continue;
+      /* lines not parsed yet have nothing cached */
+      if ((pos = _cfg_sectfind (pconfig, d->section)) == 0)
+	continue;
+      s = pconfig->sections[pos];
+      if ((idx = _cfg_keyfind (s, d->id)) < 0 || !s->entries[idx].expanded)
+	continue;
+
+      /* the cache of a block shared with a clone is still right for
+         the other handles: drop it from a private copy */
+      if (_cfg_shared (pconfig, s) && (s = _cfg_own (pconfig, pos)) == NULL)
+	continue;
+      _cfg_dropcache (&s->entries[idx]);
+      _cfg_invalidate (pconfig, d->section, d->id, depth + 1);
+    }
+}
+
+
+static int
+_cfg_append (char **pBuf, size_t *pLen, size_t *pMax, const char *s,
+    size_t n)
+{
+  char *newBuf;
+  size_t newMax;
+
+  if (*pLen + n + 1 > *pMax)
+    {
+      newMax = *pMax ? *pMax * 2 : 64;
+      while (newMax < *pLen + n + 1)
+	newMax *= 2;
+      if ((newBuf = (char *) realloc (*pBuf, newMax)) == NULL)
+	return -1;
+      *pBuf = newBuf;
+      *pMax = newMax;
+    }
+  memcpy (*pBuf + *pLen, s, n);
+  *pLen += n;
+  (*pBuf)[*pLen] = 0;
+  return 0;
+}
+
+
+/*
+ *  Return the value of e, an entry of block s, with ${section:key} and
+ *  ${ENV:NAME} references replaced, computing and caching it on first
+ *  use. A block shared with a clone is not changed: there the result
+ *  is returned in *pFree, for the caller to free. Returns NULL with
+ *  errno set on a reference cycle or no memory.
+ */
+static char *
+_cfg_expand (PCONFIG pconfig, PCFGSECT s, PCFGENTRY e, const char *section,
+    int depth, char **pFree)
+{
+  char *buf = NULL, *cp, *end, *colon, *ref, *refSection, *refId, *id;
+  char *refFree;
+  size_t len = 0, max = 0;
+  PCFGSECT rs;
+  PCFGENTRY r;
+  int rc = 0, shared;
+
+  *pFree = NULL;
+
+  if (e->flags & CFE_PLAIN)
+    return e->value;
+  if (e->expanded)
+    return e->expanded;
+  /* other threads may be reading a shared block: no flag is set on it,
+     and a cycle through it is caught by the depth limit instead */
+  shared = _cfg_shared (pconfig, s);
+  if (strstr (e->value, "${") == NULL)
+    {
+      if (!shared)
+	e->flags |= CFE_PLAIN;
+      return e->value;
+    }
+  if ((e->flags & CFE_EXPANDING) || depth >= CFG_MAX_EXPAND_DEPTH)
+    {
+      errno = ELOOP;
+      return NULL;
+    }
+  if ((id = remove_quotes (e->id)) == NULL)
+    return e->value;
+
+  if (!shared)
+    e->flags |= CFE_EXPANDING;
+  for (cp = e->value; *cp && rc == 0;)
+    {
+      if (cp[0] == '$' && cp[1] == '$' && cp[2] == '{')
+	{
+	  /* $${ is a literal ${ */
+	  rc = _cfg_append (&buf, &len, &max, cp, 1);
+	  cp += 2;
+	  continue;
+	}
+      if (cp[0] != '$' || cp[1] != '{'
+	  || (end = strchr (cp + 2, '}')) == NULL
+	  || (colon = memchr (cp + 2, ':', end - cp - 2)) == NULL)
+	{
+	  rc = _cfg_append (&buf, &len, &max, cp++, 1);
+	  continue;
+	}
+
+      refSection = strndup (cp + 2, colon - cp - 2);
+      refId = strndup (colon + 1, end - colon - 1);
+      if (refSection == NULL || refId == NULL)
+	rc = -1;
+      else if (!strcmp (refSection, "ENV"))
+	{
+	  if ((ref = getenv (refId)) != NULL)
+	    rc = _cfg_append (&buf, &len, &max, ref, strlen (ref));
+	}
+      else if ((rc = _cfg_adddep (pconfig, refSection, refId,
+		  section, id)) == 0
+	  && (r = _cfg_findentry (pconfig, refSection, refId, &rs)) != NULL)
+	{
+	  if ((ref = _cfg_expand (pconfig, rs, r, refSection, depth + 1,
+		      &refFree)) == NULL)
+	    rc = -1;
+	  else
+	    rc = _cfg_append (&buf, &len, &max, ref, strlen (ref));
+	  free (refFree);
+	}
+      free (refSection);
+      free (refId);
+      cp = end + 1;
+    }
+  if (!shared)
+    e->flags &= ~CFE_EXPANDING;
+  free (id);
+
+  if (rc == 0 && buf == NULL)
+    rc = _cfg_append (&buf, &len, &max, "", 0);
+  if (rc)
+    {
+      free (buf);
+      return NULL;
+    }
+
+  if (shared)
+    *pFree = buf;
+  else
+    e->expanded = buf;
+  return buf;
+}
+
+
+/*** CLONE MODULE ****/
+
+
+/*
+ *  Is block s shared with another handle?
+ */
+static int
+_cfg_shared (PCONFIG pconfig, PCFGSECT s)
+{
+  return (pconfig->spineRefs
+      && __atomic_load_n (pconfig->spineRefs, __ATOMIC_ACQUIRE) > 1)
+      || __atomic_load_n (&s->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+
+/*
+ *  Private copy of a parsed block. Strings in the image stay shared;
+ *  strings of the block's own are duplicated.
+ */
+static PCFGSECT
+_cfg_copysect (PCFGSECT s)
+{
+  PCFGSECT c;
+  PCFGENTRY e;
+  unsigned int i;
+
+  if ((c = (PCFGSECT) calloc (1, sizeof (TCFGSECT))) == NULL)
+    return NULL;
+  c->refs = 1;
+  c->entries = (PCFGENTRY) malloc ((s->numEntries ? s->numEntries : 1)
+      * sizeof (TCFGENTRY));
+  if (c->entries == NULL)
+    {
+      free (c);
+      return NULL;
+    }
+  if (s->numEntries)
+    memcpy (c->entries, s->entries, s->numEntries * sizeof (TCFGENTRY));
+  c->maxEntries = s->numEntries;
+
+  for (i = 0, e = c->entries; i < s->numEntries; i++, e++)
+    {
+      /* the cached expansion is kept so that invalidation still
+         reaches whatever was expanded from it in other blocks */
+      e->flags &= ~CFE_EXPANDING;
+      e->list = NULL;
+      if (e->expanded && (e->expanded = strdup (e->expanded)) == NULL)
+	{
+	  _cfg_freesect (c);
+	  return NULL;
+	}
+      if ((e->flags & CFE_MUST_FREE_SECTION)
+	  && (e->section = strdup (e->section)) == NULL)
+	e->flags &= ~CFE_MUST_FREE_SECTION;
+      if ((e->flags & CFE_MUST_FREE_ID) && (e->id = strdup (e->id)) == NULL)
+	e->flags &= ~CFE_MUST_FREE_ID;
+      e->valueCap = 0;
+      if ((e->flags & CFE_MUST_FREE_VALUE)
+	  && (e->value = strdup (e->value)) == NULL)
+	e->flags &= ~CFE_MUST_FREE_VALUE;
+      if ((e->flags & CFE_MUST_FREE_COMMENT)
+	  && (e->comment = strdup (e->comment)) == NULL)
+	e->flags &= ~CFE_MUST_FREE_COMMENT;
+      c->numEntries++;
+      if ((e->section == NULL && s->entries[i].section)
+	  || (e->id == NULL && s->entries[i].id)
+	  || (e->value == NULL && s->entries[i].value)
+	  || (e->comment == NULL && s->entries[i].comment))
+	{
+	  _cfg_freesect (c);
+	  return NULL;
+	}
+    }
+
+  /* the key index holds positions, so it carries over */
+  if (s->keyIndex)
+    {
+      if ((c->keyIndex = (unsigned int *) malloc (s->keySize
+		  * sizeof (unsigned int))) != NULL)
+	{
+	  memcpy (c->keyIndex, s->keyIndex, s->keySize * sizeof (unsigned int));
+	  c->keySize = s->keySize;
+	  c->numKeys = s->numKeys;
+	}
+    }
+
+  return c;
+}
+
+
+/*
+ *  Make the block array and the section index private to the handle
+ */
+static int
+_cfg_ownspine (PCONFIG pconfig)
+{
+  PCFGSECT *sections;
+  unsigned int *sectIndex = NULL, pos;
+
+  if (pconfig->spineRefs == NULL)
+    return 0;
+  if (__atomic_load_n (pconfig->spineRefs, __ATOMIC_ACQUIRE) == 1)
+    {
+      free (pconfig->spineRefs);
+      pconfig->spineRefs = NULL;
+      return 0;
+    }
+
+  sections = (PCFGSECT *) malloc ((pconfig->maxSections ?
+	  pconfig->maxSections : 1) * sizeof (PCFGSECT));
+  if (sections == NULL)
+    return -1;
+  if (pconfig->sectIndex)
+    {
+      sectIndex = (unsigned int *) malloc (pconfig->sectSize
+	  * sizeof (unsigned int));
+      if (sectIndex == NULL)
+	{
+	  free (sections);
+	  return -1;
+	}
+      memcpy (sectIndex, pconfig->sectIndex,
+	  pconfig->sectSize * sizeof (unsigned int));
+    }
+  memcpy (sections, pconfig->sections,
+      pconfig->numSections * sizeof (PCFGSECT));
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    __atomic_add_fetch (&sections[pos]->refs, 1, __ATOMIC_ACQ_REL);
+
+  /* let go of the shared one; free it if the other handles are gone */
+  if (__atomic_sub_fetch (pconfig->spineRefs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      for (pos = 0; pos < pconfig->numSections; pos++)
+	if (__atomic_sub_fetch (&pconfig->sections[pos]->refs, 1,
+		__ATOMIC_ACQ_REL) == 0)
+	  _cfg_freesect (pconfig->sections[pos]);
+      free (pconfig->sections);
+      free (pconfig->sectIndex);
+      free (pconfig->spineRefs);
+    }
+  pconfig->sections = sections;
+  pconfig->sectIndex = sectIndex;
+  pconfig->spineRefs = NULL;
+
+  return 0;
+}
+
+
+/*
+ *  Block pos, parsed and private to the handle, so that it can be
+ *  changed
+ */
+static PCFGSECT
+_cfg_own (PCONFIG pconfig, unsigned int pos)
+{
+  PCFGSECT s, c;
+
+  if ((s = _cfg_sect (pconfig, pos)) == NULL)
+    return NULL;
+  if (pconfig->spineRefs == NULL
+      && __atomic_load_n (&s->refs, __ATOMIC_ACQUIRE) == 1)
+    return s;
+  if (_cfg_ownspine (pconfig) == -1)
+    return NULL;
+  if (__atomic_load_n (&s->refs, __ATOMIC_ACQUIRE) == 1)
+    return s;
+
+  if ((c = _cfg_copysect (s)) == NULL)
+    return NULL;
+  if (__atomic_sub_fetch (&s->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    _cfg_freesect (s);
+  pconfig->sections[pos] = c;
+
+  return c;
+}
+
+
+int
+cfg_clone (PCONFIG pconfig, PCONFIG *ppclone)
+{
+  PCONFIG c;
+  PCFGDEP d;
+  unsigned int i;
+
+  *ppclone = NULL;
+  if (!cfg_valid (pconfig))
+    return -1;
+  if (pconfig->dir)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (pconfig->imageRefs == NULL)
+    {
+      if ((pconfig->imageRefs = (unsigned int *) malloc (sizeof (unsigned
+		  int))) == NULL)
+	return -1;
+      *pconfig->imageRefs = 1;
+    }
+  if (pconfig->spineRefs == NULL)
+    {
+      if ((pconfig->spineRefs = (unsigned int *) malloc (sizeof (unsigned
+		  int))) == NULL)
+	return -1;
+      *pconfig->spineRefs = 1;
+    }
+  /* a shared block is only read, so load what is still deferred,
+     index what is large and sort the keys for the iterators now, not
+     later from two threads at once */
+  for (i = 0; i < pconfig->numSections; i++)
+    if (!_cfg_shared (pconfig, pconfig->sections[i])
+	&& (_cfg_sect (pconfig, i) == NULL
+	    || _cfg_keyindex (pconfig->sections[i]) == -1
+	    || _cfg_keyorder (pconfig->sections[i]) == -1))
+      return -1;
+  if ((c = (PCONFIG) malloc (sizeof (TCONFIG))) == NULL)
+    return -1;
+
+  /* the content is shared, the rest belongs to each handle */
+  *c = *pconfig;
+  c->live = NULL;
+  c->locks = NULL;
+  if (_cfg_register (c) == -1)
+    {
+      free (c);
+      return -1;
+    }
+  __atomic_add_fetch (c->imageRefs, 1, __ATOMIC_ACQ_REL);
+  __atomic_add_fetch (c->spineRefs, 1, __ATOMIC_ACQ_REL);
+  c->fileName = strdup (pconfig->fileName);
+  c->subs = _cfg_subsalloc ();
+  c->async = NULL;
+  c->sectOrder = NULL;
+  c->numSectOrder = 0;
+  c->journalName = pconfig->journalName ? strdup (pconfig->journalName) : NULL;
+  c->depTable = NULL;
+  c->depSize = c->numDeps = 0;
+  c->changes = NULL;
+  c->numChanges = c->maxChanges = 0;
+  c->ops = NULL;
+  c->numOps = c->maxOps = 0;
+  c->scratch = NULL;
+  c->scratchList = NULL;
+  c->frozen = NULL;
+  c->sectCursor = c->cursor = 0;
+  c->section = c->id = c->value = c->comment = NULL;
+  c->flags = CFG_VALID;
+  if (c->fileName == NULL || c->subs == NULL
+      || (pconfig->journalName && c->journalName == NULL))
+    {
+      cfg_done (c);
+      return -1;
+    }
+
+  /* cached expansions in the shared blocks rely on these */
+  for (i = 0; i < pconfig->depSize; i++)
+    for (d = pconfig->depTable[i]; d; d = d->next)
+      if (_cfg_adddep (c, d->refSection, d->refId, d->section, d->id) == -1)
+	{
+	  cfg_done (c);
+	  return -1;
+	}
+  for (i = 0; i < pconfig->numOps; i++)
+    if (_cfg_addop (c, pconfig->ops[i].section, pconfig->ops[i].id,
+	    pconfig->ops[i].value) == -1)
+      {
+	cfg_done (c);
+	return -1;
+      }
+
+  *ppclone = c;
+  return 0;
+}
+
+
+/*** NOTIFY MODULE ****/
+
+
+/* a registered change subscription */
+typedef struct TCFGSUB
+  {
+    struct TCFGSUB *next;
+    unsigned int hash;
+    int handle;
+    int flags;
+    char *section;		/* section name or prefix */
+    char *id;			/* NULL for the whole section */
+    cfg_notify_t fn;
+    void *arg;
+  }
+TCFGSUB, *PCFGSUB;
+
+#define CFG_PREFIX_SEED		0x9e3779b9u
+#define CFG_PREFIX_LENS		64
+
+/* subscriptions of a configuration, indexed by what they watch */
+struct TCFGSUBS
+  {
+    pthread_mutex_t lock;
+    PCFGSUB *table;
+    unsigned int size;
+    unsigned int count;
+    unsigned int prefixLens[CFG_PREFIX_LENS];	/* prefixes per length */
+    int lastHandle;
+  };
+
+
+static unsigned int
+_cfg_subhash (const char *section, const char *id, int flags)
+{
+  if (flags & CFG_SUB_PREFIX)
+    return _cfg_hashstr (CFG_PREFIX_SEED, section);
+  if (id)
+    return _cfg_keyhash (section, id);
+  return _cfg_hashstr (2166136261u, section);
+}
+
+
+static struct TCFGSUBS *
+_cfg_subsalloc (void)
+{
+  struct TCFGSUBS *subs;
+
+  if ((subs = (struct TCFGSUBS *) calloc (1, sizeof (*subs))) == NULL)
+    return NULL;
+  pthread_mutex_init (&subs->lock, NULL);
+  return subs;
+}
+
+
+static void
+_cfg_subsfree (struct TCFGSUBS *subs)
+{
+  PCFGSUB s, next;
+  unsigned int i;
+
+  if (subs == NULL)
+    return;
+  for (i = 0; i < subs->size; i++)
+    for (s = subs->table[i]; s; s = next)
+      {
+	next = s->next;
+	free (s->section);
+	free (s->id);
+	free (s);
+      }
+  free (subs->table);
+  pthread_mutex_destroy (&subs->lock);
+  free (subs);
+}
+
+
+/*
+ *  Register a callback for changes of section:id, of every key of
+ *  section (id NULL), or of every section starting with section
+ *  (flags CFG_SUB_PREFIX). Returns a handle for cfg_unsubscribe.
+ */
+int
+cfg_subscribe (PCONFIG pconfig, const char *section, const char *id,
+    int flags, cfg_notify_t fn, void *arg)
+{
+  struct TCFGSUBS *subs;
+  PCFGSUB s, next, *newTable;
+  unsigned int i, newSize, len;
+  int handle;
+
+  if (pconfig == NULL || (subs = pconfig->subs) == NULL || section == NULL
+      || fn == NULL)
+    return -1;
+  if (flags & CFG_SUB_PREFIX)
+    id = NULL;
+
+  if ((s = (PCFGSUB) calloc (1, sizeof (TCFGSUB))) == NULL)
+    return -1;
+  s->section = strdup (section);
+  s->id = id ? strdup (id) : NULL;
+  if (s->section == NULL || (id && s->id == NULL))
+    {
+      free (s->section);
+      free (s);
+      return -1;
+    }
+  s->flags = flags;
+  s->hash = _cfg_subhash (section, id, flags);
+  s->fn = fn;
+  s->arg = arg;
+
+  pthread_mutex_lock (&subs->lock);
+  if (subs->count >= subs->size)
+    {
+      newSize = subs->size ? subs->size * 2 : 32;
+      newTable = (PCFGSUB *) calloc (newSize, sizeof (PCFGSUB));
+      if (newTable == NULL)
+	{
+	  pthread_mutex_unlock (&subs->lock);
+	  free (s->section);
+	  free (s->id);
+	  free (s);
+	  return -1;
+	}
+      for (i = 0; i < subs->size; i++)
+	for (next = subs->table[i]; next;)
+	  {
+	    PCFGSUB t = next;
+
+	    next = t->next;
+	    t->next = newTable[t->hash % newSize];
+	    newTable[t->hash % newSize] = t;
+	  }
+      free (subs->table);
+      subs->table = newTable;
+      subs->size = newSize;
+    }
+  handle = s->handle = ++subs->lastHandle;
+  s->next = subs->table[s->hash % subs->size];
+  subs->table[s->hash % subs->size] = s;
+  __atomic_add_fetch (&subs->count, 1, __ATOMIC_RELAXED);
+  if (flags & CFG_SUB_PREFIX)
+    {
+      len = strlen (section);
+      subs->prefixLens[len < CFG_PREFIX_LENS ? len : CFG_PREFIX_LENS - 1]++;
+    }
+  pthread_mutex_unlock (&subs->lock);
+
+  return handle;
+}
+
+
+int
+cfg_unsubscribe (PCONFIG pconfig, int handle)
+{
+  struct TCFGSUBS *subs;
+  PCFGSUB s, *ps;
+  unsigned int i, len;
+
+  if (pconfig == NULL || (subs = pconfig->subs) == NULL)
+    return -1;
+
+  pthread_mutex_lock (&subs->lock);
+  for (i = 0; i < subs->size; i++)
+    for (ps = &subs->table[i]; (s = *ps) != NULL; ps = &s->next)
+      if (s->handle == handle)
+	{
+	  *ps = s->next;
+	  __atomic_sub_fetch (&subs->count, 1, __ATOMIC_RELAXED);
+	  if (s->flags & CFG_SUB_PREFIX)
+	    {
+	      len = strlen (s->section);
+	      subs->prefixLens[len < CFG_PREFIX_LENS ? len :
+		  CFG_PREFIX_LENS - 1]--;
+	    }
+	  pthread_mutex_unlock (&subs->lock);
+	  free (s->section);
+	  free (s->id);
+	  free (s);
+	  return 0;
+	}
+  pthread_mutex_unlock (&subs->lock);
+
+  return -1;
+}
+
+
+static int
+_cfg_submatch (PCFGSUB s, const char *section, const char *id, int flags,
+    unsigned int h, size_t len)
+{
+  if (s->hash != h || (s->flags & CFG_SUB_PREFIX) != flags)
+    return 0;
+  if (flags & CFG_SUB_PREFIX)
+    return strlen (s->section) == len && !strncasecmp (s->section, section,
+	len);
+  if (strcasecmp (s->section, section))
+    return 0;
+  if (s->id == NULL || id == NULL)
+    return s->id == id;
+  return !strcasecmp (s->id, id);
+}
+
+
+/*
+ *  Run the callbacks watching section:id. Only the buckets that can
+ *  hold a matching subscription are visited; the callbacks run
+ *  outside of the registry lock.
+ */
+static void
+_cfg_notify (PCONFIG pconfig, const char *section, const char *id, int kind)
+{
+  struct TCFGSUBS *subs = pconfig->subs;
+  TCFGSUB local[16], *hits = local;
+  unsigned int numHits = 0, maxHits = 16;
+  unsigned int h, i;
+  size_t len;
+  PCFGSUB s;
+
+  if (subs == NULL || __atomic_load_n (&subs->count, __ATOMIC_RELAXED) == 0)
+    return;
+
+#define CFG_COLLECT(HASH, ID, FLAGS, LEN)				\
+  for (s = subs->table[(HASH) % subs->size]; s; s = s->next)		\
+    if (_cfg_submatch (s, section, ID, FLAGS, HASH, LEN))		\
+      {									\
+	if (numHits == maxHits)						\
+	  {								\
+	    TCFGSUB *more = (TCFGSUB *) malloc (2 * maxHits		\
+		* sizeof (TCFGSUB));					\
+	    if (more == NULL)						\
+	      break;							\
+	    memcpy (more, hits, numHits * sizeof (TCFGSUB));		\
+	    if (hits != local)						\
+	      free (hits);						\
+	    hits = more;						\
+	    maxHits *= 2;						\
+	  }								\
+	hits[numHits++] = *s;						\
+      }
+
+  pthread_mutex_lock (&subs->lock);
+  h = _cfg_subhash (section, id, 0);
+  CFG_COLLECT (h, id, 0, 0);
+  h = _cfg_subhash (section, NULL, 0);
+  CFG_COLLECT (h, NULL, 0, 0);
+  h = CFG_PREFIX_SEED;
+  for (len = 0; section[len]; len++)
+    {
+      h = (h ^ (unsigned char) tolower ((unsigned char) section[len]))
+	  * 16777619u;
+      if (subs->prefixLens[len + 1 < CFG_PREFIX_LENS ? len + 1 :
+	      CFG_PREFIX_LENS - 1])
+	CFG_COLLECT (h, NULL, CFG_SUB_PREFIX, len + 1);
+    }
+  pthread_mutex_unlock (&subs->lock);
+#undef CFG_COLLECT
+
+  for (i = 0; i < numHits; i++)
+    hits[i].fn (pconfig, section, id, kind, hits[i].arg);
+  if (hits != local)
+    free (hits);
+}
+
+
+/*
+ *  Set the dirty flag. Writers in several threads (CFG_OPEN_CONCURRENT)
+ *  store to it once, rather than each taking its cache line.
+ */
+static void
+_cfg_markdirty (PCONFIG pconfig)
+{
+  if (!__atomic_load_n (&pconfig->dirty, __ATOMIC_RELAXED))
+    __atomic_store_n (&pconfig->dirty, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ *  Bookkeeping after section:id has been added, updated or deleted
+ */
+static int
+_cfg_changed (PCONFIG pconfig, const char *section, const char *id, int kind)
+{
+  _cfg_markdirty (pconfig);
+  _cfg_invalidate (pconfig, section, id, 0);
+  _cfg_notify (pconfig, section, id, kind);
+  return 0;
+}
+
+
+/*** WRITE MODULE ****/
+
+
+/*
+ *  Change the configuration
+ *
+ *  section id    value		action
+ *  --------------------------------------------------------------------------
+ *   value  value value		update '<entry>=<string>' in section <section>
+ *   value  value NULL		delete '<entry>' from section <section>
+ *   value  NULL  NULL		delete section <section>
+ */
+int
+cfg_write (
+    PCONFIG pconfig,
+    char *section,
+    char *id,
+    char *value)
+{
+  int rc = -1;
+
+  CFG_PROBE4 (write_entry, pconfig ? pconfig->fileName : NULL, section, id,
+      value);
+  if (pconfig && pconfig->locks)
+    rc = _cfg_lockedwrite (pconfig, section, id, value);
+  else if (_cfg_writable (pconfig))
+    rc = _cfg_loggedwrite (pconfig, section, id, value);
+  CFG_PROBE4 (write_return, pconfig ? pconfig->fileName : NULL, section, id,
+      rc);
+  return rc;
+}
+
+
+/*
+ *  Can the handle be changed? Lean and frozen handles are read only.
+ */
+static int
+_cfg_writable (PCONFIG pconfig)
+{
+  if (!cfg_valid (pconfig))
+    return 0;
+  if ((pconfig->openFlags & CFG_OPEN_LEAN) || pconfig->frozen)
+    {
+      errno = EROFS;
+      return 0;
+    }
+  return 1;
+}
+
+
+/*
+ *  Is e a comment line that belongs with the entry below it?
+ */
+static int
+_cfg_sticky (PCFGENTRY e)
+{
+  return e->comment && !e->section && !e->id && !e->value
+      && (iswhite (e->comment[0]) || e->comment[0] == ';');
+}
+
+
+/*
+ *  Set the value of e, an entry of a block private to the handle. A
+ *  value of the entry's own is overwritten in place when the new one
+ *  fits; otherwise the value gets room to spare, so that a counter
+ *  that grows by a digit now and then is not reallocated each time.
+ *  On failure the old value stays.
+ */
+static int
+_cfg_setvalue (PCFGENTRY e, const char *value)
+{
+  size_t len, cap;
+  char *p;
+
+  len = strlen (value);
+  /* value may be a pointer into the old one */
+  if ((e->flags & CFE_MUST_FREE_VALUE) && len < e->valueCap)
+    {
+      memmove (e->value, value, len + 1);
+      return 0;
+    }
+
+  cap = (len + 16) & ~(size_t) 15;
+  if ((p = (char *) malloc (cap)) == NULL)
+    return -1;
+  memcpy (p, value, len + 1);
+  if (e->flags & CFE_MUST_FREE_VALUE)
+    free (e->value);
+  e->value = p;
+  e->valueCap = cap <= UINT_MAX ? (unsigned int) cap : 0;
+  e->flags |= CFE_MUST_FREE_VALUE;
+  return 0;
+}
+
+
+static int
+_cfg_write (
+    PCONFIG pconfig,
+    char *section,
+    char *id,
+    char *value)
+{
+  unsigned int pos;
+
+  if (!cfg_valid (pconfig) || section == NULL)
+    return -1;
+
+  /* did we find the section? */
+  if ((pos = _cfg_sectfind (pconfig, section)) == 0)
+    {
+      /* check for delete operation on a nonexisting section */
+      if (!id || !value)
+	return 0;
+
+      /* add section first */
+      if (cfg_storeentry (pconfig, section, NULL, NULL, NULL, 1) == -1)
+	return -1;
+      pos = pconfig->numSections - 1;
+    }
+
+  return _cfg_writesect (pconfig, pos, section, id, value);
+}
+
+
+/*
+ *  cfg_write on the section in block pos
+ */
+static int
+_cfg_writesect (
+    PCONFIG pconfig,
+    unsigned int pos,
+    char *section,
+    char *id,
+    char *value)
+{
+  PCFGSECT s, prev;
+  PCFGENTRY e;
+  char **ids = NULL;
+  unsigned int first, last, numIds = 0, i;
+  int idx;
+
+  /* ok - we have found the section - let's see what we need to do */
+  if ((s = _cfg_own (pconfig, pos)) == NULL)
+    return -1;
+
+  if (id)
+    {
+      idx = _cfg_keyfind (s, id);
+      if (value)
+	{
+	  if (idx < 0)
+	    {
+	      /* add a new key at the end of the section */
+	      if ((e = _cfg_poolalloc (pconfig, s, 1)) == NULL)
+		return -1;
+	      e->section = NULL;
+	      e->id = strdup (id);
+	      e->value = NULL;
+	      e->comment = NULL;
+	      e->expanded = NULL;
+	      e->list = NULL;
+	      e->flags = CFE_MUST_FREE_ID;
+	      e->source = 0;
+	      e->valueCap = 0;
+	      if (e->id == NULL || _cfg_setvalue (e, value) == -1)
+		{
+		  _cfg_delentries (pconfig, s, s->numEntries - 1,
+		      s->numEntries);
+		  return -1;
+		}
+	      _cfg_keyinsert (s, s->numEntries - 1);
+	      _cfg_dropkeyorder (s);
+	      return _cfg_changed (pconfig, section, id, CFG_ADDED);
+	    }
+
+	  /* found key - do update */
+	  e = &s->entries[idx];
+	  if (_cfg_setvalue (e, value) == -1)
+	    return -1;
+	  _cfg_dropcache (e);
+	  return _cfg_changed (pconfig, section, id, CFG_MODIFIED);
+	}
+
+      /* delete a key - that's ok if it does not exist */
+      if (idx < 0)
+	return 0;
+
+      /* along with the comment lines above it */
+      for (first = idx; first > 0 && _cfg_sticky (&s->entries[first - 1]);
+	  first--)
+	;
+      _cfg_delentries (pconfig, s, first, idx + 1);
+      return _cfg_changed (pconfig, section, id, CFG_REMOVED);
+    }
+
+  /* delete entire section */
+  if ((prev = _cfg_own (pconfig, pos - 1)) == NULL)
+    return -1;
+
+  /* remember its keys, to report them as removed */
+  for (i = 1; i < s->numEntries; i++)
+    if (s->entries[i].id)
+      numIds++;
+  if (numIds && (ids = (char **) calloc (numIds, sizeof (char *))) == NULL)
+    return -1;
+  for (numIds = 0, i = 1; i < s->numEntries; i++)
+    if (s->entries[i].id && (ids[numIds++] = strdup (s->entries[i].id))
+	== NULL)
+      {
+	while (numIds--)
+	  free (ids[numIds]);
+	free (ids);
+	return -1;
+      }
+
+  /* the comment block above the section goes with it */
+  for (first = prev->numEntries;
+      first > 0 && _cfg_sticky (&prev->entries[first - 1]); first--)
+    ;
+  _cfg_delentries (pconfig, prev, first, prev->numEntries);
+
+  /* the comment block at its end belongs to the next one: keep it */
+  for (last = s->numEntries; last > 1 && _cfg_sticky (&s->entries[last - 1]);
+      last--)
+    ;
+  if (last < s->numEntries)
+    {
+      if ((e = _cfg_poolalloc (pconfig, prev, s->numEntries - last)) == NULL)
+	{
+	  for (i = 0; i < numIds; i++)
+	    free (ids[i]);
+	  free (ids);
+	  return -1;
+	}
+      memcpy (e, &s->entries[last],
+	  (s->numEntries - last) * sizeof (TCFGENTRY));
+      pconfig->numEntries -= s->numEntries - last;
+      s->numEntries = last;
+    }
+
+  pconfig->numEntries -= s->numEntries;
+  _cfg_freesect (s);
+  memmove (&pconfig->sections[pos], &pconfig->sections[pos + 1],
+      (pconfig->numSections - pos - 1) * sizeof (PCFGSECT));
+  pconfig->numSections--;
+  _cfg_sectreindex (pconfig);
+  pconfig->dirty = 1;
+
+  for (i = 0; i < numIds; i++)
+    {
+      _cfg_changed (pconfig, section, ids[i], CFG_REMOVED);
+      free (ids[i]);
+    }
+  free (ids);
+
+  return 0;
+}
+
+
+/*
+ *  Grow block s once for count more entries
+ */
+static int
+_cfg_reserve (PCFGSECT s, unsigned int count)
+{
+  if (s->numEntries + count <= s->maxEntries)
+    return 0;
+  return _cfg_resize (s, s->numEntries + count);
+}
+
+
+/*
+ *  Apply many cfg_write operations. Section deletes are applied in
+ *  turn, since the comments they take along depend on what came
+ *  before. The key writes between two of them are grouped by section
+ *  and each group is applied in one pass over its section, growing
+ *  the section at most once. Groups run in order of their first key
+ *  write, which is the order cfg_write would have created missing
+ *  sections in. The result is that of cfg_write in turn.
+ */
+static int
+_cfg_writemany (PCONFIG pconfig, PCFGOP ops, unsigned int numOps)
+{
+  unsigned int i, j;
+  int rc = 0;
+
+  if (!_cfg_writable (pconfig) || (ops == NULL && numOps))
+    return -1;
+  for (i = 0; i < numOps; i++)
+    if (ops[i].section == NULL)
+      return -1;
+
+  for (i = 0; rc == 0 && i < numOps; i = j + 1)
+    {
+      for (j = i; j < numOps && ops[j].id != NULL; j++)
+	;
+      if (j > i)
+	rc = _cfg_writegroups (pconfig, ops + i, j - i);
+      if (rc == 0 && j < numOps)
+	rc = _cfg_loggedwrite (pconfig, ops[j].section, NULL, NULL);
+    }
+  return rc;
+}
+
+
+/*
+ *  Apply numOps key writes grouped by section
+ */
+static int
+_cfg_writegroups (PCONFIG pconfig, PCFGOP ops, unsigned int numOps)
+{
+  unsigned int *slots, *group, *order, *start, *first, *rank;
+  unsigned int size, mask, numGroups = 0, numNew, pos, i, j, g, h;
+  PCFGOP op;
+  int rc = 0;
+
+  for (size = 16; size < 2 * numOps; size *= 2)
+    ;
+  mask = size - 1;
+  slots = (unsigned int *) calloc (size, sizeof (unsigned int));
+  group = (unsigned int *) malloc (numOps * sizeof (unsigned int));
+  order = (unsigned int *) malloc (numOps * sizeof (unsigned int));
+  start = (unsigned int *) calloc (numOps + 1, sizeof (unsigned int));
+  first = (unsigned int *) malloc (numOps * sizeof (unsigned int));
+  rank = (unsigned int *) malloc (numOps * sizeof (unsigned int));
+  if (!slots || !group || !order || !start || !first || !rank)
+    {
+      rc = -1;
+      goto done;
+    }
+
+  /* split the operations into groups: slots hold op index + 1 of the
+     latest operation on a section, first the sort key of a group */
+  for (i = 0; i < numOps; i++)
+    {
+      h = _cfg_hashstr (2166136261u, ops[i].section);
+      for (j = h & mask; slots[j]; j = (j + 1) & mask)
+	if (!strcasecmp (ops[slots[j] - 1].section, ops[i].section))
+	  break;
+      if (slots[j])
+	group[i] = group[slots[j] - 1];
+      else
+	{
+	  group[i] = numGroups++;
+	  first[group[i]] = i;
+	}
+      slots[j] = i + 1;
+      if (ops[i].value && ops[first[group[i]]].value == NULL)
+	first[group[i]] = i;
+    }
+
+  /* order the groups by their keys, which are distinct op indexes */
+  for (i = 0; i < numOps; i++)
+    rank[i] = numOps;
+  for (g = 0; g < numGroups; g++)
+    rank[first[g]] = g;
+  for (i = 0, j = 0; i < numOps; i++)
+    if (rank[i] < numOps)
+      first[rank[i]] = j++;
+  for (i = 0; i < numOps; i++)
+    {
+      group[i] = first[group[i]];
+      start[group[i] + 1]++;
+    }
+
+  /* counting sort by group, stable */
+  for (g = 0; g < numGroups; g++)
+    start[g + 1] += start[g];
+  for (i = 0; i < numOps; i++)
+    order[start[group[i]]++] = i;
+  for (g = numGroups; g > 0; g--)
+    start[g] = start[g - 1];
+  start[0] = 0;
+
+  for (g = 0; rc == 0 && g < numGroups; g++)
+    {
+      op = &ops[order[start[g]]];
+      pos = _cfg_sectfind (pconfig, op->section);
+
+      /* size the section for its new keys in one step */
+      if (pos && _cfg_own (pconfig, pos) == NULL)
+	{
+	  rc = -1;
+	  break;
+	}
+      for (numNew = 0, i = start[g]; i < start[g + 1]; i++)
+	if (ops[order[i]].value
+	    && (pos == 0 || _cfg_keyfind (pconfig->sections[pos],
+		    ops[order[i]].id) < 0))
+	  numNew++;
+      if (pos && _cfg_reserve (pconfig->sections[pos], numNew) == -1)
+	{
+	  rc = -1;
+	  break;
+	}
+
+      for (i = start[g]; rc == 0 && i < start[g + 1]; i++)
+	{
+	  op = &ops[order[i]];
+	  if (pos == 0 && !op->value)
+	    continue;
+	  if (_cfg_logged (pconfig)
+	      && _cfg_reserveop (pconfig, op->section, op->id,
+		  op->value) == -1)
+	    {
+	      rc = -1;
+	      break;
+	    }
+	  if (pos == 0)
+	    {
+	      if (cfg_storeentry (pconfig, op->section, NULL, NULL, NULL,
+		      1) == -1
+		  || _cfg_reserve (pconfig->sections[pconfig->numSections - 1],
+		      numNew) == -1)
+		rc = -1;
+	      else
+		pos = pconfig->numSections - 1;
+	    }
+	  if (rc == 0)
+	    rc = _cfg_writesect (pconfig, pos, op->section, op->id,
+		op->value);
+	  if (_cfg_logged (pconfig))
+	    rc = _cfg_endop (pconfig, rc);
+	}
+    }
+
+done:
+  free (slots);
+  free (group);
+  free (order);
+  free (start);
+  free (first);
+  free (rank);
+  return rc;
+}
+
+
+int
+cfg_write_many (PCONFIG pconfig, PCFGOP ops, unsigned int numOps)
+{
+  if (pconfig && pconfig->locks)
+    return _cfg_lockedmany (pconfig, ops, numOps);
+  return _cfg_writemany (pconfig, ops, numOps);
+}
+
+
+/*
+ *  Write a formatted copy of the configuration to a file
+ *
+ *  This assumes that the inifile has already been parsed. Deferred
+ *  blocks are parsed before anything is written; -1 if one fails.
+ */
+static int
+_cfg_outputformatted (PCONFIG pconfig, FILE *fd)
+{
+  PCFGSECT s;
+  PCFGENTRY e;
+  unsigned int pos, i, j;
+  int m = 0;
+  int l;
+  int skip = 0;
+
+  if (_cfg_loadall (pconfig) == -1)
+    return -1;
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    {
+      s = pconfig->sections[pos];
+      for (i = 0, e = s->entries; i < s->numEntries; i++, e++)
+	{
+	  if (e->section)
+	    {
+	      /* Add extra line before section, unless comment block found */
+	      if (skip)
+		fprintf (fd, "\n");
+	      fprintf (fd, "[%s]", e->section);
+	      if (e->comment)
+		fprintf (fd, "\t;%s", e->comment);
+
+	      /* Calculate m, which is the length of the longest key */
+	      m = 0;
+	      for (j = i + 1; j < s->numEntries; j++)
+		if (s->entries[j].id && (l = strlen (s->entries[j].id)) > m)
+		  m = l;
+
+	      /* Add an extra lf next time around */
+	      skip = 1;
+	    }
+	  /*
+	   *  Key = value
+	   */
+	  else if (e->id && e->value)
+	    {
+	      if (m)
+		fprintf (fd, "%-*.*s = %s", m, m, e->id, e->value);
+	      else
+		fprintf (fd, "%s = %s", e->id, e->value);
+	      if (e->comment)
+		fprintf (fd, "\t;%s", e->comment);
+	    }
+	  /*
+	   *  Value only (continuation)
+	   */
+	  else if (e->value)
+	    {
+	      fprintf (fd, "  %s", e->value);
+	      if (e->comment)
+		fprintf (fd, "\t;%s", e->comment);
+	    }
+	  /*
+	   *  Comment only - check if we need an extra lf
+	   *
+	   *  1. Comment before section gets an extra blank line before
+	   *     the comment starts.
+	   *
+	   *          previousEntry = value
+	   *          <<< INSERT BLANK LINE HERE >>>
+	   *          ; Comment Block
+	   *          ; Sticks to section below
+	   *          [new section]
+	   *
+	   *  2. Exception on 1. for commented out definitions:
+	   *     (Immediate nonwhitespace after ;)
+	   *          [some section]
+	   *          v1 = 1
+	   *          ;v2 = 2   << NO EXTRA LINE >>
+	   *          v3 = 3
+	   *
+	   *  3. Exception on 2. for ;; which certainly is a section comment
+	   *          [some section]
+	   *          definitions
+	   *          <<< INSERT BLANK LINE HERE >>>
+	   *          ;; block comment
+	   *          [new section]
+	   */
+	  else if (e->comment)
+	    {
+	      if (skip && (iswhite (e->comment[0]) || e->comment[0] == ';'))
+		{
+		  for (j = i + 1; j < s->numEntries; j++)
+		    if (s->entries[j].id || s->entries[j].value)
+		      break;
+		  /* only comments up to the next block's [section] line */
+		  if (j == s->numEntries && pos + 1 < pconfig->numSections)
+		    {
+		      fprintf (fd, "\n");
+		      skip = 0;
+		    }
+		}
+	      fprintf (fd, ";%s", e->comment);
+	    }
+	  fprintf (fd, "\n");
+	}
+    }
+  return 0;
+}
+
+
+/*** JOURNAL MODULE ****/
+
+
+/*
+ *  Are writes remembered until the next commit? The journal, the
+ *  fragments of a directory and optimistic commits replay them.
+ */
+static int
+_cfg_logged (PCONFIG pconfig)
+{
+  return pconfig->journalName || pconfig->dir
+      || (pconfig->openFlags & CFG_OPEN_OPTIMISTIC);
+}
+
+
+/*
+ *  Remember a successful cfg_write until the next commit
+ */
+static int
+_cfg_addop (PCONFIG pconfig, char *section, char *id, char *value)
+{
+  if (_cfg_reserveop (pconfig, section, id, value) == -1)
+    return -1;
+  return _cfg_endop (pconfig, 0);
+}
+
+
+/*
+ *  Copy a write into the slot after the ops, before it is made: once
+ *  made, it can then be remembered without anything left to fail
+ */
+static int
+_cfg_reserveop (PCONFIG pconfig, char *section, char *id, char *value)
+{
+  PCFGOP op;
+  unsigned int newMax;
+
+  if (section == NULL)
+    return -1;
+  if (pconfig->numOps >= pconfig->maxOps)
+    {
+      newMax = pconfig->maxOps ? pconfig->maxOps * 2 : 16;
+      op = (PCFGOP) realloc (pconfig->ops, newMax * sizeof (TCFGOP));
+      if (op == NULL)
+	return -1;
+      pconfig->ops = op;
+      pconfig->maxOps = newMax;
+    }
+
+  op = &pconfig->ops[pconfig->numOps];
+  op->section = strdup (section);
+  op->id = id ? strdup (id) : NULL;
+  op->value = id && value ? strdup (value) : NULL;
+  if (op->section == NULL || (id && op->id == NULL)
+      || (id && value && op->value == NULL))
+    {
+      free (op->section);
+      free (op->id);
+      free (op->value);
+      return -1;
+    }
+
+  return 0;
+}
+
+
+/*
+ *  Remember the reserved write if it was made with result rc, or
+ *  drop it
+ */
+static int
+_cfg_endop (PCONFIG pconfig, int rc)
+{
+  PCFGOP op = &pconfig->ops[pconfig->numOps];
+
+  if (rc == 0)
+    pconfig->numOps++;
+  else
+    {
+      free (op->section);
+      free (op->id);
+      free (op->value);
+    }
+  return rc;
+}
+
+
+/*
+ *  _cfg_write, remembering the write when the handle logs them
+ */
+static int
+_cfg_loggedwrite (PCONFIG pconfig, char *section, char *id, char *value)
+{
+  if (!_cfg_logged (pconfig))
+    return _cfg_write (pconfig, section, id, value);
+  if (_cfg_reserveop (pconfig, section, id, value) == -1)
+    return -1;
+  return _cfg_endop (pconfig, _cfg_write (pconfig, section, id, value));
+}
+
+
+static void
+_cfg_freeops (PCONFIG pconfig)
+{
+  unsigned int i;
+
+  for (i = 0; i < pconfig->numOps; i++)
+    {
+      free (pconfig->ops[i].section);
+      free (pconfig->ops[i].id);
+      free (pconfig->ops[i].value);
+    }
+  free (pconfig->ops);
+  pconfig->ops = NULL;
+  pconfig->numOps = pconfig->maxOps = 0;
+}
+
+
+/*
+ *  Journal record:
+ *
+ *	<op> <section length> <id length> <value length> <checksum>\n
+ *	<section><id><value>\n
+ *
+ *  op is W (set a key), D (delete a key) or S (delete a section);
+ *  the checksum is a FNV-1a hash of the three strings.
+ */
+static int
+_cfg_journalrecord (char **pBuf, size_t *pLen, size_t *pMax, PCFGOP op)
+{
+  char head[96];
+  size_t sl, il, vl;
+  unsigned int h;
+
+  sl = strlen (op->section);
+  il = op->id ? strlen (op->id) : 0;
+  vl = op->value ? strlen (op->value) : 0;
+  h = _cfg_hashmem (2166136261u, op->section, sl);
+  if (op->id)
+    h = _cfg_hashmem (h, op->id, il);
+  if (op->value)
+    h = _cfg_hashmem (h, op->value, vl);
+  sprintf (head, "%c %lu %lu %lu %08x\n",
+      !op->id ? 'S' : !op->value ? 'D' : 'W',
+      (unsigned long) sl, (unsigned long) il, (unsigned long) vl, h);
+
+  if (_cfg_append (pBuf, pLen, pMax, head, strlen (head))
+      || _cfg_append (pBuf, pLen, pMax, op->section, sl)
+      || (op->id && _cfg_append (pBuf, pLen, pMax, op->id, il))
+      || (op->value && _cfg_append (pBuf, pLen, pMax, op->value, vl))
+      || _cfg_append (pBuf, pLen, pMax, "\n", 1))
+    return -1;
+  return 0;
+}
+
+
+/*
+ *  Check the record at p, in a buffer ending with a 0 at end;
+ *  returns its payload, or NULL if the record is torn or corrupt
+ */
+static char *
+_cfg_journalcheck (char *p, char *end, char *pOp, unsigned long *pSl,
+    unsigned long *pIl, unsigned long *pVl)
+{
+  char *nl, *payload;
+  unsigned long n;
+  unsigned int h;
+
+  if ((nl = memchr (p, '\n', end - p)) == NULL
+      || sscanf (p, "%c %lu %lu %lu %x", pOp, pSl, pIl, pVl, &h) != 5)
+    return NULL;
+  payload = nl + 1;
+  n = *pSl + *pIl + *pVl;
+  if ((size_t) (end - payload) < n + 1 || payload[n] != '\n'
+      || _cfg_hashmem (2166136261u, payload, n) != h)
+    return NULL;
+  return payload;
+}
+
+
+/*
+ *  Apply the journal on top of the freshly parsed file.
+ *  Replay stops at the first torn or corrupt record.
+ */
+static int
+_cfg_replay (PCONFIG pconfig)
+{
+  struct TCFGSUBS *subs;
+  struct stat sb;
+  char *mem, *p, *end, *payload;
+  char *section, *id, *value;
+  unsigned long sl, il, vl;
+  char op;
+  int fd, rc = 0;
+
+  pconfig->journalSize = pconfig->journalValid = 0;
+  pconfig->journalMtime = 0;
+  if (pconfig->journalName == NULL)
+    return 0;
+  if ((fd = open (pconfig->journalName, O_RDONLY | O_BINARY)) == -1)
+    return errno == ENOENT ? 0 : -1;
+  if (fstat (fd, &sb) == -1
+      || (mem = (char *) malloc (sb.st_size + 1)) == NULL)
+    {
+      close (fd);
+      return -1;
+    }
+  if (read (fd, mem, sb.st_size) != sb.st_size)
+    {
+      free (mem);
+      close (fd);
+      return -1;
+    }
+  close (fd);
+  mem[sb.st_size] = 0;
+
+  /* replayed writes are part of the loaded state, not news */
+  subs = pconfig->subs;
+  pconfig->subs = NULL;
+
+  end = mem + sb.st_size;
+  for (p = mem; rc == 0 && p < end; p = payload + sl + il + vl + 1)
+    {
+      if ((payload = _cfg_journalcheck (p, end, &op, &sl, &il, &vl)) == NULL)
+	break;
+
+      section = strndup (payload, sl);
+      id = op != 'S' ? strndup (payload + sl, il) : NULL;
+      value = op == 'W' ? strndup (payload + sl + il, vl) : NULL;
+      if (section == NULL || (op != 'S' && id == NULL)
+	  || (op == 'W' && value == NULL))
+	rc = -1;
+      else
+	rc = _cfg_write (pconfig, section, id, value);
+      free (section);
+      free (id);
+      free (value);
+      if (rc == 0)
+	pconfig->journalValid = payload + sl + il + vl + 1 - mem;
+    }
+
+  pconfig->subs = subs;
+  pconfig->dirty = 0;
+  pconfig->journalSize = sb.st_size;
+  pconfig->journalMtime = sb.st_mtime;
+  free (mem);
+
+  return rc;
+}
+
+
+/*
+ *  Open the journal and lock it for writing. Handles append to it and
+ *  compact it only under this lock.
+ */
+static int
+_cfg_journallock (PCONFIG pconfig)
+{
+  int fd;
+
+  if ((fd = open (pconfig->journalName, O_RDWR | O_CREAT | O_APPEND
+	      | O_BINARY, 0644)) == -1)
+    return -1;
+  if (_cfg_lockfd (fd) == -1)
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+
+/*
+ *  With the journal locked at fd, catch up with what other handles
+ *  did since this one loaded: records they appended, or a compaction
+ *  that replaced the file. Then the file is read again, the whole
+ *  journal replayed and the pending writes applied on top, so that
+ *  the image holds every committed record before it is folded or
+ *  appended to.
+ */
+static int
+_cfg_journalsync (PCONFIG pconfig, int fd)
+{
+  struct stat sb, jb;
+  char *mem;
+  int mfd;
+
+  if (fstat (fd, &jb) == -1 || stat (pconfig->fileName, &sb) == -1)
+    return -1;
+  if ((size_t) jb.st_size == pconfig->journalSize
+      && (size_t) sb.st_size == pconfig->size
+      && sb.st_mtime == pconfig->mtime
+      && sb.st_mtim.tv_nsec == pconfig->mtimeNsec
+      && (unsigned long) sb.st_ino == pconfig->inode)
+    return 0;
+
+  if ((mfd = open (pconfig->fileName, O_RDONLY | O_BINARY)) == -1)
+    return -1;
+  mem = (char *) malloc (sb.st_size + 1);
+  if (mem == NULL || read (mfd, mem, sb.st_size) != sb.st_size)
+    {
+      free (mem);
+      close (mfd);
+      return -1;
+    }
+  close (mfd);
+  mem[sb.st_size] = 0;
+
+  if (_cfg_adopt (pconfig, mem, sb.st_size, sb.st_mtime, 1) == -1)
+    return -1;
+  _cfg_setversion (pconfig, &sb);
+  return 0;
+}
+
+
+/*
+ *  Write the image over the file and empty the journal at fd, locked
+ *  and synced; without a journal fd is -1
+ */
+static int
+_cfg_fold (PCONFIG pconfig, int fd)
+{
+  struct stat sb;
+
+  if (_cfg_writeatomic (pconfig, &sb) == -1)
+    return -1;
+  _cfg_setversion (pconfig, &sb);
+
+  /* a crash before this point only replays writes already folded in */
+  if (fd != -1)
+    {
+      if (ftruncate (fd, 0) == -1 || fstat (fd, &sb) == -1)
+	return -1;
+      pconfig->journalSize = pconfig->journalValid = sb.st_size;
+      pconfig->journalMtime = sb.st_mtime;
+    }
+  _cfg_freeops (pconfig);
+  pconfig->dirty = 0;
+
+  return 0;
+}
+
+
+/*
+ *  Append the pending writes to the journal
+ */
+static int
+_cfg_journalcommit (PCONFIG pconfig)
+{
+  struct stat sb;
+  char *buf = NULL;
+  size_t len = 0, max = 0, limit;
+  unsigned int i;
+  int fd, rc = 0;
+
+  /* a write that changed nothing in this image, as a delete of a
+     section another handle added, still goes to the journal */
+  if (pconfig->numOps == 0)
+    {
+      pconfig->dirty = 0;
+      return 0;
+    }
+
+  for (i = 0; i < pconfig->numOps; i++)
+    if (_cfg_journalrecord (&buf, &len, &max, &pconfig->ops[i]) == -1)
+      {
+	free (buf);
+	return -1;
+      }
+
+  if ((fd = _cfg_journallock (pconfig)) == -1)
+    {
+      free (buf);
+      return -1;
+    }
+  /* other writers of the journal append under the same lock, so a
+     record that does not check out after the sync is torn, not half
+     written: cut it off, or it would hide ours */
+  if (_cfg_journalsync (pconfig, fd) == -1 || fstat (fd, &sb) == -1
+      || ((size_t) sb.st_size > pconfig->journalValid
+	  && ftruncate (fd, pconfig->journalValid) == -1)
+      || write (fd, buf, len) != (ssize_t) len || fstat (fd, &sb) == -1)
+    {
+      free (buf);
+      _cfg_unlockfd (fd);
+      return -1;
+    }
+  free (buf);
+
+  _cfg_freeops (pconfig);
+  pconfig->dirty = 0;
+  pconfig->journalSize = pconfig->journalValid = sb.st_size;
+  pconfig->journalMtime = sb.st_mtime;
+
+  limit = pconfig->journalLimit > pconfig->size ?
+      pconfig->journalLimit : pconfig->size;
+  if (pconfig->journalSize > limit)
+    rc = _cfg_fold (pconfig, fd);
+  _cfg_unlockfd (fd);
+
+  return rc;
+}
+
+
+/*
+ *  Replace the file with the formatted configuration: write a
+ *  temporary file next to it and rename it over the original
+ */
+static int
+_cfg_writeatomic (PCONFIG pconfig, struct stat *psb)
+{
+  return _cfg_replace (pconfig->fileName, pconfig, NULL, 0, psb);
+}
+
+
+/*
+ *  Replace fileName through a temporary file with the formatted
+ *  content of pconfig, or if that is NULL, with buf. The temporary
+ *  file gets a name of its own, next to fileName, so that writers in
+ *  other threads and processes each rename a whole file of theirs.
+ */
+static int
+_cfg_replace (const char *fileName, PCONFIG pconfig, const char *buf,
+    size_t size, struct stat *psb)
+{
+  struct stat sb;
+  char *tmpName;
+  FILE *fp;
+  int fd, rc;
+
+  if ((tmpName = (char *) malloc (strlen (fileName) + 8)) == NULL)
+    return -1;
+  sprintf (tmpName, "%s.XXXXXX", fileName);
+  if ((fd = mkstemp (tmpName)) == -1)
+    {
+      free (tmpName);
+      return -1;
+    }
+  if ((fp = fdopen (fd, "w")) == NULL)
+    {
+      close (fd);
+      unlink (tmpName);
+      free (tmpName);
+      return -1;
+    }
+  fchmod (fd, stat (fileName, &sb) == 0 ? sb.st_mode & 07777 : 0644);
+
+  rc = 0;
+  if (pconfig)
+    rc = _cfg_outputformatted (pconfig, fp);
+  else
+    fwrite (buf, 1, size, fp);
+
+  rc = rc == -1 || ferror (fp) || fflush (fp) || fsync (fileno (fp)) ? -1 : 0;
+  if (fclose (fp) || rc == -1 || rename (tmpName, fileName) == -1
+      || stat (fileName, psb) == -1)
+    {
+      unlink (tmpName);
+      free (tmpName);
+      return -1;
+    }
+  free (tmpName);
+
+  return 0;
+}
+
+
+/*
+ *  Fold the journal into the file
+ */
+int
+cfg_compact (PCONFIG pconfig)
+{
+  int fd, rc;
+
+  if (!_cfg_writable (pconfig))
+    return -1;
+  if (pconfig->dir)
+    return _cfg_dircommit (pconfig, 1);
+  _cfg_settle (pconfig);
+  if (pconfig->journalName == NULL)
+    return _cfg_fold (pconfig, -1);
+
+  /* fold in what other handles appended, under their lock */
+  if ((fd = _cfg_journallock (pconfig)) == -1)
+    return -1;
+  rc = _cfg_journalsync (pconfig, fd) == -1 ? -1 : _cfg_fold (pconfig, fd);
+  _cfg_unlockfd (fd);
+
+  return rc;
+}
+
+
+/*
+ *  Write the changed file back
+ */
+static int
+_cfg_commit (PCONFIG pconfig)
+{
+  FILE *fp;
+
+  if (!_cfg_writable (pconfig))
+    return -1;
+  if (pconfig->dir)
+    return _cfg_dircommit (pconfig, 0);
+  _cfg_settle (pconfig);
+
+  if (pconfig->journalName)
+    return _cfg_journalcommit (pconfig);
+  /* a pending write may have changed nothing in this image, but will
+     in a newer file */
+  if (pconfig->openFlags & CFG_OPEN_OPTIMISTIC)
+    return pconfig->dirty || pconfig->numOps ? _cfg_optcommit (pconfig) : 0;
+
+  if (pconfig->dirty)
+    {
+      /* parse what is deferred before the file is emptied */
+      if (_cfg_loadall (pconfig) == -1
+	  || (fp = fopen (pconfig->fileName, "w")) == NULL)
+	return -1;
+
+      _cfg_outputformatted (pconfig, fp);
+
+      fclose (fp);
+
+      pconfig->dirty = 0;
+    }
+
+  return 0;
+}
+
+
+int
+cfg_commit (PCONFIG pconfig)
+{
+  int rc;
+
+  CFG_PROBE2 (commit_entry, pconfig ? pconfig->fileName : NULL,
+      pconfig ? __atomic_load_n (&pconfig->dirty, __ATOMIC_RELAXED) : 0);
+  if (pconfig && pconfig->locks)
+    rc = _cfg_lockedcommit (pconfig);
+  else
+    rc = _cfg_commit (pconfig);
+  CFG_PROBE2 (commit_return, pconfig ? pconfig->fileName : NULL, rc);
+  return rc;
+}
+
+
+/*** BATCH LOAD MODULE ****/
+
+
+/* file being loaded through io_uring */
+typedef struct
+  {
+#ifdef CFG_HAVE_URING
+    struct statx stx;
+#endif
+    char *mem;
+    size_t size;
+    struct stat sb;		/* Version of the file, from the statx */
+    size_t done;		/* Bytes read so far */
+    int fd;
+    int waiting;		/* Open and statx not completed yet */
+    int failed;
+    int finished;		/* Handed on to the workers */
+  }
+TCFGLOAD;
+
+typedef struct
+  {
+    PCONFIG *ppconf;
+    const char **paths;
+    int flags;
+    TCFGLOAD *files;		/* NULL: workers open the files themselves */
+    unsigned int *ready;	/* Files waiting to be parsed */
+    unsigned int head, tail;
+    unsigned int staged;	/* ready[tail..staged) not yet published */
+    int closed;			/* Nothing more will be added to ready */
+    int failed;
+    int abandoned;		/* The kernel may still write to files */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+  }
+TCFGBATCH;
+
+
+static void
+_cfg_batchpush (TCFGBATCH *b, unsigned int i)
+{
+  b->ready[b->staged++] = i;
+}
+
+
+/*
+ *  Make the files pushed so far visible to the workers; once per
+ *  batch of completions rather than once per file
+ */
+static void
+_cfg_batchpublish (TCFGBATCH *b)
+{
+  pthread_mutex_lock (&b->lock);
+  if (b->tail != b->staged)
+    {
+      b->tail = b->staged;
+      pthread_cond_broadcast (&b->cond);
+    }
+  pthread_mutex_unlock (&b->lock);
+}
+
+
+static void
+_cfg_batchfail (TCFGBATCH *b, unsigned int i)
+{
+  cfg_done (b->ppconf[i]);
+  b->ppconf[i] = NULL;
+  pthread_mutex_lock (&b->lock);
+  b->failed = 1;
+  pthread_mutex_unlock (&b->lock);
+}
+
+
+/*
+ *  Worker: parse (or open) the files from the ready list until it is
+ *  closed and empty
+ */
+static void *
+_cfg_batchwork (void *arg)
+{
+  TCFGBATCH *b = (TCFGBATCH *) arg;
+  TCFGLOAD *f;
+  unsigned int i;
+  int rc;
+
+  pthread_mutex_lock (&b->lock);
+  while (1)
+    {
+      while (b->head == b->tail && !b->closed)
+	pthread_cond_wait (&b->cond, &b->lock);
+      if (b->head == b->tail)
+	break;
+      i = b->ready[b->head++];
+      pthread_mutex_unlock (&b->lock);
+
+      if (b->files == NULL || (f = &b->files[i])->mem == NULL)
+	{
+	  cfg_done (b->ppconf[i]);
+	  rc = cfg_open (&b->ppconf[i], b->paths[i], b->flags);
+	}
+      else
+	{
+	  rc = _cfg_adopt (b->ppconf[i], f->mem, f->size, f->sb.st_mtime, 0)
+	      == -1 ? -1 : 0;
+	  f->mem = NULL;
+	  if (rc == -1)
+	    {
+	      cfg_done (b->ppconf[i]);
+	      b->ppconf[i] = NULL;
+	    }
+	  else
+	    _cfg_setversion (b->ppconf[i], &f->sb);
+	}
+
+      pthread_mutex_lock (&b->lock);
+      if (rc == -1)
+	b->failed = 1;
+    }
+  pthread_mutex_unlock (&b->lock);
+
+  return NULL;
+}
+
+
+#ifdef CFG_HAVE_URING
+
+#define CFG_RING_ENTRIES	256
+
+#define CFG_OP_OPEN	0
+#define CFG_OP_STATX	1
+#define CFG_OP_READ	2
+#define CFG_OP_CLOSE	3
+
+typedef struct
+  {
+    int fd;
+    unsigned int entries;
+    unsigned int inflight;	/* Queued or submitted, not completed */
+    unsigned int toSubmit;
+    unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned int *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqSize, cqSize;
+  }
+TCFGRING;
+
+
+static int
+_cfg_ringinit (TCFGRING *ring)
+{
+  struct io_uring_params params;
+  char *sq, *cq;
+
+  memset (ring, 0, sizeof (TCFGRING));
+  memset (&params, 0, sizeof (params));
+  if ((ring->fd = syscall (__NR_io_uring_setup, CFG_RING_ENTRIES,
+	      &params)) < 0)
+    return -1;
+
+  /* OPENAT, STATX and READ came with the same kernel as this flag */
+  if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+      close (ring->fd);
+      return -1;
+    }
+
+  ring->entries = params.sq_entries;
+  ring->sqSize = params.sq_off.array
+      + params.sq_entries * sizeof (unsigned int);
+  ring->cqSize = params.cq_off.cqes
+      + params.cq_entries * sizeof (struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sqSize = ring->cqSize = ring->sqSize > ring->cqSize
+	? ring->sqSize : ring->cqSize;
+
+  ring->sqRing = mmap (NULL, ring->sqSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED)
+    {
+      close (ring->fd);
+      return -1;
+    }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring->cqRing = ring->sqRing;
+  else if ((ring->cqRing = mmap (NULL, ring->cqSize, PROT_READ | PROT_WRITE,
+	      MAP_SHARED | MAP_POPULATE, ring->fd,
+	      IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+      munmap (ring->sqRing, ring->sqSize);
+      close (ring->fd);
+      return -1;
+    }
+  ring->sqes = (struct io_uring_sqe *) mmap (NULL,
+      params.sq_entries * sizeof (struct io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+      IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      if (ring->cqRing != ring->sqRing)
+	munmap (ring->cqRing, ring->cqSize);
+      munmap (ring->sqRing, ring->sqSize);
+      close (ring->fd);
+      return -1;
+    }
+
+  sq = (char *) ring->sqRing;
+  cq = (char *) ring->cqRing;
+  ring->sqHead = (unsigned int *) (sq + params.sq_off.head);
+  ring->sqTail = (unsigned int *) (sq + params.sq_off.tail);
+  ring->sqMask = (unsigned int *) (sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned int *) (sq + params.sq_off.array);
+  ring->cqHead = (unsigned int *) (cq + params.cq_off.head);
+  ring->cqTail = (unsigned int *) (cq + params.cq_off.tail);
+  ring->cqMask = (unsigned int *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return 0;
+}
+
+
+static void
+_cfg_ringdone (TCFGRING *ring)
+{
+  munmap (ring->sqes, ring->entries * sizeof (struct io_uring_sqe));
+  if (ring->cqRing != ring->sqRing)
+    munmap (ring->cqRing, ring->cqSize);
+  munmap (ring->sqRing, ring->sqSize);
+  close (ring->fd);
+}
+
+
+/*
+ *  Next free submission slot; the caller keeps inflight below entries
+ */
+static struct io_uring_sqe *
+_cfg_ringsqe (TCFGRING *ring, unsigned int i, int op)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int tail, index;
+
+  tail = *ring->sqTail;
+  index = tail & *ring->sqMask;
+  sqe = &ring->sqes[index];
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->user_data = ((unsigned long long) i << 2) | op;
+  ring->sqArray[index] = index;
+  __atomic_store_n (ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  ring->toSubmit++;
+  ring->inflight++;
+
+  return sqe;
+}
+
+
+static void
+_cfg_ringread (TCFGRING *ring, TCFGLOAD *f, unsigned int i)
+{
+  struct io_uring_sqe *sqe = _cfg_ringsqe (ring, i, CFG_OP_READ);
+
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = f->fd;
+  sqe->addr = (unsigned long) (f->mem + f->done);
+  sqe->len = f->size - f->done;
+  sqe->off = f->done;
+}
+
+
+/*
+ *  The file is read or has failed: close it and pass it on
+ */
+static void
+_cfg_ringfinish (TCFGBATCH *b, TCFGRING *ring, unsigned int i)
+{
+  TCFGLOAD *f = &b->files[i];
+  struct io_uring_sqe *sqe;
+
+  f->finished = 1;
+  if (f->fd >= 0)
+    {
+      sqe = _cfg_ringsqe (ring, i, CFG_OP_CLOSE);
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = f->fd;
+      f->fd = -1;
+    }
+  if (f->failed)
+    {
+      free (f->mem);
+      f->mem = NULL;
+      _cfg_batchfail (b, i);
+    }
+  else
+    {
+      f->mem[f->size] = 0;
+      _cfg_batchpush (b, i);
+    }
+}
+
+
+/*
+ *  Each completion queues at most one follow-up, so the slot it frees
+ *  is always enough
+ */
+static void
+_cfg_ringcomplete (TCFGBATCH *b, TCFGRING *ring, struct io_uring_cqe *cqe)
+{
+  unsigned int i = (unsigned int) (cqe->user_data >> 2);
+  TCFGLOAD *f = &b->files[i];
+
+  ring->inflight--;
+  switch (cqe->user_data & 3)
+    {
+    case CFG_OP_OPEN:
+      if (cqe->res < 0)
+	f->failed = 1;
+      else
+	f->fd = cqe->res;
+      break;
+    case CFG_OP_STATX:
+      if (cqe->res < 0)
+	f->failed = 1;
+      /* what an optimistic commit compares with the file on disk */
+      f->sb.st_size = f->stx.stx_size;
+      f->sb.st_ino = f->stx.stx_ino;
+      f->sb.st_mtim.tv_sec = f->stx.stx_mtime.tv_sec;
+      f->sb.st_mtim.tv_nsec = f->stx.stx_mtime.tv_nsec;
+      break;
+    case CFG_OP_READ:
+      if (cqe->res <= 0)
+	f->failed = 1;
+      else if ((f->done += cqe->res) < f->size)
+	_cfg_ringread (ring, f, i);
+      if (f->failed || f->done == f->size)
+	_cfg_ringfinish (b, ring, i);
+      return;
+    default:
+      return;
+    }
+
+  /* open and statx both done */
+  if (--f->waiting)
+    return;
+  if (!f->failed)
+    {
+      f->size = f->stx.stx_size;
+      if ((f->mem = (char *) malloc (f->size + 1)) == NULL)
+	f->failed = 1;
+      else if (f->size)
+	{
+	  _cfg_ringread (ring, f, i);
+	  return;
+	}
+    }
+  _cfg_ringfinish (b, ring, i);
+}
+
+
+/*
+ *  Stat, open and read all files through one ring, handing each one
+ *  to the workers as soon as its data is in
+ */
+static int
+_cfg_ringload (TCFGBATCH *b, unsigned int n)
+{
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  TCFGRING ring;
+  TCFGLOAD *f;
+  unsigned int head, tail, next = 0;
+  int rc;
+
+  if (_cfg_ringinit (&ring) == -1)
+    return -1;
+
+  while (next < n || ring.inflight)
+    {
+      while (next < n && ring.inflight + 2 <= ring.entries)
+	{
+	  f = &b->files[next];
+	  f->fd = -1;
+	  f->waiting = 2;
+	  if (b->ppconf[next] == NULL)
+	    {
+	      f->finished = 1;
+	      _cfg_batchfail (b, next++);
+	      continue;
+	    }
+
+	  sqe = _cfg_ringsqe (&ring, next, CFG_OP_OPEN);
+	  sqe->opcode = IORING_OP_OPENAT;
+	  sqe->fd = AT_FDCWD;
+	  sqe->addr = (unsigned long) b->paths[next];
+	  sqe->open_flags = O_RDONLY | O_BINARY;
+
+	  sqe = _cfg_ringsqe (&ring, next, CFG_OP_STATX);
+	  sqe->opcode = IORING_OP_STATX;
+	  sqe->fd = AT_FDCWD;
+	  sqe->addr = (unsigned long) b->paths[next];
+	  sqe->len = STATX_SIZE | STATX_MTIME | STATX_INO;
+	  sqe->off = (unsigned long) &f->stx;
+	  next++;
+	}
+
+      rc = syscall (__NR_io_uring_enter, ring.fd, ring.toSubmit,
+	  ring.inflight ? 1 : 0, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (rc < 0)
+	{
+	  if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+	    continue;
+	  /*
+	   *  Should not happen. Requests already submitted may still
+	   *  write to their buffers, so those are left alone; files
+	   *  not finished are opened by the workers.
+	   */
+	  b->abandoned = 1;
+	  for (head = 0; head < next; head++)
+	    if (!b->files[head].finished)
+	      {
+		b->files[head].mem = NULL;
+		_cfg_batchpush (b, head);
+	      }
+	  for (; next < n; next++)
+	    _cfg_batchpush (b, next);
+	  _cfg_batchpublish (b);
+	  break;
+	}
+      ring.toSubmit -= rc;
+
+      head = *ring.cqHead;
+      tail = __atomic_load_n (ring.cqTail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++)
+	{
+	  cqe = &ring.cqes[head & *ring.cqMask];
+	  _cfg_ringcomplete (b, &ring, cqe);
+	}
+      __atomic_store_n (ring.cqHead, head, __ATOMIC_RELEASE);
+      _cfg_batchpublish (b);
+    }
+
+  _cfg_ringdone (&ring);
+  return 0;
+}
+
+#endif /* CFG_HAVE_URING */
+
+
+int
+cfg_init_many (PCONFIG *ppconf, const char **paths, unsigned int n,
+    int flags)
+{
+  TCFGBATCH b;
+  pthread_t *threads;
+  unsigned int i, numThreads, started = 0;
+  long cpus;
+  int uring = 0;
+
+  if (ppconf == NULL || paths == NULL)
+    return -1;
+  memset (&b, 0, sizeof (b));
+  b.ppconf = ppconf;
+  b.paths = paths;
+  b.flags = flags;
+  for (i = 0; i < n; i++)
+    ppconf[i] = NULL;
+  if (n == 0)
+    return 0;
+
+  if ((b.ready = (unsigned int *) malloc (n * sizeof (unsigned int))) == NULL)
+    return -1;
+  pthread_mutex_init (&b.lock, NULL);
+  pthread_cond_init (&b.cond, NULL);
+
+  cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  if (cpus < 1)
+    cpus = 1;
+
+#ifdef CFG_HAVE_URING
+  /* the handles are set up here, the workers only parse */
+  if ((b.files = (TCFGLOAD *) calloc (n, sizeof (TCFGLOAD))) != NULL)
+    {
+      for (i = 0; i < n; i++)
+	ppconf[i] = _cfg_new (paths[i], flags);
+      uring = 1;
+      /* the calling thread parses too once the ring is drained */
+      numThreads = cpus - 1;
+    }
+#endif
+  if (!uring)
+    {
+      /* the workers block in the file calls, so use more of them */
+      for (i = 0; i < n; i++)
+	b.ready[b.tail++] = i;
+      b.staged = b.tail;
+      b.closed = 1;
+      numThreads = cpus * 4 > 32 ? 32 : cpus * 4;
+    }
+  if (numThreads > n)
+    numThreads = n;
+
+  threads = (pthread_t *) malloc ((numThreads + 1) * sizeof (pthread_t));
+  for (i = 0; threads && i < numThreads; i++)
+    if (pthread_create (&threads[started], NULL, _cfg_batchwork, &b) == 0)
+      started++;
+
+#ifdef CFG_HAVE_URING
+  if (uring && _cfg_ringload (&b, n) == -1)
+    {
+      /* no io_uring here: the workers open the files */
+      for (i = 0; i < n; i++)
+	_cfg_batchpush (&b, i);
+      _cfg_batchpublish (&b);
+    }
+#endif
+
+  pthread_mutex_lock (&b.lock);
+  b.closed = 1;
+  pthread_cond_broadcast (&b.cond);
+  pthread_mutex_unlock (&b.lock);
+
+  /* the calling thread helps, and does all if no thread started */
+  _cfg_batchwork (&b);
+  for (i = 0; i < started; i++)
+    pthread_join (threads[i], NULL);
+
+  free (threads);
+  if (!b.abandoned)
+    free (b.files);
+  free (b.ready);
+  pthread_cond_destroy (&b.cond);
+  pthread_mutex_destroy (&b.lock);
+
+  return b.failed ? -1 : 0;
+}
+
+
+/*** DIRECTORY MODULE ****/
+
+
+/* fragments of a conf.d directory (cfg_open_dir) */
+struct TCFGDIR
+  {
+    PCONFIG *frags;		/* In lexical order of their names */
+    unsigned int numFrags;
+  };
+
+
+static int
+_cfg_namecmp (const void *a, const void *b)
+{
+  return strcmp (*(char * const *) a, *(char * const *) b);
+}
+
+
+static void
+_cfg_freelist (char **list, unsigned int n)
+{
+  while (n--)
+    free (list[n]);
+  free (list);
+}
+
+
+/*
+ *  The *.ini files of dirName, as paths, in lexical order
+ */
+static char **
+_cfg_dirlist (const char *dirName, unsigned int *pNum)
+{
+  struct dirent *de;
+  DIR *dp;
+  char **list = NULL, **newList;
+  unsigned int n = 0, max = 0;
+  size_t len;
+
+  if ((dp = opendir (dirName)) == NULL)
+    return NULL;
+  while ((de = readdir (dp)) != NULL)
+    {
+      len = strlen (de->d_name);
+      if (de->d_name[0] == '.' || len < 5
+	  || strcmp (de->d_name + len - 4, ".ini"))
+	continue;
+      if (n + 1 >= max)
+	{
+	  max = max ? max * 2 : 16;
+	  if ((newList = (char **) realloc (list, max * sizeof (char *)))
+	      == NULL)
+	    break;
+	  list = newList;
+	}
+      if ((list[n] = (char *) malloc (strlen (dirName) + len + 2)) == NULL)
+	break;
+      sprintf (list[n++], "%s/%s", dirName, de->d_name);
+    }
+  closedir (dp);
+  if (de != NULL)
+    {
+      _cfg_freelist (list, n);
+      return NULL;
+    }
+
+  /* an empty directory is a valid, empty configuration */
+  if (list == NULL && (list = (char **) malloc (sizeof (char *))) == NULL)
+    return NULL;
+  qsort (list, n, sizeof (char *), _cfg_namecmp);
+  *pNum = n;
+  return list;
+}
+
+
+static void
+_cfg_dirfree (struct TCFGDIR *dir)
+{
+  unsigned int i;
+
+  if (dir == NULL)
+    return;
+  for (i = 0; i < dir->numFrags; i++)
+    cfg_done (dir->frags[i]);
+  free (dir->frags);
+  free (dir);
+}
+
+
+/*
+ *  Is the loaded fragment what is on disk?
+ */
+static int
+_cfg_fragsame (PCONFIG f)
+{
+  struct stat sb, jb;
+
+  if (f->dirty || stat (f->fileName, &sb) == -1
+      || (size_t) sb.st_size != f->size || sb.st_mtime != f->mtime)
+    return 0;
+  memset (&jb, 0, sizeof (jb));
+  if (f->journalName)
+    stat (f->journalName, &jb);
+  return (size_t) jb.st_size == f->journalSize
+      && jb.st_mtime == f->journalMtime;
+}
+
+
+/*
+ *  Build the merged content from the fragments, each read as a lookup
+ *  in it would see it: sections in the order they first appear, keys
+ *  of later fragments replacing those of earlier ones. The entries point to the strings of the fragments
+ *  and remember which one they came from.
+ */
+static int
+_cfg_merge (PCONFIG pconfig)
+{
+  struct TCFGDIR *dir = pconfig->dir;
+  PCONFIG f;
+  PCFGSECT s, t;
+  PCFGENTRY e, d;
+  unsigned int i, pos, tpos, j;
+  int idx;
+
+  if ((pconfig->image = strdup ("")) == NULL
+      || _cfg_newsect (pconfig) == NULL)
+    return -1;
+  pconfig->imageAlloc = 1;
+  pconfig->flags |= CFG_VALID;
+
+  for (i = 0; i < dir->numFrags; i++)
+    {
+      f = dir->frags[i];
+      for (pos = 1; pos < f->numSections; pos++)
+	{
+	  /* as in lookups, a repeated section of one file is hidden */
+	  if ((s = _cfg_sect (f, pos)) == NULL)
+	    return -1;
+	  if (_cfg_sectfind (f, s->entries[0].section) != pos)
+	    continue;
+	  if ((tpos = _cfg_sectfind (pconfig, s->entries[0].section)) == 0)
+	    {
+	      if ((t = _cfg_newsect (pconfig)) == NULL
+		  || _cfg_storeat (pconfig, t, s->entries[0].section, NULL,
+		      NULL, NULL, 0) == NULL)
+		return -1;
+	      tpos = pconfig->numSections - 1;
+	      _cfg_sectinsert (pconfig, tpos);
+	    }
+	  t = pconfig->sections[tpos];
+	  t->entries[0].source = i + 1;
+
+	  for (j = 1, e = &s->entries[1]; j < s->numEntries; j++, e++)
+	    {
+	      if (!e->id || !e->value)
+		continue;
+	      if ((idx = _cfg_keyfind (t, e->id)) < 0)
+		{
+		  if ((d = _cfg_storeat (pconfig, t, NULL, e->id, e->value,
+			      e->comment, 0)) == NULL)
+		    return -1;
+		}
+	      else
+		{
+		  /* within one file the first of equal keys wins */
+		  d = &t->entries[idx];
+		  if (d->source == i + 1)
+		    continue;
+		  d->value = e->value;
+		  d->comment = e->comment;
+		}
+	      d->source = i + 1;
+	    }
+	}
+    }
+
+  return 0;
+}
+
+
+/*
+ *  cfg_refresh for a directory: reload all fragments if any of them,
+ *  or the list of them, changed
+ */
+static int
+_cfg_dirrefresh (PCONFIG pconfig)
+{
+  struct TCFGDIR *dir;
+  TCONFIG old;
+  char **paths;
+  unsigned int n, i;
+
+  if ((paths = _cfg_dirlist (pconfig->fileName, &n)) == NULL)
+    return -1;
+  _cfg_freechanges (pconfig);
+
+  if (!pconfig->dirty && pconfig->image && pconfig->dir
+      && pconfig->dir->numFrags == n)
+    {
+      for (i = 0; i < n; i++)
+	if (strcmp (paths[i], pconfig->dir->frags[i]->fileName)
+	    || !_cfg_fragsame (pconfig->dir->frags[i]))
+	  break;
+      if (i == n)
+	{
+	  _cfg_freelist (paths, n);
+	  return 0;
+	}
+    }
+
+  /* fragments are parsed in parallel */
+  if ((dir = (struct TCFGDIR *) calloc (1, sizeof (struct TCFGDIR))) == NULL
+      || (dir->frags = (PCONFIG *) calloc (n + 1, sizeof (PCONFIG))) == NULL
+      || cfg_init_many (dir->frags, (const char **) paths, n,
+	  pconfig->openFlags & (CFG_OPEN_JOURNAL | CFG_OPEN_LEAN)) == -1)
+    {
+      if (dir)
+	{
+	  dir->numFrags = n;
+	  _cfg_dirfree (dir);
+	}
+      _cfg_freelist (paths, n);
+      return -1;
+    }
+  dir->numFrags = n;
+  _cfg_freelist (paths, n);
+
+  /* the old content points into the old fragments: free those last */
+  old = *pconfig;
+  _cfg_reset (pconfig);
+  pconfig->dir = dir;
+  if (_cfg_merge (pconfig) == -1)
+    {
+      cfg_freeimage (&old);
+      _cfg_dirfree (old.dir);
+      cfg_freeimage (pconfig);
+      _cfg_dirfree (pconfig->dir);
+      pconfig->dir = NULL;
+      return -1;
+    }
+
+  if (old.image && _cfg_diff (&old, pconfig) == -1)
+    _cfg_freechanges (pconfig);
+  cfg_freeimage (&old);
+  _cfg_dirfree (old.dir);
+
+  for (i = 0; i < pconfig->numChanges; i++)
+    _cfg_notify (pconfig, pconfig->changes[i].section,
+	pconfig->changes[i].id, pconfig->changes[i].kind);
+
+  return 1;
+}
+
+
+int
+cfg_open_dir (PCONFIG *ppconf, const char *dirName, int flags)
+{
+  PCONFIG pconfig;
+
+  *ppconf = NULL;
+
+  if ((flags & CFG_OPEN_CREATE) && dirName && access (dirName, 0) == -1)
+    mkdir (dirName, 0755);
+
+  /* the journals are the fragments' own */
+  if ((pconfig = _cfg_new (dirName, flags & CFG_OPEN_LEAN)) == NULL)
+    return -1;
+  pconfig->openFlags = CFG_OPEN_DIR | (flags & (CFG_OPEN_JOURNAL
+	  | CFG_OPEN_LEAN));
+
+  if (_cfg_dirrefresh (pconfig) == -1)
+    {
+      cfg_done (pconfig);
+      return -1;
+    }
+  *ppconf = pconfig;
+
+  return 0;
+}
+
+
+/*
+ *  Fragment a write of section:id goes to: the one the key came from,
+ *  for a new key the last one with the section, for a new section
+ *  the last fragment. -1 if there are no fragments, or the block of
+ *  the section cannot be parsed.
+ */
+static int
+_cfg_route (PCONFIG pconfig, const char *section, const char *id)
+{
+  PCFGSECT s;
+  PCFGENTRY e;
+  unsigned int pos;
+
+  if ((pos = _cfg_sectfind (pconfig, section)) != 0)
+    {
+      if ((s = _cfg_sect (pconfig, pos)) == NULL)
+	return -1;
+      if (id && (e = _cfg_findentry (pconfig, section, id, NULL)) != NULL
+	  && e->source)
+	return e->source - 1;
+      if (s->entries[0].source)
+	return s->entries[0].source - 1;
+    }
+  return (int) pconfig->dir->numFrags - 1;
+}
+
+
+const char *
+cfg_source (PCONFIG pconfig, const char *section, const char *id)
+{
+  PCFGENTRY e;
+  int i;
+
+  if (!cfg_valid (pconfig) || pconfig->dir == NULL || section == NULL
+      || id == NULL)
+    return NULL;
+  if ((e = _cfg_findentry (pconfig, section, id, NULL)) == NULL)
+    return NULL;
+  if (e->source)
+    return pconfig->dir->frags[e->source - 1]->fileName;
+  if ((i = _cfg_route (pconfig, section, id)) < 0)
+    return NULL;
+  return pconfig->dir->frags[i]->fileName;
+}
+
+
+/*
+ *  cfg_commit for a directory: apply the pending writes to the
+ *  fragments they belong to and commit those. Deletes go to every
+ *  fragment, or the key of an earlier one would come back.
+ */
+static int
+_cfg_dircommit (PCONFIG pconfig, int compact)
+{
+  struct TCFGDIR *dir = pconfig->dir;
+  PCFGOP op;
+  PCFGENTRY e;
+  PCFGSECT s;
+  unsigned int i, j;
+  int target, rc = 0;
+
+  for (i = 0, op = pconfig->ops; i < pconfig->numOps; i++, op++)
+    {
+      if (op->id && op->value)
+	{
+	  if ((target = _cfg_route (pconfig, op->section, op->id)) < 0)
+	    {
+	      errno = ENOENT;
+	      return -1;
+	    }
+	  if (cfg_write (dir->frags[target], op->section, op->id,
+		  op->value) == -1)
+	    return -1;
+
+	  /* later writes and cfg_source follow it there */
+	  if ((e = _cfg_findentry (pconfig, op->section, op->id, &s)) != NULL)
+	    {
+	      e->source = target + 1;
+	      if (!s->entries[0].source)
+		s->entries[0].source = target + 1;
+	    }
+	  continue;
+	}
+      for (j = 0; j < dir->numFrags; j++)
+	do
+	  {
+	    if (cfg_write (dir->frags[j], op->section, op->id, NULL) == -1)
+	      return -1;
+	  }
+	/* a repeated key or section would show up in its place */
+	while (op->id ? _cfg_findentry (dir->frags[j], op->section, op->id,
+		NULL) != NULL : _cfg_sectfind (dir->frags[j], op->section) != 0);
+    }
+
+  for (j = 0; j < dir->numFrags; j++)
+    if (compact ? cfg_compact (dir->frags[j]) == -1
+	: dir->frags[j]->dirty && cfg_commit (dir->frags[j]) == -1)
+      rc = -1;
+  if (rc == 0)
+    {
+      _cfg_freeops (pconfig);
+      pconfig->dirty = 0;
+    }
+  return rc;
+}
+
+
+/*** FREEZE MODULE ****/
+
+
+/* key of a frozen handle, in hash slot order */
+typedef struct
+  {
+    uint64_t hash;		/* _cfg_frozenhash, to reject a miss */
+    unsigned int section;	/* offsets into the pool */
+    unsigned int id;
+    unsigned int value;
+    unsigned int len;		/* of the value */
+  }
+TCFGFSLOT;
+
+/* read only snapshot: one allocation holding the slots, the bucket
+   displacements and the pool of strings */
+struct TCFGFROZEN
+  {
+    uint64_t seed;
+    size_t size;		/* of the allocation */
+    unsigned int numKeys;
+    unsigned int numBuckets;
+    unsigned int *disp;
+    TCFGFSLOT *slots;
+    char *pool;
+  };
+
+/* key collected by cfg_freeze */
+typedef struct
+  {
+    const char *section;
+    const char *id;
+    const char *value;
+    char *valueFree;		/* expansion to free, if not cached */
+    size_t len;
+    uint64_t hash;		/* unseeded */
+    unsigned int slot;
+  }
+TCFGFKEY;
+
+#define CFG_FREEZE_SEEDS	32
+#define CFG_FREEZE_DISP		(1U << 22)
+
+
+static uint64_t
+_cfg_mix64 (uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+static unsigned int
+_cfg_mix32 (unsigned int h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+
+/*
+ *  64 bit FNV-1a of section:id, folded like _cfg_keyhash
+ */
+static uint64_t
+_cfg_frozenhash (const char *section, const char *id)
+{
+  uint64_t h = 14695981039346656037ULL;
+
+  while (*section)
+    h = (h ^ (unsigned char) tolower ((unsigned char) *section++))
+	* 1099511628211ULL;
+  h *= 1099511628211ULL;
+  while (*id == '\'' || *id == '\"')
+    id++;
+  while (*id && *id != '\'' && *id != '\"')
+    h = (h ^ (unsigned char) tolower ((unsigned char) *id++))
+	* 1099511628211ULL;
+  return h;
+}
+
+
+/*
+ *  Slot of a seeded hash: its bucket's displacement moves it
+ */
+static unsigned int
+_cfg_frozenslot (struct TCFGFROZEN *f, uint64_t g)
+{
+  return _cfg_mix32 ((unsigned int) g
+      + f->disp[(unsigned int) (g >> 32) % f->numBuckets] * 0x9E3779B9u)
+      % f->numKeys;
+}
+
+
+static const char *
+_cfg_frozenfind (struct TCFGFROZEN *f, const char *section, const char *id,
+    size_t *pLen)
+{
+  TCFGFSLOT *t;
+  uint64_t g;
+
+  if (f->numKeys == 0)
+    return NULL;
+  g = _cfg_mix64 (_cfg_frozenhash (section, id) ^ f->seed);
+  t = &f->slots[_cfg_frozenslot (f, g)];
+  if (t->hash != g || strcasecmp (f->pool + t->section, section)
+      || _cfg_idcmp (f->pool + t->id, id))
+    return NULL;
+  if (pLen)
+    *pLen = t->len;
+  return f->pool + t->value;
+}
+
+
+static void
+_cfg_frozenfree (PCONFIG pconfig)
+{
+  free (pconfig->frozen);
+  pconfig->frozen = NULL;
+}
+
+
+static int
+_cfg_bysize (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/*
+ *  Hash and displace: the keys of each bucket, largest buckets
+ *  first, are moved together by the first displacement that puts all
+ *  of them in free slots. Sets keys[].slot; returns 1 when a bucket
+ *  runs out of displacements under this seed, -1 when out of memory.
+ */
+static int
+_cfg_frozenbuild (struct TCFGFROZEN *f, TCFGFKEY *keys)
+{
+  unsigned int *size, *start, *members, *taken;
+  unsigned int n = f->numKeys, nb = f->numBuckets, b, i, j, k, d, s;
+  uint64_t *order, g;
+  int rc = -1;
+
+  size = (unsigned int *) calloc (nb, sizeof (unsigned int));
+  start = (unsigned int *) calloc (nb + 1, sizeof (unsigned int));
+  order = (uint64_t *) malloc (nb * sizeof (uint64_t));
+  members = (unsigned int *) malloc (n * sizeof (unsigned int));
+  taken = (unsigned int *) calloc (n, sizeof (unsigned int));
+  if (!size || !start || !order || !members || !taken)
+    goto done;
+
+  for (i = 0; i < n; i++)
+    size[(unsigned int) (_cfg_mix64 (keys[i].hash ^ f->seed) >> 32) % nb]++;
+  for (b = 0; b < nb; b++)
+    {
+      /* largest first, then by number */
+      start[b + 1] = start[b] + size[b];
+      order[b] = ((uint64_t) (UINT_MAX - size[b]) << 32) | b;
+    }
+  for (i = 0; i < n; i++)
+    {
+      g = _cfg_mix64 (keys[i].hash ^ f->seed);
+      members[start[(unsigned int) (g >> 32) % nb]++] = i;
+    }
+  for (b = 0; b < nb; b++)
+    start[b] -= size[b];
+  qsort (order, nb, sizeof (uint64_t), _cfg_bysize);
+
+  for (i = 0; i < nb && size[(unsigned int) order[i]]; i++)
+    {
+      b = (unsigned int) order[i];
+      for (d = 0; d < CFG_FREEZE_DISP; d++)
+	{
+	  /* the bucket's own keys are marked 2 while trying */
+	  for (j = 0; j < size[b]; j++)
+	    {
+	      k = members[start[b] + j];
+	      g = _cfg_mix64 (keys[k].hash ^ f->seed);
+	      s = _cfg_mix32 ((unsigned int) g + d * 0x9E3779B9u) % n;
+	      if (taken[s])
+		break;
+	      taken[s] = 2;
+	      keys[k].slot = s;
+	    }
+	  if (j == size[b])
+	    break;
+	  while (j-- > 0)
+	    taken[keys[members[start[b] + j]].slot] = 0;
+	}
+      if (d == CFG_FREEZE_DISP)
+	{
+	  rc = 1;
+	  goto done;
+	}
+      f->disp[b] = d;
+      for (j = 0; j < size[b]; j++)
+	taken[keys[members[start[b] + j]].slot] = 1;
+    }
+  rc = 0;
+
+done:
+  free (size);
+  free (start);
+  free (order);
+  free (members);
+  free (taken);
+  return rc;
+}
+
+
+/*
+ *  Copy a string into the pool, returning its offset
+ */
+static unsigned int
+_cfg_frozenput (char *pool, size_t *pUsed, const char *s, size_t len)
+{
+  size_t at = *pUsed;
+
+  memcpy (pool + at, s, len);
+  pool[at + len] = 0;
+  *pUsed = at + len + 1;
+  return (unsigned int) at;
+}
+
+
+int
+cfg_freeze (PCONFIG pconfig)
+{
+  struct TCFGFROZEN *f = NULL;
+  TCFGFKEY *keys = NULL, *k;
+  PCFGSECT s;
+  PCFGENTRY e;
+  TCFGFSLOT *t;
+  unsigned int n = 0, max = 0, pos, i, attempt;
+  const char *section = NULL, *id;
+  size_t poolSize = 0, used = 0, sect = 0, idLen, size;
+  char *value, *valueFree;
+  int rc = -1, built;
+
+  if (!cfg_valid (pconfig))
+    return -1;
+  if (pconfig->frozen)
+    return 0;
+  _cfg_settle (pconfig);
+
+  /* the keys a lookup can reach: the first block of each section and
+     the first of equal keys in it, with their values expanded */
+  for (pos = 1; pos < pconfig->numSections; pos++)
+    {
+      if ((s = _cfg_sect (pconfig, pos)) == NULL)
+	goto done;
+      if (_cfg_sectfind (pconfig, s->entries[0].section) != pos)
+	continue;
+      poolSize += strlen (s->entries[0].section) + 1;
+      for (i = 1, e = &s->entries[1]; i < s->numEntries; i++, e++)
+	{
+	  if (!e->id || !e->value || e->section
+	      || _cfg_keyfind (s, e->id) != (int) i)
+	    continue;
+	  if ((value = _cfg_expand (pconfig, s, e, s->entries[0].section, 0,
+		      &valueFree)) == NULL)
+	    {
+	      if (errno == ELOOP)
+		continue;
+	      goto done;
+	    }
+	  if (n == max)
+	    {
+	      max = max ? 2 * max : 64;
+	      if ((k = (TCFGFKEY *) realloc (keys, max * sizeof (TCFGFKEY)))
+		  == NULL)
+		{
+		  free (valueFree);
+		  goto done;
+		}
+	      keys = k;
+	    }
+	  k = &keys[n++];
+	  k->section = s->entries[0].section;
+	  k->id = e->id;
+	  k->value = value;
+	  k->valueFree = valueFree;
+	  k->len = strlen (value);
+	  k->hash = _cfg_frozenhash (k->section, k->id);
+	  poolSize += strlen (k->id) + 1 + k->len + 1;
+	}
+    }
+  if (poolSize > UINT_MAX)
+    {
+      errno = EFBIG;
+      goto done;
+    }
+
+  size = sizeof (struct TCFGFROZEN) + n * sizeof (TCFGFSLOT)
+      + (n / 4 + 1) * sizeof (unsigned int) + poolSize;
+  if ((f = (struct TCFGFROZEN *) malloc (size)) == NULL)
+    goto done;
+  f->size = size;
+  f->numKeys = n;
+  f->numBuckets = n / 4 + 1;
+  f->slots = (TCFGFSLOT *) (f + 1);
+  f->disp = (unsigned int *) (f->slots + n);
+  f->pool = (char *) (f->disp + f->numBuckets);
+  memset (f->disp, 0, f->numBuckets * sizeof (unsigned int));
+
+  for (attempt = 0; n && attempt < CFG_FREEZE_SEEDS; attempt++)
+    {
+      f->seed = _cfg_mix64 (attempt + 1);
+      if ((built = _cfg_frozenbuild (f, keys)) == 0)
+	break;
+      if (built == -1)
+	goto done;
+    }
+  if (n && attempt == CFG_FREEZE_SEEDS)
+    {
+      errno = EAGAIN;
+      goto done;
+    }
+
+  /* keys and values side by side, each section name once */
+  for (i = 0, k = keys; i < n; i++, k++)
+    {
+      if (k->section != section)
+	{
+	  section = k->section;
+	  sect = _cfg_frozenput (f->pool, &used, section, strlen (section));
+	}
+      t = &f->slots[k->slot];
+      t->hash = _cfg_mix64 (k->hash ^ f->seed);
+      t->section = (unsigned int) sect;
+      for (id = k->id; *id == '\'' || *id == '\"'; id++);
+      for (idLen = 0; id[idLen] && id[idLen] != '\'' && id[idLen] != '\"';
+	  idLen++);
+      t->id = _cfg_frozenput (f->pool, &used, id, idLen);
+      t->len = (unsigned int) k->len;
+      t->value = _cfg_frozenput (f->pool, &used, k->value, k->len);
+    }
+
+  pconfig->frozen = f;
+  f = NULL;
+  rc = 0;
+
+done:
+  for (i = 0; i < n; i++)
+    free (keys[i].valueFree);
+  free (keys);
+  free (f);
+  return rc;
+}
+
+
+/*** LIST MODULE ****/
+
+
+/* split of a value, cached on its entry */
+struct TCFGLIST
+  {
+    int sep;
+    unsigned int count;
+    TCFGSPAN items[1];
+  };
+
+/* blanks around list elements; a blank separator is not trimmed */
+#define _cfg_listblank(c, sep) \
+  (isspace ((unsigned char) (c)) && (c) != (sep))
+
+static const double _cfg_pow10[] =
+{
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/*
+ *  Count the sep characters in buf
+ */
+static size_t
+_cfg_countsep (const char *buf, size_t size, int sep)
+{
+  size_t n = 0, i = 0;
+
+#ifdef __SSE2__
+  __m128i c = _mm_set1_epi8 ((char) sep);
+
+  for (; i + 16 <= size; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (buf + i));
+
+      n += __builtin_popcount (_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, c)));
+    }
+#endif
+  for (; i < size; i++)
+    n += buf[i] == (char) sep;
+
+  return n;
+}
+
+
+/*
+ *  Split value on sep, or on runs of blanks if sep is 0, into spans
+ *  with the blanks around them trimmed. A blank value has no elements.
+ */
+static struct TCFGLIST *
+_cfg_split (const char *value, int sep)
+{
+  struct TCFGLIST *l;
+  const char *cp, *end, *next, *last;
+  size_t max;
+
+  for (cp = value; _cfg_listblank (*cp, sep); cp++);
+  for (end = cp + strlen (cp); end > cp && _cfg_listblank (end[-1], sep);
+      end--);
+
+  /* sized once: separators + 1, or half the characters for blanks */
+  if (cp == end)
+    max = 0;
+  else if (sep)
+    max = _cfg_countsep (cp, end - cp, sep) + 1;
+  else
+    max = (end - cp) / 2 + 1;
+  if ((l = (struct TCFGLIST *) malloc (sizeof (struct TCFGLIST)
+	      + (max ? max - 1 : 0) * sizeof (TCFGSPAN))) == NULL)
+    return NULL;
+  l->sep = sep;
+  l->count = 0;
+
+  if (cp == end)
+    return l;
+
+  /* a separator at the end leaves an empty last element */
+  for (;;)
+    {
+      if (sep)
+	{
+	  if ((next = memchr (cp, sep, end - cp)) == NULL)
+	    next = end;
+	}
+      else
+	for (next = cp; next < end && !isspace ((unsigned char) *next);
+	    next++);
+      for (last = next; last > cp && _cfg_listblank (last[-1], sep); last--);
+      l->items[l->count].ptr = cp;
+      l->items[l->count].len = last - cp;
+      l->count++;
+      if (next == end)
+	break;
+      for (cp = next + 1; cp < end && _cfg_listblank (*cp, sep); cp++);
+    }
+
+  return l;
+}
+
+
+int
+cfg_getlist (PCONFIG pconfig, const char *section, const char *id,
+    int sep, const TCFGSPAN **pItems)
+{
+  PCFGSECT s;
+  PCFGENTRY e;
+  const char *value;
+  struct TCFGLIST *l;
+
+  if ((value = _cfg_lookup (pconfig, section, id, &s, &e, NULL)) == NULL)
+    return -1;
+
+  if (s == NULL || _cfg_shared (pconfig, s))
+    {
+      /* as for the expansion, a shared or frozen entry is not written
+         to */
+      if ((l = _cfg_split (value, sep)) == NULL)
+	return -1;
+      free (pconfig->scratchList);
+      pconfig->scratchList = l;
+    }
+  else if ((l = e->list) == NULL || l->sep != sep)
+    {
+      if ((l = _cfg_split (value, sep)) == NULL)
+	return -1;
+      free (e->list);
+      e->list = l;
+    }
+
+  if (pItems)
+    *pItems = l->items;
+  return (int) l->count;
+}
+
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/*
+ *  The 8 bytes at p as a decimal number, or -1 if they are not all
+ *  digits: checked and combined 8 at a time in a 64 bit word
+ */
+static int64_t
+_cfg_digits8 (const char *p)
+{
+  uint64_t x;
+
+  memcpy (&x, p, 8);
+  if (((x & 0xF0F0F0F0F0F0F0F0ULL)
+	  | (((x + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+      != 0x3333333333333333ULL)
+    return -1;
+  x -= 0x3030303030303030ULL;
+  x = x * 10 + (x >> 8);
+  x = ((x & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))
+      + ((x >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))) >> 32;
+  return (int64_t) x;
+}
+#endif
+
+
+/*
+ *  Accumulate the decimal digits from cp into *pv; digits that no
+ *  longer fit are counted in *pDropped. Returns the end of the digits.
+ */
+static const char *
+_cfg_digits (const char *cp, const char *end, uint64_t *pv, int *pDropped)
+{
+  uint64_t v = *pv;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  int64_t d;
+
+  while (end - cp >= 8 && v < 100000000000ULL
+      && (d = _cfg_digits8 (cp)) >= 0)
+    {
+      v = v * 100000000 + (uint64_t) d;
+      cp += 8;
+    }
+#endif
+  for (; cp < end && (unsigned) (*cp - '0') < 10; cp++)
+    {
+      if (v <= (UINT64_MAX - 9) / 10)
+	v = v * 10 + (unsigned) (*cp - '0');
+      else
+	(*pDropped)++;
+    }
+
+  *pv = v;
+  return cp;
+}
+
+
+/*
+ *  Decimal long at *pp, moving *pp past it
+ */
+static int
+_cfg_parselong (const char **pp, const char *end, long *pv)
+{
+  const char *cp = *pp, *digits;
+  uint64_t v = 0;
+  int neg = 0, dropped = 0;
+
+  if (cp < end && (*cp == '-' || *cp == '+'))
+    neg = *cp++ == '-';
+  digits = cp;
+  cp = _cfg_digits (cp, end, &v, &dropped);
+  if (cp == digits)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if (dropped || v > (uint64_t) LONG_MAX + neg)
+    {
+      errno = ERANGE;
+      return -1;
+    }
+
+  *pv = neg ? -(long) (v - 1) - 1 : (long) v;
+  *pp = cp;
+  return 0;
+}
+
+
+/*
+ *  Double at *pp, moving *pp past it. Up to 2^53 with a power of ten
+ *  up to 22 is exact in a double, so one multiply or divide rounds
+ *  it correctly; the rest goes to strtod.
+ */
+static int
+_cfg_parsedouble (const char **pp, const char *end, double *pv)
+{
+  const char *cp = *pp, *digits, *frac, *ecp;
+  uint64_t m = 0;
+  int neg = 0, dropped = 0, exp = 0, e = 0, eneg = 0;
+  size_t nd;
+  char *ep;
+  double d;
+
+  if (cp < end && (*cp == '-' || *cp == '+'))
+    neg = *cp++ == '-';
+  digits = cp;
+  cp = _cfg_digits (cp, end, &m, &dropped);
+  nd = cp - digits;
+  if (cp < end && *cp == '.')
+    {
+      frac = ++cp;
+      cp = _cfg_digits (cp, end, &m, &dropped);
+      exp = -(int) (cp - frac);
+      nd += cp - frac;
+    }
+  if (nd && cp < end && (*cp == 'e' || *cp == 'E'))
+    {
+      ecp = cp + 1;
+      if (ecp < end && (*ecp == '-' || *ecp == '+'))
+	eneg = *ecp++ == '-';
+      if (ecp < end && (unsigned) (*ecp - '0') < 10)
+	{
+	  for (; ecp < end && (unsigned) (*ecp - '0') < 10; ecp++)
+	    if (e < 100000)
+	      e = e * 10 + (*ecp - '0');
+	  exp += eneg ? -e : e;
+	  cp = ecp;
+	}
+    }
+
+  if (nd && !dropped && m <= (1ULL << 53) && exp >= -22 && exp <= 22)
+    {
+      d = (double) m;
+      d = exp < 0 ? d / _cfg_pow10[-exp] : d * _cfg_pow10[exp];
+      *pv = neg ? -d : d;
+      *pp = cp;
+      return 0;
+    }
+
+  /* long mantissas, large exponents, inf and nan */
+  errno = 0;
+  d = strtod (*pp, &ep);
+  if (ep == *pp || ep > end)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if (errno == ERANGE && (d > 1 || d < -1))
+    return -1;
+
+  *pv = d;
+  *pp = ep;
+  return 0;
+}
+
+
+/*
+ *  Decode the list at section:id straight from its value, storing up
+ *  to n elements; returns the number of elements
+ */
+static int
+_cfg_decode (PCONFIG pconfig, const char *section, const char *id,
+    int sep, void *vals, unsigned int n, int isDouble)
+{
+  const char *cp, *end, *value;
+  unsigned int count = 0;
+  size_t len;
+  long lv;
+  double dv;
+  int rc;
+
+  if ((value = _cfg_lookup (pconfig, section, id, NULL, NULL, &len)) == NULL)
+    return -1;
+
+  end = value + len;
+  for (cp = value; _cfg_listblank (*cp, sep); cp++);
+  while (cp < end)
+    {
+      if (isDouble)
+	{
+	  if ((rc = _cfg_parsedouble (&cp, end, &dv)) == 0 && count < n)
+	    ((double *) vals)[count] = dv;
+	}
+      else if ((rc = _cfg_parselong (&cp, end, &lv)) == 0 && count < n)
+	((long *) vals)[count] = lv;
+      if (rc)
+	return -1;
+      count++;
+
+      /* the element ends at blanks and a separator, or the end */
+      value = cp;
+      for (; _cfg_listblank (*cp, sep); cp++);
+      if (cp == end)
+	break;
+      if (sep ? *cp != (char) sep : cp == value)
+	{
+	  errno = EINVAL;
+	  return -1;
+	}
+      for (cp += sep != 0; _cfg_listblank (*cp, sep); cp++);
+      if (cp == end)
+	{
+	  /* a separator with nothing after it */
+	  errno = EINVAL;
+	  return -1;
+	}
+    }
+
+  return count > INT_MAX ? INT_MAX : (int) count;
+}
+
+
+int
+cfg_getlongs (PCONFIG pconfig, const char *section, const char *id,
+    int sep, long *vals, unsigned int n)
+{
+  return _cfg_decode (pconfig, section, id, sep, vals, n, 0);
+}
+
+
+int
+cfg_getdoubles (PCONFIG pconfig, const char *section, const char *id,
+    int sep, double *vals, unsigned int n)
+{
+  return _cfg_decode (pconfig, section, id, sep, vals, n, 1);
+}
+
+
+/* "00" to "99", so that integers are formatted two digits at a time */
+static const char _cfg_pairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/*
+ *  Format v in decimal so that it ends at end, which is set to NUL;
+ *  returns where it starts. Up to 20 digits go before end.
+ */
+static char *
+_cfg_fmtu64 (char *end, uint64_t v)
+{
+  char *p = end;
+  unsigned int i;
+
+  *p = 0;
+  while (v >= 100)
+    {
+      i = (unsigned int) (v % 100) * 2;
+      v /= 100;
+      *--p = _cfg_pairs[i + 1];
+      *--p = _cfg_pairs[i];
+    }
+  if (v >= 10)
+    {
+      i = (unsigned int) v * 2;
+      *--p = _cfg_pairs[i + 1];
+      *--p = _cfg_pairs[i];
+    }
+  else
+    *--p = (char) ('0' + v);
+  return p;
+}
+
+
+static char *
+_cfg_fmti64 (char *end, int64_t v)
+{
+  char *p;
+
+  if (v >= 0)
+    return _cfg_fmtu64 (end, (uint64_t) v);
+  p = _cfg_fmtu64 (end, 0 - (uint64_t) v);
+  *--p = '-';
+  return p;
+}
+
+
+/*
+ *  Format v into buf of 32 bytes as the shortest decimal that reads
+ *  back as v. For k = 0, 1, ... fraction digits, the k digit decimal
+ *  nearest to v is n / 10^k, n rounded from v * 10^k; the first k for
+ *  which that quotient is v again gives the fewest digits. With n
+ *  below 2^53 and 10^k exact, the division rounds the same quotient
+ *  strtod does, so the digits read back as v. Values that need an
+ *  exponent, or more digits than that, take the smallest N for which
+ *  %.Ng reads back as v.
+ */
+static char *
+_cfg_fmtdouble (char *buf, double v)
+{
+  char digits[24], *p, *q;
+  double a, scaled;
+  uint64_t n;
+  size_t len;
+  int k, prec = 1;
+
+  a = fabs (v);
+  if (a == 0)
+    {
+      strcpy (buf, signbit (v) ? "-0" : "0");
+      return buf;
+    }
+  if (a >= 1e-5 && a < 1e15)
+    for (k = 0; k < (int) (sizeof (_cfg_pow10) / sizeof (double)); k++)
+      {
+	scaled = a * _cfg_pow10[k];
+	if (scaled + 0.5 >= 9007199254740992.0)
+	  {
+	    /* fewer than 15 digits did not do */
+	    prec = 15;
+	    break;
+	  }
+	n = (uint64_t) (scaled + 0.5);
+	if ((double) n / _cfg_pow10[k] != a)
+	  continue;
+
+	p = _cfg_fmtu64 (digits + sizeof (digits) - 1, n);
+	len = digits + sizeof (digits) - 1 - p;
+	q = buf;
+	if (v < 0)
+	  *q++ = '-';
+	if (k == 0)
+	  memcpy (q, p, len + 1);
+	else if ((int) len > k)
+	  {
+	    memcpy (q, p, len - k);
+	    q[len - k] = '.';
+	    memcpy (q + len - k + 1, p + len - k, k + 1);
+	  }
+	else
+	  {
+	    *q++ = '0';
+	    *q++ = '.';
+	    memset (q, '0', k - len);
+	    memcpy (q + k - len, p, len + 1);
+	  }
+	return buf;
+      }
+
+  for (; prec < 17; prec++)
+    {
+      snprintf (buf, 32, "%.*g", prec, v);
+      if (strtod (buf, NULL) == v)
+	return buf;
+    }
+  snprintf (buf, 32, "%.17g", v);
+  return buf;
+}
+
+
+static int
+_cfg_writetyped (PCONFIG pconfig, const char *section, const char *id,
+    char *value)
+{
+  /* a NULL id would delete the section */
+  if (id == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  return cfg_write (pconfig, (char *) section, (char *) id, value);
+}
+
+
+int
+cfg_write_int64 (PCONFIG pconfig, const char *section, const char *id,
+    int64_t value)
+{
+  char buf[24];
+
+  return _cfg_writetyped (pconfig, section, id,
+      _cfg_fmti64 (buf + sizeof (buf) - 1, value));
+}
+
+
+int
+cfg_write_uint64 (PCONFIG pconfig, const char *section, const char *id,
+    uint64_t value)
+{
+  char buf[24];
+
+  return _cfg_writetyped (pconfig, section, id,
+      _cfg_fmtu64 (buf + sizeof (buf) - 1, value));
+}
+
+
+int
+cfg_write_double (PCONFIG pconfig, const char *section, const char *id,
+    double value)
+{
+  char buf[32];
+
+  return _cfg_writetyped (pconfig, section, id, _cfg_fmtdouble (buf, value));
+}
+
+
+int
+cfg_write_bool (PCONFIG pconfig, const char *section, const char *id,
+    int value)
+{
+  return _cfg_writetyped (pconfig, section, id, value ? "1" : "0");
+}
+
+
+/*** ASYNC COMMIT MODULE ****/
+
+
+typedef struct
+  {
+    cfg_commit_t fn;
+    void *arg;
+  }
+TCFGDONE;
+
+/* background commits of one handle */
+struct TCFGASYNC
+  {
+    struct TCFGASYNC *next;	/* Writer queue */
+    PCONFIG pconfig;
+    char *buf;			/* Newest snapshot, not yet being written */
+    size_t size;
+    TCFGDONE *waiting;		/* Callbacks for buf */
+    unsigned int numWaiting, maxWaiting;
+    TCFGDONE *running;		/* Callbacks for the write in progress */
+    unsigned int numRunning, maxRunning;
+    int queued;
+    int writing;
+    char *records;		/* Journal records of buf */
+    size_t recordsLen, recordsMax;
+    int rc;			/* Result of the last write */
+    int settled;		/* Its result was applied to the handle */
+    struct stat sb;		/* Version of the file the snapshots build on */
+    struct stat jb;		/* Journal after the last write */
+    size_t journalValid;	/* Journal the snapshots hold, (size_t) -1
+				   if records of other handles came after */
+  };
+
+/* one writer thread serves all handles */
+static pthread_mutex_t _cfg_wlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _cfg_wwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _cfg_wdone = PTHREAD_COND_INITIALIZER;
+static struct TCFGASYNC *_cfg_whead, *_cfg_wtail;
+static int _cfg_wstarted;
+
+
+static int
+_cfg_adddone (TCFGDONE **pList, unsigned int *pNum, unsigned int *pMax,
+    cfg_commit_t fn, void *arg)
+{
+  TCFGDONE *newList;
+  unsigned int newMax;
+
+  if (*pNum >= *pMax)
+    {
+      newMax = *pMax ? *pMax * 2 : 4;
+      newList = (TCFGDONE *) realloc (*pList, newMax * sizeof (TCFGDONE));
+      if (newList == NULL)
+	return -1;
+      *pList = newList;
+      *pMax = newMax;
+    }
+  (*pList)[*pNum].fn = fn;
+  (*pList)[*pNum].arg = arg;
+  (*pNum)++;
+  return 0;
+}
+
+
+/*
+ *  Find where the intact records of the journal open at fd end,
+ *  checking those from offset from on
+ */
+static int
+_cfg_journalend (int fd, size_t from, size_t size, size_t *pValid)
+{
+  char *mem, *p, *payload;
+  unsigned long sl, il, vl;
+  char op;
+
+  *pValid = from;
+  if (size <= from)
+    return 0;
+  if ((mem = (char *) malloc (size - from + 1)) == NULL)
+    return -1;
+  if (pread (fd, mem, size - from, from) != (ssize_t) (size - from))
+    {
+      free (mem);
+      return -1;
+    }
+  mem[size - from] = 0;
+  for (p = mem; p < mem + size - from; p = payload + sl + il + vl + 1)
+    if ((payload = _cfg_journalcheck (p, mem + size - from, &op, &sl, &il,
+		&vl)) == NULL)
+      break;
+  *pValid += p - mem;
+  free (mem);
+
+  return 0;
+}
+
+
+/*
+ *  Write one snapshot. In journal mode, under the journal lock: the
+ *  snapshot replaces the file and empties the journal only if it
+ *  holds the whole journal and was built on the file still there.
+ *  Otherwise another handle appended or compacted since, and the
+ *  records of the snapshot go to the journal after theirs instead.
+ */
+static int
+_cfg_asyncwrite (struct TCFGASYNC *a, const char *buf, size_t size,
+    const char *records, size_t len)
+{
+  PCONFIG pconfig = a->pconfig;
+  struct stat sb;
+  size_t valid;
+  int fd, same, rc = 0;
+
+  /* fileName and journalName do not change while the handle lives */
+  if (pconfig->journalName == NULL)
+    return _cfg_replace (pconfig->fileName, NULL, buf, size, &a->sb);
+
+  if ((fd = _cfg_journallock (pconfig)) == -1)
+    return -1;
+  if (fstat (fd, &a->jb) == -1 || stat (pconfig->fileName, &sb) == -1)
+    {
+      _cfg_unlockfd (fd);
+      return -1;
+    }
+  same = sb.st_size == a->sb.st_size && sb.st_mtime == a->sb.st_mtime
+      && sb.st_mtim.tv_nsec == a->sb.st_mtim.tv_nsec
+      && sb.st_ino == a->sb.st_ino;
+
+  if (same && a->journalValid == (size_t) a->jb.st_size
+      && _cfg_replace (pconfig->fileName, NULL, buf, size, &a->sb) == 0)
+    {
+      /* a crash before this point only replays writes folded in */
+      if (ftruncate (fd, 0) == -1 || fstat (fd, &a->jb) == -1)
+	rc = -1;
+      a->journalValid = 0;
+    }
+  else if (_cfg_journalend (fd, same && a->journalValid != (size_t) -1 ?
+	  a->journalValid : 0, a->jb.st_size, &valid) == -1
+      || ((size_t) a->jb.st_size > valid && ftruncate (fd, valid) == -1)
+      || write (fd, records, len) != (ssize_t) len
+      || fstat (fd, &a->jb) == -1)
+    rc = -1;
+  else
+    a->journalValid = same && a->journalValid == valid ?
+	(size_t) a->jb.st_size : (size_t) -1;
+  _cfg_unlockfd (fd);
+
+  return rc;
+}
+
+
+static void *
+_cfg_writer (void *unused)
+{
+  struct TCFGASYNC *a;
+  TCFGDONE *done;
+  unsigned int i, numDone;
+  size_t size, len, max;
+  char *buf, *records;
+  int rc;
+
+  pthread_mutex_lock (&_cfg_wlock);
+  while (1)
+    {
+      while (_cfg_whead == NULL)
+	pthread_cond_wait (&_cfg_wwork, &_cfg_wlock);
+      a = _cfg_whead;
+      if ((_cfg_whead = a->next) == NULL)
+	_cfg_wtail = NULL;
+      a->next = NULL;
+      a->queued = 0;
+      a->writing = 1;
+      buf = a->buf;
+      size = a->size;
+      records = a->records;
+      len = a->recordsLen;
+      a->buf = NULL;
+      a->records = NULL;
+      a->recordsLen = a->recordsMax = 0;
+      a->running = a->waiting;
+      a->numRunning = a->numWaiting;
+      a->maxRunning = a->maxWaiting;
+      a->waiting = NULL;
+      a->numWaiting = a->maxWaiting = 0;
+      pthread_mutex_unlock (&_cfg_wlock);
+
+      rc = _cfg_asyncwrite (a, buf, size, records, len);
+      free (buf);
+
+      /* callbacks may be added while the earlier ones run */
+      pthread_mutex_lock (&_cfg_wlock);
+      a->rc = rc;
+      /* the records of a failed write go ahead of newer ones, so that
+	 the next snapshot still brings them to the journal */
+      max = len;
+      if (rc == -1 && len && _cfg_append (&records, &len, &max,
+	      a->records ? a->records : "", a->recordsLen) == 0)
+	{
+	  free (a->records);
+	  a->records = records;
+	  a->recordsLen = len;
+	  a->recordsMax = max;
+	  records = NULL;
+	}
+      free (records);
+      while (a->numRunning)
+	{
+	  done = a->running;
+	  numDone = a->numRunning;
+	  a->running = NULL;
+	  a->numRunning = a->maxRunning = 0;
+	  pthread_mutex_unlock (&_cfg_wlock);
+	  for (i = 0; i < numDone; i++)
+	    done[i].fn (a->pconfig, rc, done[i].arg);
+	  free (done);
+	  pthread_mutex_lock (&_cfg_wlock);
+	}
+      a->writing = 0;
+      a->settled = 0;
+
+      /* a newer snapshot came in during the write */
+      if (a->buf && !a->queued)
+	{
+	  a->queued = 1;
+	  if (_cfg_wtail)
+	    _cfg_wtail->next = a;
+	  else
+	    _cfg_whead = a;
+	  _cfg_wtail = a;
+	}
+      pthread_cond_broadcast (&_cfg_wdone);
+    }
+
+  return unused;
+}
+
+
+/*
+ *  Wait for the background commits of the handle and take over what
+ *  they did to the file, so that cfg_refresh sees it as unchanged
+ */
+static int
+_cfg_settle (PCONFIG pconfig)
+{
+  struct TCFGASYNC *a = pconfig->async;
+  struct stat sb, jb;
+  size_t journalValid;
+  int rc, settled;
+
+  if (a == NULL)
+    return 0;
+
+  pthread_mutex_lock (&_cfg_wlock);
+  while (a->queued || a->writing)
+    pthread_cond_wait (&_cfg_wdone, &_cfg_wlock);
+  rc = a->rc;
+  settled = a->settled;
+  a->settled = 1;
+  sb = a->sb;
+  jb = a->jb;
+  journalValid = a->journalValid;
+  pthread_mutex_unlock (&_cfg_wlock);
+
+  if (settled)
+    return rc;
+  if (rc == -1)
+    {
+      /* write it again on the next commit */
+      pconfig->dirty = 1;
+      return rc;
+    }
+  _cfg_setversion (pconfig, &sb);
+  /* with records of other handles in the journal, refresh reads them */
+  if (pconfig->journalName && journalValid != (size_t) -1)
+    {
+      pconfig->journalSize = pconfig->journalValid = journalValid;
+      pconfig->journalMtime = jb.st_mtime;
+    }
+  return rc;
+}
+
+
+static void
+_cfg_asyncfree (PCONFIG pconfig)
+{
+  if (pconfig->async == NULL)
+    return;
+  _cfg_settle (pconfig);
+  free (pconfig->async->waiting);
+  free (pconfig->async->running);
+  free (pconfig->async->buf);
+  free (pconfig->async->records);
+  free (pconfig->async);
+  pconfig->async = NULL;
+}
+
+
+int
+cfg_commit_async (PCONFIG pconfig, cfg_commit_t fn, void *arg)
+{
+  struct TCFGASYNC *a;
+  pthread_t thread;
+  pthread_attr_t attr;
+  char *buf = NULL, *records = NULL;
+  size_t size = 0, len = 0, max = 0, used;
+  unsigned int i;
+  FILE *fp;
+  int rc = 0, now = 0;
+
+  if (!_cfg_writable (pconfig))
+    return -1;
+  if (pconfig->dir || (pconfig->openFlags & CFG_OPEN_OPTIMISTIC))
+    {
+      /* the writes are spread over the fragments, or have to be
+	 reconciled with the file under its lock: commit them here */
+      rc = cfg_commit (pconfig);
+      if (fn)
+	fn (pconfig, rc, arg);
+      return rc;
+    }
+  if ((a = pconfig->async) == NULL)
+    {
+      if ((a = (struct TCFGASYNC *) calloc (1,
+		  sizeof (struct TCFGASYNC))) == NULL)
+	return -1;
+      a->pconfig = pconfig;
+      a->settled = 1;
+      pconfig->async = a;
+    }
+
+  /* the snapshot is taken here, the writer only sees bytes; in
+     journal mode the records of the writes go along with it, for the
+     case another handle used the journal meanwhile */
+  if (pconfig->dirty || pconfig->numOps)
+    {
+      if ((fp = open_memstream (&buf, &size)) == NULL)
+	return -1;
+      rc = _cfg_outputformatted (pconfig, fp);
+      if (fclose (fp) || rc == -1)
+	{
+	  free (buf);
+	  return -1;
+	}
+      for (i = 0; pconfig->journalName && i < pconfig->numOps; i++)
+	if (_cfg_journalrecord (&records, &len, &max,
+		&pconfig->ops[i]) == -1)
+	  {
+	    free (records);
+	    free (buf);
+	    return -1;
+	  }
+    }
+
+  pthread_mutex_lock (&_cfg_wlock);
+  if (buf && !_cfg_wstarted)
+    {
+      pthread_attr_init (&attr);
+      pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+      if (pthread_create (&thread, &attr, _cfg_writer, NULL) == 0)
+	_cfg_wstarted = 1;
+      pthread_attr_destroy (&attr);
+      if (!_cfg_wstarted)
+	{
+	  pthread_mutex_unlock (&_cfg_wlock);
+	  free (records);
+	  free (buf);
+	  return -1;
+	}
+    }
+
+  /* a snapshot with nothing pending builds on the handle's version */
+  if (buf && a->settled && !a->buf && !a->writing)
+    {
+      memset (&a->sb, 0, sizeof (a->sb));
+      a->sb.st_size = pconfig->size;
+      a->sb.st_mtime = pconfig->mtime;
+      a->sb.st_mtim.tv_nsec = pconfig->mtimeNsec;
+      a->sb.st_ino = pconfig->inode;
+      a->journalValid = pconfig->journalValid;
+    }
+  used = a->recordsLen;
+  if (len && _cfg_append (&a->records, &a->recordsLen, &a->recordsMax,
+	  records, len) == -1)
+    {
+      pthread_mutex_unlock (&_cfg_wlock);
+      free (records);
+      free (buf);
+      return -1;
+    }
+  free (records);
+
+  /* the callback is queued before the snapshot, so that when there is
+     no room for it, nothing has been handed to the writer yet */
+  if (fn)
+    {
+      if (buf || a->buf)
+	rc = _cfg_adddone (&a->waiting, &a->numWaiting, &a->maxWaiting,
+	    fn, arg);
+      else if (a->writing)
+	rc = _cfg_adddone (&a->running, &a->numRunning, &a->maxRunning,
+	    fn, arg);
+      else
+	now = 1;
+      if (rc == -1)
+	{
+	  a->recordsLen = used;
+	  pthread_mutex_unlock (&_cfg_wlock);
+	  free (buf);
+	  return -1;
+	}
+    }
+  if (buf)
+    {
+      /* replaces a snapshot that has not been picked up yet */
+      free (a->buf);
+      a->buf = buf;
+      a->size = size;
+    }
+  if (buf && !a->queued && !a->writing)
+    {
+      a->queued = 1;
+      if (_cfg_wtail)
+	_cfg_wtail->next = a;
+      else
+	_cfg_whead = a;
+      _cfg_wtail = a;
+      pthread_cond_signal (&_cfg_wwork);
+    }
+  pthread_mutex_unlock (&_cfg_wlock);
+
+  if (buf)
+    {
+      /* the journal ops are in the snapshot */
+      pconfig->dirty = 0;
+      _cfg_freeops (pconfig);
+    }
+  if (now)
+    fn (pconfig, _cfg_settle (pconfig), arg);
+
+  return rc;
+}
+
+
+int
+cfg_flush (PCONFIG pconfig)
+{
+  if (pconfig == NULL)
+    return -1;
+  return _cfg_settle (pconfig);
+}
+
+
+/*** CONCURRENT MODULE ****/
 
-      if (section)
-	data->flags |= CFE_MUST_FREE_SECTION;
-      if (id)
-	data->flags |= CFE_MUST_FREE_ID;
-      if (value)
-	data->flags |= CFE_MUST_FREE_VALUE;
-      if (comment)
-	data->flags |= CFE_MUST_FREE_COMMENT;
-    }
 
-  data->section = section;
-  data->id = id;
-  data->value = value;
-  data->comment = comment;
+/*
+ *  With CFG_OPEN_CONCURRENT, a section is guarded by the stripe its
+ *  name hashes to. A call that stays within one existing section takes
+ *  only that stripe; anything that changes the handle as a whole takes
+ *  all stripes, in order. There are few enough stripes for thread
+ *  sanitizers, which follow at most 64 locks held at once.
+ */
+#define CFG_LOCK_STRIPES	32
+
+/* one stripe per cache line, so that writers do not share lines */
+typedef union
+  {
+    struct
+      {
+	pthread_mutex_t lock;
+	unsigned long writes;	/* Writes made under this stripe */
+      }
+    s;
+    char line[64];
+  }
+TCFGSTRIPE;
+
+struct TCFGLOCKS
+  {
+    pthread_mutex_t commit;	/* One snapshot commit at a time */
+    TCFGSTRIPE stripes[CFG_LOCK_STRIPES];
+  };
+
+
+static struct TCFGLOCKS *
+_cfg_locksalloc (void)
+{
+  struct TCFGLOCKS *l;
+  void *mem;
+  int i;
+
+  if (posix_memalign (&mem, 64, sizeof (struct TCFGLOCKS)))
+    return NULL;
+  l = (struct TCFGLOCKS *) mem;
+  memset (l, 0, sizeof (struct TCFGLOCKS));
+  pthread_mutex_init (&l->commit, NULL);
+  for (i = 0; i < CFG_LOCK_STRIPES; i++)
+    pthread_mutex_init (&l->stripes[i].s.lock, NULL);
+  return l;
+}
+
+
+static void
+_cfg_locksfree (struct TCFGLOCKS *l)
+{
+  int i;
+
+  if (l == NULL)
+    return;
+  pthread_mutex_destroy (&l->commit);
+  for (i = 0; i < CFG_LOCK_STRIPES; i++)
+    pthread_mutex_destroy (&l->stripes[i].s.lock);
+  free (l);
+}
+
 
+static void
+_cfg_lockall (struct TCFGLOCKS *l)
+{
+  int i;
+
+  for (i = 0; i < CFG_LOCK_STRIPES; i++)
+    pthread_mutex_lock (&l->stripes[i].s.lock);
+}
+
+
+static void
+_cfg_unlockall (struct TCFGLOCKS *l)
+{
+  int i;
+
+  for (i = CFG_LOCK_STRIPES - 1; i >= 0; i--)
+    pthread_mutex_unlock (&l->stripes[i].s.lock);
+}
+
+
+/*
+ *  The stripe of section; names that differ only in case share one
+ */
+static TCFGSTRIPE *
+_cfg_stripe (struct TCFGLOCKS *l, const char *section)
+{
+  return &l->stripes[_cfg_hashstr (2166136261u, section) % CFG_LOCK_STRIPES];
+}
+
+
+/*
+ *  Does a cached expansion depend on section:id? Changing it then
+ *  reaches into other sections.
+ */
+static int
+_cfg_referenced (PCONFIG pconfig, const char *section, const char *id)
+{
+  PCFGDEP d;
+  unsigned int h;
+
+  if (!pconfig->depTable)
+    return 0;
+  h = _cfg_keyhash (section, id);
+  for (d = pconfig->depTable[h % pconfig->depSize]; d; d = d->next)
+    if (d->hash == h && !strcasecmp (d->refSection, section)
+	&& !strcasecmp (d->refId, id))
+      return 1;
   return 0;
 }
 
 
-static PCFGENTRY
-_cfg_poolalloc (PCONFIG p, unsigned int count)
+/*
+ *  cfg_write holding only the stripe of section. Returns 1 without
+ *  changing anything when the write reaches beyond the section: it
+ *  adds or deletes a section, loads a deferred one, copies one shared
+ *  with a clone, moves the entries of a block that other stripes read
+ *  the name from, or drops expansions cached in other sections.
+ */
+static int
+_cfg_fastwrite (PCONFIG pconfig, char *section, char *id, char *value)
 {
-  PCFGENTRY newBase;
-  unsigned int newMax;
+  PCFGSECT s;
+  unsigned int pos;
+
+  if (id == NULL || _cfg_logged (pconfig) || pconfig->spineRefs
+      || (pos = _cfg_sectfind (pconfig, section)) == 0)
+    return 1;
+  s = pconfig->sections[pos];
+  if (s->body || __atomic_load_n (&s->refs, __ATOMIC_ACQUIRE) > 1
+      || _cfg_referenced (pconfig, section, id))
+    return 1;
+  if (value && (s->numEntries >= s->maxEntries || (s->flags & CFS_SLAB))
+      && _cfg_keyfind (s, id) < 0)
+    return 1;
+
+  return _cfg_writesect (pconfig, pos, section, id, value) == 0 ? 0 : -1;
+}
+
+
+static int
+_cfg_lockedwrite (PCONFIG pconfig, char *section, char *id, char *value)
+{
+  TCFGSTRIPE *st;
+  int rc;
+
+  if (section == NULL)
+    return -1;
+
+  /* a reload clears CFG_VALID while it holds all stripes, so the
+     handle is checked under the stripe */
+  st = _cfg_stripe (pconfig->locks, section);
+  pthread_mutex_lock (&st->s.lock);
+  if (!_cfg_writable (pconfig))
+    rc = -1;
+  else if ((rc = _cfg_fastwrite (pconfig, section, id, value)) != 1)
+    st->s.writes++;
+  pthread_mutex_unlock (&st->s.lock);
+  if (rc != 1)
+    return rc;
+
+  _cfg_lockall (pconfig->locks);
+  rc = _cfg_loggedwrite (pconfig, section, id, value);
+  st->s.writes++;
+  _cfg_unlockall (pconfig->locks);
+
+  return rc;
+}
+
+
+/*
+ *  cfg_write_many; its groups may add and delete sections, so it
+ *  takes all stripes
+ */
+static int
+_cfg_lockedmany (PCONFIG pconfig, PCFGOP ops, unsigned int numOps)
+{
+  int rc;
+
+  _cfg_lockall (pconfig->locks);
+  rc = _cfg_writemany (pconfig, ops, numOps);
+  pconfig->locks->stripes[0].s.writes++;
+  _cfg_unlockall (pconfig->locks);
+  return rc;
+}
+
 
-  if (p->numEntries + count > p->maxEntries)
+/*
+ *  Hand value out the way the getter asked for: as a long, copied
+ *  whole (size is (size_t) -1) or truncated to size bytes. Returns the
+ *  full length.
+ */
+static int
+_cfg_copyout (const char *value, char *valptr, size_t size, long *pLong)
+{
+  size_t len, n;
+
+  len = strlen (value);
+  if (pLong)
+    *pLong = atoi (value);
+  else if (size == (size_t) -1)
+    memcpy (valptr, value, len + 1);
+  else if (size)
     {
-      newMax =
-	  p->maxEntries ? count + p->maxEntries + p->maxEntries / 2 : count +
-	  4096 / sizeof (TCFGENTRY);
-      newBase = (PCFGENTRY) malloc (newMax * sizeof (TCFGENTRY));
-      if (newBase == NULL)
-	return NULL;
-      if (p->entries)
+      n = len < size - 1 ? len : size - 1;
+      memcpy (valptr, value, n);
+      valptr[n] = 0;
+    }
+  return len > INT_MAX ? INT_MAX : (int) len;
+}
+
+
+/*
+ *  Look up section:id holding only its stripe, unless the section is
+ *  deferred or the value still has to be expanded: expanding reads
+ *  other sections and records dependencies, so it takes all stripes.
+ *  The cursor is left alone.
+ */
+static int
+_cfg_lockedget (PCONFIG pconfig, const char *section, const char *id,
+    char *valptr, size_t size, long *pLong)
+{
+  TCFGSTRIPE *st;
+  const char *value;
+  PCFGSECT s;
+  PCFGENTRY e;
+  unsigned int pos;
+  int idx, rc = 1;
+
+  if (section == NULL || id == NULL)
+    return -1;
+
+  st = _cfg_stripe (pconfig->locks, section);
+  pthread_mutex_lock (&st->s.lock);
+  if (!cfg_valid (pconfig) || (pos = _cfg_sectfind (pconfig, section)) == 0)
+    rc = -1;
+  else if ((s = pconfig->sections[pos])->body == NULL)
+    {
+      if ((idx = _cfg_keyfind (s, id)) < 0)
+	rc = -1;
+      else
 	{
-	  memcpy (newBase, p->entries, p->numEntries * sizeof (TCFGENTRY));
-	  free (p->entries);
+	  e = &s->entries[idx];
+	  if (e->expanded)
+	    rc = _cfg_copyout (e->expanded, valptr, size, pLong);
+	  else if ((e->flags & CFE_PLAIN) || strstr (e->value, "${") == NULL)
+	    rc = _cfg_copyout (e->value, valptr, size, pLong);
 	}
-      p->entries = newBase;
-      p->maxEntries = newMax;
     }
+  pthread_mutex_unlock (&st->s.lock);
+  if (rc != 1)
+    return rc;
 
-  newBase = &p->entries[p->numEntries];
-  p->numEntries += count;
+  _cfg_lockall (pconfig->locks);
+  if ((value = _cfg_lookup (pconfig, section, id, NULL, NULL, NULL)) == NULL)
+    rc = -1;
+  else
+    rc = _cfg_copyout (value, valptr, size, pLong);
+  _cfg_unlockall (pconfig->locks);
 
-  return newBase;
+  return rc;
 }
 
 
-/*** COMPATIBILITY LAYER ***/
+/*
+ *  Writes made so far; all stripes are held
+ */
+static unsigned long
+_cfg_writes (struct TCFGLOCKS *l)
+{
+  unsigned long n = 0;
+  int i;
 
+  for (i = 0; i < CFG_LOCK_STRIPES; i++)
+    n += l->stripes[i].s.writes;
+  return n;
+}
 
-int
-cfg_rewind (PCONFIG pconfig)
+
+/*
+ *  Commit a point in time view. All stripes are held only while the
+ *  snapshot is taken, which shares the blocks with a clone; the clone
+ *  is then written out while the writers go on, copying a block the
+ *  first time they change it. The handle stays dirty if anything was
+ *  written in the meantime.
+ */
+static int
+_cfg_lockedcommit (PCONFIG pconfig)
 {
-  if (!cfg_valid (pconfig))
+  struct TCFGLOCKS *l = pconfig->locks;
+  struct stat sb;
+  PCONFIG snap = NULL;
+  unsigned long writes;
+  int rc = 0;
+
+  pthread_mutex_lock (&l->commit);
+  _cfg_lockall (l);
+  if (!_cfg_writable (pconfig))
+    {
+      _cfg_unlockall (l);
+      pthread_mutex_unlock (&l->commit);
+      return -1;
+    }
+  if (pconfig->async || pconfig->dir
+      || (pconfig->openFlags & CFG_OPEN_OPTIMISTIC))
+    {
+      /* these keep their own state across commits, or reconcile it
+	 with the file */
+      rc = _cfg_commit (pconfig);
+      _cfg_unlockall (l);
+      pthread_mutex_unlock (&l->commit);
+      return rc;
+    }
+  if (!__atomic_load_n (&pconfig->dirty, __ATOMIC_RELAXED))
+    {
+      _cfg_unlockall (l);
+      pthread_mutex_unlock (&l->commit);
+      return 0;
+    }
+  writes = _cfg_writes (l);
+  if (cfg_clone (pconfig, &snap) == -1 || _cfg_ownspine (pconfig) == -1)
+    rc = -1;
+  _cfg_unlockall (l);
+
+  if (rc == 0)
+    rc = _cfg_writeatomic (snap, &sb);
+
+  if (rc == 0)
+    {
+      _cfg_lockall (l);
+      pconfig->size = sb.st_size;
+      pconfig->mtime = sb.st_mtime;
+      if (_cfg_writes (l) == writes)
+	__atomic_store_n (&pconfig->dirty, 0, __ATOMIC_RELAXED);
+      _cfg_unlockall (l);
+    }
+  cfg_done (snap);
+  pthread_mutex_unlock (&l->commit);
+
+  return rc;
+}
+
+
+/*** OPTIMISTIC COMMIT MODULE ****/
+
+
+/*
+ *  Remember which version of the file the image is: together with the
+ *  hash taken when it was parsed, this tells a commit whether another
+ *  process replaced the file since
+ */
+static void
+_cfg_setversion (PCONFIG pconfig, struct stat *psb)
+{
+  pconfig->size = psb->st_size;
+  pconfig->mtime = psb->st_mtime;
+  pconfig->mtimeNsec = psb->st_mtim.tv_nsec;
+  pconfig->inode = psb->st_ino;
+}
+
+
+/*
+ *  Apply the writes pending on old again on top of the freshly parsed
+ *  image, and keep them pending there. They were reported to the
+ *  subscribers when they were first made.
+ */
+static int
+_cfg_reapply (PCONFIG pconfig, PCONFIG old)
+{
+  struct TCFGSUBS *subs;
+  unsigned int i;
+  int rc = 0;
+
+  subs = pconfig->subs;
+  pconfig->subs = NULL;
+  for (i = 0; rc == 0 && i < old->numOps; i++)
+    rc = _cfg_write (pconfig, old->ops[i].section, old->ops[i].id,
+	old->ops[i].value);
+  pconfig->subs = subs;
+  if (rc == -1)
     return -1;
 
-  pconfig->flags = CFG_VALID;
-  pconfig->cursor = 0;
+  pconfig->ops = old->ops;
+  pconfig->numOps = old->numOps;
+  pconfig->maxOps = old->maxOps;
+  old->ops = NULL;
+  old->numOps = old->maxOps = 0;
+  pconfig->dirty = 1;
 
   return 0;
 }
 
 
 /*
- *  returns:
- *	 0 success
- *	-1 no next entry
- *
- *	section	id	value	flags		meaning
- *	!0	0	!0	SECTION		[value]
- *	!0	!0	!0	DEFINE		id = value|id="value"|id='value'
- *	!0	0	!0	0		value
- *	0	0	0	EOF		end of file encountered
+ *  Take the write lock on the whole file open at fd. Open file
+ *  description locks belong to the open file rather than the process:
+ *  they keep the threads of one process apart too, and closing another
+ *  descriptor of the file does not drop them. Without them, a process
+ *  wide mutex keeps the threads apart until _cfg_unlockfd.
  */
-int
-cfg_nextentry (PCONFIG pconfig)
+#ifdef F_OFD_SETLKW
+#define CFG_SETLKW	F_OFD_SETLKW
+#else
+#define CFG_SETLKW	F_SETLKW
+static pthread_mutex_t _cfg_flock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int
+_cfg_lockfd (int fd)
 {
-  PCFGENTRY e;
+  struct flock fl;
 
-  if (!cfg_valid (pconfig) || cfg_eof (pconfig))
-    return -1;
+#ifndef F_OFD_SETLKW
+  pthread_mutex_lock (&_cfg_flock);
+#endif
+  memset (&fl, 0, sizeof (fl));
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+  while (fcntl (fd, CFG_SETLKW, &fl) == -1)
+    if (errno != EINTR)
+      {
+#ifndef F_OFD_SETLKW
+	pthread_mutex_unlock (&_cfg_flock);
+#endif
+	return -1;
+      }
+  return 0;
+}
 
-  pconfig->flags &= ~(CFG_TYPEMASK);
-  pconfig->id = pconfig->value = NULL;
 
-  while (1)
+/*
+ *  Close the file locked by _cfg_lockfd, which drops the lock
+ */
+static void
+_cfg_unlockfd (int fd)
+{
+  close (fd);
+#ifndef F_OFD_SETLKW
+  pthread_mutex_unlock (&_cfg_flock);
+#endif
+}
+
+
+/*
+ *  Lock the file at fileName for writing. Another writer may have
+ *  renamed a new file over it while we waited for the lock on the
+ *  old one: then try again on the new one. Returns the locked file.
+ */
+static int
+_cfg_lockfile (const char *fileName, struct stat *psb)
+{
+  struct stat sb;
+  int fd;
+
+  for (;;)
     {
-      if (pconfig->cursor >= pconfig->numEntries)
+      if ((fd = open (fileName, O_RDWR | O_CREAT | O_BINARY, 0644)) == -1)
+	return -1;
+      if (_cfg_lockfd (fd) == -1)
 	{
-	  pconfig->flags |= CFG_EOF;
+	  close (fd);
 	  return -1;
 	}
-      e = &pconfig->entries[pconfig->cursor++];
-
-      if (e->section)
+      if (fstat (fd, psb) == -1)
 	{
-	  pconfig->section = e->section;
-	  pconfig->flags |= CFG_SECTION;
-	  return 0;
+	  _cfg_unlockfd (fd);
+	  return -1;
 	}
-      if (e->value)
+      if (stat (fileName, &sb) == 0 && sb.st_ino == psb->st_ino
+	  && sb.st_dev == psb->st_dev)
+	return fd;
+      _cfg_unlockfd (fd);
+    }
+}
+
+
+/*
+ *  Write the file back unless another process replaced it since it
+ *  was loaded. In that case, read the newer file, apply the pending
+ *  writes of this handle on top of it and write that instead. The
+ *  file is locked only for this, so the writers of several processes
+ *  keep all their updates without holding a lock from load to commit.
+ */
+static int
+_cfg_optcommit (PCONFIG pconfig)
+{
+  struct stat sb;
+  char *mem, *buf = NULL;
+  size_t size = 0;
+  FILE *fp;
+  int fd, rc = 0;
+
+  if ((fd = _cfg_lockfile (pconfig->fileName, &sb)) == -1)
+    return -1;
+
+  if ((size_t) sb.st_size != pconfig->size || sb.st_mtime != pconfig->mtime
+      || sb.st_mtim.tv_nsec != pconfig->mtimeNsec
+      || (unsigned long) sb.st_ino != pconfig->inode)
+    {
+      if ((mem = (char *) malloc (sb.st_size + 1)) == NULL
+	  || pread (fd, mem, sb.st_size, 0) != sb.st_size)
 	{
-	  pconfig->value = e->value;
-	  if (e->id)
-	    {
-	      pconfig->id = e->id;
-	      pconfig->flags |= CFG_DEFINE;
-	    }
-	  else
-	    pconfig->flags |= CFG_CONTINUE;
-	  return 0;
+	  free (mem);
+	  _cfg_unlockfd (fd);
+	  return -1;
 	}
+      mem[sb.st_size] = 0;
+
+      /* the same content under a new time stamp changes nothing */
+      if (_cfg_hashmem (2166136261u, mem, sb.st_size) == pconfig->hash)
+	free (mem);
+      else if (_cfg_adopt (pconfig, mem, sb.st_size, sb.st_mtime, 1) == -1)
+	rc = -1;
+    }
+
+  if (rc == 0 && (fp = open_memstream (&buf, &size)) == NULL)
+    rc = -1;
+  if (rc == 0)
+    {
+      rc = _cfg_outputformatted (pconfig, fp);
+      if (fclose (fp))
+	rc = -1;
+    }
+  if (rc == 0 && _cfg_replace (pconfig->fileName, NULL, buf, size, &sb) == 0)
+    {
+      _cfg_setversion (pconfig, &sb);
+      pconfig->hash = _cfg_hashmem (2166136261u, buf, size);
+      _cfg_freeops (pconfig);
+      pconfig->dirty = 0;
     }
+  else
+    rc = -1;
+  free (buf);
+  _cfg_unlockfd (fd);
+
+  return rc;
+}
+
+
+/*** MEMORY MODULE ****/
+
+
+/* a live handle; its own allocation, so that only this module writes
+   the links while the handle itself is copied and reset */
+struct TCFGLIVE
+  {
+    struct TCFGLIVE *prev;
+    struct TCFGLIVE *next;
+    PCONFIG pconfig;
+  };
+
+static pthread_mutex_t _cfg_hlock = PTHREAD_MUTEX_INITIALIZER;
+static struct TCFGLIVE *_cfg_handles;
+
+/* pieces shared by clones already counted by a walk over all handles */
+typedef struct
+  {
+    const void **slots;
+    unsigned int size;
+    unsigned int count;
+  }
+TCFGSEEN;
+
+
+static int
+_cfg_register (PCONFIG pconfig)
+{
+  struct TCFGLIVE *l;
+
+  if ((l = (struct TCFGLIVE *) malloc (sizeof (struct TCFGLIVE))) == NULL)
+    return -1;
+  l->pconfig = pconfig;
+  l->prev = NULL;
+  pthread_mutex_lock (&_cfg_hlock);
+  if ((l->next = _cfg_handles) != NULL)
+    l->next->prev = l;
+  _cfg_handles = l;
+  pthread_mutex_unlock (&_cfg_hlock);
+  pconfig->live = l;
+  return 0;
+}
+
+
+static void
+_cfg_unregister (PCONFIG pconfig)
+{
+  struct TCFGLIVE *l = pconfig->live;
+
+  if (l == NULL)
+    return;
+  pthread_mutex_lock (&_cfg_hlock);
+  if (l->prev)
+    l->prev->next = l->next;
+  else
+    _cfg_handles = l->next;
+  if (l->next)
+    l->next->prev = l->prev;
+  pthread_mutex_unlock (&_cfg_hlock);
+  free (l);
+  pconfig->live = NULL;
 }
 
 
-int
-cfg_find (PCONFIG pconfig, char *section, char *id)
+/*
+ *  Add p to seen. Returns 1 if it was not there, 0 if it was, -1 on no
+ *  memory.
+ */
+static int
+_cfg_seen (TCFGSEEN *seen, const void *p)
 {
-  int atsection;
-
-  if (!cfg_valid (pconfig) || cfg_rewind (pconfig))
-    return -1;
+  const void **old = seen->slots;
+  unsigned int oldSize = seen->size, mask, i;
 
-  atsection = 0;
-  while (cfg_nextentry (pconfig) == 0)
+  if (2 * (seen->count + 1) > seen->size)
     {
-      if (atsection)
+      seen->size = oldSize ? oldSize * 2 : 256;
+      if ((seen->slots = (const void **) calloc (seen->size,
+		  sizeof (void *))) == NULL)
 	{
-	  if (cfg_section (pconfig))
-	    return -1;
-	  else if (cfg_define (pconfig))
-	    {
-	      char *szId = remove_quotes (pconfig->id);
-	      int bSame;
-	      if (szId)
-		{
-		  bSame = !strcasecmp (szId, id);
-		  free (szId);
-		  if (bSame)
-		    return 0;
-		}
-	    }
-	}
-      else if (cfg_section (pconfig)
-	  && !strcasecmp (pconfig->section, section))
-	{
-	  if (id == NULL)
-	    return 0;
-	  atsection = 1;
+	  seen->slots = old;
+	  seen->size = oldSize;
+	  return -1;
 	}
+      seen->count = 0;
+      for (i = 0; i < oldSize; i++)
+	if (old[i])
+	  _cfg_seen (seen, old[i]);
+      free (old);
     }
-  return -1;
+
+  mask = seen->size - 1;
+  for (i = ((unsigned int) ((uintptr_t) p >> 4) * 2654435761u) & mask;
+      seen->slots[i]; i = (i + 1) & mask)
+    if (seen->slots[i] == p)
+      return 0;
+  seen->slots[i] = p;
+  seen->count++;
+  return 1;
 }
 
 
-/*** WRITE MODULE ****/
+static size_t
+_cfg_memsum (PCFGMEM m)
+{
+  return m->image + m->entries + m->strings + m->indexes + m->caches
+      + m->other;
+}
+
+
+static size_t
+_cfg_strsize (const char *s)
+{
+  return s ? strlen (s) + 1 : 0;
+}
+
+
+static size_t
+_cfg_listsize (struct TCFGLIST *l)
+{
+  return l ? sizeof (struct TCFGLIST) + (l->count ? l->count - 1 : 0)
+      * sizeof (TCFGSPAN) : 0;
+}
 
 
 /*
- *  Change the configuration
- *
- *  section id    value		action
- *  --------------------------------------------------------------------------
- *   value  value value		update '<entry>=<string>' in section <section>
- *   value  value NULL		delete '<entry>' from section <section>
- *   value  NULL  NULL		delete section <section>
+ *  Add block s to m. Entries in the parse slab are counted with it.
  */
-int
-cfg_write (
-    PCONFIG pconfig,
-    char *section,
-    char *id,
-    char *value)
+static void
+_cfg_memsect (PCFGSECT s, PCFGMEM m)
 {
-  PCFGENTRY e, e2, eSect;
-  int idx;
-  int i;
-
-  if (!cfg_valid (pconfig) || section == NULL)
-    return -1;
+  PCFGENTRY e;
+  unsigned int i;
 
-  /* find the section */
-  e = pconfig->entries;
-  i = pconfig->numEntries;
-  eSect = 0;
-  while (i--)
+  m->other += sizeof (TCFGSECT);
+  if (!(s->flags & CFS_SLAB))
     {
-      if (e->section && !strcasecmp (e->section, section))
-	{
-	  eSect = e;
-	  break;
-	}
-      e++;
+      m->entries += s->maxEntries * sizeof (TCFGENTRY);
+      m->entriesUsed += s->numEntries * sizeof (TCFGENTRY);
     }
+  m->indexes += s->keySize * sizeof (unsigned int);
+  if (s->keyOrder)
+    m->indexes += (s->numOrdered ? s->numOrdered : 1) * sizeof (unsigned int);
 
-  /* did we find the section? */
-  if (!eSect)
+  for (i = 0, e = s->entries; i < s->numEntries; i++, e++)
     {
-      /* check for delete operation on a nonexisting section */
-      if (!id || !value)
-	return 0;
+      if (e->flags & CFE_MUST_FREE_SECTION)
+	m->strings += _cfg_strsize (e->section);
+      if (e->flags & CFE_MUST_FREE_ID)
+	m->strings += _cfg_strsize (e->id);
+      if (e->flags & CFE_MUST_FREE_VALUE)
+	m->strings += e->valueCap ? e->valueCap : _cfg_strsize (e->value);
+      if (e->flags & CFE_MUST_FREE_COMMENT)
+	m->strings += _cfg_strsize (e->comment);
+      m->caches += _cfg_strsize (e->expanded) + _cfg_listsize (e->list);
+    }
+}
 
-      /* add section first */
-      if (cfg_storeentry (pconfig, section, NULL, NULL, NULL,
-	      1) == -1
-	  || cfg_storeentry (pconfig, NULL, id, value, NULL,
-	      1) == -1)
-	return -1;
 
-      pconfig->dirty = 1;
-      return 0;
-    }
+/*
+ *  Entries of the slab up to the end of the last block in it: what
+ *  the handle still uses, whatever slabUsed reached before deletes
+ */
+static unsigned int
+_cfg_slabend (PCONFIG pconfig)
+{
+  PCFGSECT s;
+  unsigned int pos, end, used = 0;
+
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    if ((s = pconfig->sections[pos])->flags & CFS_SLAB)
+      {
+	end = s->entries + s->numEntries - pconfig->slab;
+	if (end > used)
+	  used = end;
+      }
+  return used;
+}
 
-  /* ok - we have found the section - let's see what we need to do */
 
-  if (id)
-    {
-      if (value)
-	{
-	  /* add / update a key */
-	  while (i--)
-	    {
-	      e++;
-	      /* break on next section */
-	      if (e->section)
-		{
-		  /* insert new entry before e */
-		  idx = e - pconfig->entries;
-		  if (_cfg_poolalloc (pconfig, 1) == NULL)
-		    return -1;
-		  memmove (e + 1, e,
-		      (pconfig->numEntries - idx) * sizeof (TCFGENTRY));
-		  e->section = NULL;
-		  e->id = strdup (id);
-		  e->value = strdup (value);
-		  e->comment = NULL;
-		  if (e->id == NULL || e->value == NULL)
-		    return -1;
-		  e->flags |= CFE_MUST_FREE_ID | CFE_MUST_FREE_VALUE;
-		  pconfig->dirty = 1;
-		  return 0;
-		}
+/*
+ *  Add the memory of pconfig to m. With seen, what is shared with a
+ *  clone is added once over all calls; without, it is added in full
+ *  and to m->shared too.
+ */
+static int
+_cfg_memory (PCONFIG pconfig, PCFGMEM m, TCFGSEEN *seen)
+{
+  struct TCFGSUBS *subs = pconfig->subs;
+  struct TCFGASYNC *a = pconfig->async;
+  PCFGSUB sub;
+  PCFGDEP d;
+  PCFGSECT s;
+  unsigned int i;
+  size_t before;
+  int shared, rc;
 
-	      if (e->id && !strcasecmp (e->id, id))
-		{
-		  /* found key - do update */
-		  if (e->value && (e->flags & CFE_MUST_FREE_VALUE))
-		    {
-		      e->flags &= ~CFE_MUST_FREE_VALUE;
-		      free (e->value);
-		    }
-		  pconfig->dirty = 1;
-		  if ((e->value = strdup (value)) == NULL)
-		    return -1;
-		  e->flags |= CFE_MUST_FREE_VALUE;
-		  return 0;
-		}
-	    }
+  m->handles++;
+  m->other += sizeof (TCONFIG) + sizeof (struct TCFGLIVE)
+      + _cfg_strsize (pconfig->fileName) + _cfg_strsize (pconfig->journalName);
 
-	  /* last section in file - add new entry */
-	  if (cfg_storeentry (pconfig, NULL, id, value, NULL,
-		  1) == -1)
-	    return -1;
-	  pconfig->dirty = 1;
-	  return 0;
-	}
-      else
+  /* the image and the slab */
+  shared = pconfig->imageRefs
+      && __atomic_load_n (pconfig->imageRefs, __ATOMIC_ACQUIRE) > 1;
+  if ((rc = shared && seen ? _cfg_seen (seen, pconfig->imageRefs) : 1) == -1)
+    return -1;
+  if (rc)
+    {
+      before = _cfg_memsum (m);
+      m->image += pconfig->image ? pconfig->imageAlloc : 0;
+      m->entries += pconfig->slabSize * sizeof (TCFGENTRY);
+      m->entriesUsed += _cfg_slabend (pconfig) * sizeof (TCFGENTRY);
+      if (shared && !seen)
+	m->shared += _cfg_memsum (m) - before;
+    }
+
+  /* the block array, the section index and the blocks; a block may
+     also be held by the arrays of other clones */
+  shared = pconfig->spineRefs
+      && __atomic_load_n (pconfig->spineRefs, __ATOMIC_ACQUIRE) > 1;
+  if ((rc = shared && seen ? _cfg_seen (seen, pconfig->spineRefs) : 1) == -1)
+    return -1;
+  if (rc && pconfig->sections)
+    {
+      before = _cfg_memsum (m);
+      m->other += pconfig->maxSections * sizeof (PCFGSECT);
+      m->indexes += pconfig->sectSize * sizeof (unsigned int);
+      if (shared && !seen)
+	m->shared += _cfg_memsum (m) - before;
+      for (i = 0; i < pconfig->numSections; i++)
 	{
-	  /* delete a key */
-	  while (i--)
+	  s = pconfig->sections[i];
+	  rc = __atomic_load_n (&s->refs, __ATOMIC_ACQUIRE) > 1;
+	  if (rc && seen && (rc = _cfg_seen (seen, s)) != 1)
 	    {
-	      e++;
-	      /* break on next section */
-	      if (e->section)
-		return 0;	/* not found */
-
-	      if (e->id && !strcasecmp (e->id, id))
-		{
-		  /* found key - do delete */
-		  eSect = e;
-		  e++;
-		  goto doDelete;
-		}
+	      if (rc == -1)
+		return -1;
+	      continue;
 	    }
-	  /* key not found - that' ok */
-	  return 0;
+	  before = _cfg_memsum (m);
+	  _cfg_memsect (s, m);
+	  if ((shared || rc) && !seen)
+	    m->shared += _cfg_memsum (m) - before;
 	}
     }
-  else
+
+  /* what belongs to the handle alone */
+  if (pconfig->sectOrder)
+    m->indexes += (pconfig->numSectOrder ? pconfig->numSectOrder : 1)
+	* sizeof (unsigned int);
+  if (pconfig->frozen)
+    m->indexes += pconfig->frozen->size;
+  m->caches += _cfg_strsize (pconfig->scratch)
+      + _cfg_listsize (pconfig->scratchList)
+      + pconfig->depSize * sizeof (PCFGDEP);
+  for (i = 0; i < pconfig->depSize; i++)
+    for (d = pconfig->depTable[i]; d; d = d->next)
+      m->caches += sizeof (TCFGDEP) + _cfg_strsize (d->refSection)
+	  + _cfg_strsize (d->refId) + _cfg_strsize (d->section)
+	  + _cfg_strsize (d->id);
+  m->other += pconfig->maxChanges * sizeof (TCFGCHANGE)
+      + pconfig->maxOps * sizeof (TCFGOP);
+  for (i = 0; i < pconfig->numChanges; i++)
+    m->other += _cfg_strsize (pconfig->changes[i].section)
+	+ _cfg_strsize (pconfig->changes[i].id);
+  for (i = 0; i < pconfig->numOps; i++)
+    m->other += _cfg_strsize (pconfig->ops[i].section)
+	+ _cfg_strsize (pconfig->ops[i].id)
+	+ _cfg_strsize (pconfig->ops[i].value);
+
+  if (subs)
+    {
+      pthread_mutex_lock (&subs->lock);
+      m->other += sizeof (struct TCFGSUBS) + subs->size * sizeof (PCFGSUB);
+      for (i = 0; i < subs->size; i++)
+	for (sub = subs->table[i]; sub; sub = sub->next)
+	  m->other += sizeof (TCFGSUB) + _cfg_strsize (sub->section)
+	      + _cfg_strsize (sub->id);
+      pthread_mutex_unlock (&subs->lock);
+    }
+  if (a)
     {
-      /* delete entire section */
+      pthread_mutex_lock (&_cfg_wlock);
+      m->other += sizeof (struct TCFGASYNC) + (a->buf ? a->size : 0)
+	  + (a->maxWaiting + a->maxRunning) * sizeof (TCFGDONE);
+      pthread_mutex_unlock (&_cfg_wlock);
+    }
+  if (pconfig->locks)
+    m->other += sizeof (struct TCFGLOCKS);
 
-      /* find e : next section */
-      while (i--)
-	{
-	  e++;
-	  /* break on next section */
-	  if (e->section)
-	    break;
-	}
-      if (i < 0)
-	e++;
-
-      /* move up e while comment */
-      e2 = e - 1;
-      while (e2->comment && !e2->section && !e2->id && !e2->value
-	  && (iswhite (e2->comment[0]) || e2->comment[0] == ';'))
-	e2--;
-      e = e2 + 1;
-
-    doDelete:
-      /* move up eSect while comment */
-      e2 = eSect - 1;
-      while (e2->comment && !e2->section && !e2->id && !e2->value
-	  && (iswhite (e2->comment[0]) || e2->comment[0] == ';'))
-	e2--;
-      eSect = e2 + 1;
-
-      /* delete everything between eSect .. e */
-      for (e2 = eSect; e2 < e; e2++)
-	{
-	  if (e2->flags & CFE_MUST_FREE_SECTION)
-	    free (e2->section);
-	  if (e2->flags & CFE_MUST_FREE_ID)
-	    free (e2->id);
-	  if (e2->flags & CFE_MUST_FREE_VALUE)
-	    free (e2->value);
-	  if (e2->flags & CFE_MUST_FREE_COMMENT)
-	    free (e2->comment);
-	}
-      idx = e - pconfig->entries;
-      memmove (eSect, e, (pconfig->numEntries - idx) * sizeof (TCFGENTRY));
-      pconfig->numEntries -= e - eSect;
-      pconfig->dirty = 1;
+  /* the fragments of a directory are handles of their own; a walk
+     over all handles reaches them by itself */
+  if (pconfig->dir)
+    {
+      m->other += sizeof (struct TCFGDIR)
+	  + pconfig->dir->numFrags * sizeof (PCONFIG);
+      if (!seen)
+	for (i = 0; i < pconfig->dir->numFrags; i++)
+	  _cfg_memory (pconfig->dir->frags[i], m, NULL);
     }
 
   return 0;
 }
 
 
+int
+cfg_memory_usage (PCONFIG pconfig, PCFGMEM pUsage)
+{
+  struct TCFGLIVE *l;
+  TCFGSEEN seen;
+  int rc = 0;
+
+  memset (pUsage, 0, sizeof (TCFGMEM));
+  if (pconfig)
+    _cfg_memory (pconfig, pUsage, NULL);
+  else
+    {
+      memset (&seen, 0, sizeof (seen));
+      pthread_mutex_lock (&_cfg_hlock);
+      for (l = _cfg_handles; l && rc == 0; l = l->next)
+	rc = _cfg_memory (l->pconfig, pUsage, &seen);
+      pthread_mutex_unlock (&_cfg_hlock);
+      free (seen.slots);
+    }
+  pUsage->total = _cfg_memsum (pUsage);
+
+  return rc;
+}
+
+
 /*
- *  Write a formatted copy of the configuration to a file
- *
- *  This assumes that the inifile has already been parsed
+ *  Cut the parse slab down to the entries taken from it. Only when no
+ *  clone points into it.
  */
 static void
-_cfg_outputformatted (PCONFIG pconfig, FILE *fd)
+_cfg_shrinkslab (PCONFIG pconfig)
 {
-  PCFGENTRY e = pconfig->entries;
-  int i = pconfig->numEntries;
-  int m = 0;
-  int j, l;
-  int skip = 0;
+  PCFGENTRY slab;
+  PCFGSECT s;
+  uintptr_t oldSlab = (uintptr_t) pconfig->slab;
+  unsigned int pos, used;
+
+  if (pconfig->slab == NULL
+      || (pconfig->imageRefs
+	  && __atomic_load_n (pconfig->imageRefs, __ATOMIC_ACQUIRE) > 1))
+    return;
+  used = _cfg_slabend (pconfig);
+  if (used == 0 || used >= pconfig->slabSize)
+    return;
+
+  /* the last block in the slab may have grown into the rest of it */
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    if ((s = pconfig->sections[pos])->flags & CFS_SLAB)
+      s->maxEntries = s->numEntries;
+  if ((slab = (PCFGENTRY) realloc (pconfig->slab, used
+	      * sizeof (TCFGENTRY))) == NULL)
+    return;
+  pconfig->slab = slab;
+  pconfig->slabSize = pconfig->slabUsed = used;
+  if ((uintptr_t) slab == oldSlab)
+    return;
+  for (pos = 0; pos < pconfig->numSections; pos++)
+    if ((s = pconfig->sections[pos])->flags & CFS_SLAB)
+      s->entries = slab + ((uintptr_t) s->entries - oldSlab)
+	  / sizeof (TCFGENTRY);
+}
+
+
+int
+cfg_shrink (PCONFIG pconfig)
+{
+  PCFGSECT s, *sections;
+  PCFGENTRY entries;
+  PCFGCHANGE changes;
+  PCFGOP ops;
+  unsigned int pos, n;
+  int rc = 0;
+
+  if (!cfg_valid (pconfig))
+    return -1;
+
+  for (pos = 0; pconfig->dir && pos < pconfig->dir->numFrags; pos++)
+    if (cfg_shrink (pconfig->dir->frags[pos]) == -1)
+      rc = -1;
 
-  while (i--)
+  /* blocks owned by the handle: entry arrays to size, key indexes
+     rebuilt for the keys left */
+  for (pos = 0; pos < pconfig->numSections; pos++)
     {
-      if (e->section)
+      s = pconfig->sections[pos];
+      if (s->body || _cfg_shared (pconfig, s))
+	continue;
+      if (!(s->flags & CFS_SLAB) && s->numEntries
+	  && s->maxEntries > s->numEntries)
 	{
-	  /* Add extra line before section, unless comment block found */
-	  if (skip)
-	    fprintf (fd, "\n");
-	  fprintf (fd, "[%s]", e->section);
-	  if (e->comment)
-	    fprintf (fd, "\t;%s", e->comment);
-
-	  /* Calculate m, which is the length of the longest key */
-	  m = 0;
-	  for (j = 1; j <= i; j++)
+	  if ((entries = (PCFGENTRY) realloc (s->entries, s->numEntries
+		      * sizeof (TCFGENTRY))) == NULL)
+	    rc = -1;
+	  else
 	    {
-	      if (e[j].section)
-		break;
-	      if (e[j].id && (l = strlen (e[j].id)) > m)
-		m = l;
+	      s->entries = entries;
+	      s->maxEntries = s->numEntries;
 	    }
-
-	  /* Add an extra lf next time around */
-	  skip = 1;
 	}
-      /*
-       *  Key = value
-       */
-      else if (e->id && e->value)
+      for (n = 16; n < 2 * s->numEntries; n *= 2)
+	;
+      if (s->keySize > n)
 	{
-	  if (m)
-	    fprintf (fd, "%-*.*s = %s", m, m, e->id, e->value);
-	  else
-	    fprintf (fd, "%s = %s", e->id, e->value);
-	  if (e->comment)
-	    fprintf (fd, "\t;%s", e->comment);
+	  free (s->keyIndex);
+	  s->keyIndex = NULL;
+	  s->keySize = s->numKeys = 0;
+	  _cfg_keyindex (s);
 	}
-      /*
-       *  Value only (continuation)
-       */
-      else if (e->value)
-	{
-	  fprintf (fd, "  %s", e->value);
-	  if (e->comment)
-	    fprintf (fd, "\t;%s", e->comment);
-	}
-      /*
-       *  Comment only - check if we need an extra lf
-       *
-       *  1. Comment before section gets an extra blank line before
-       *     the comment starts.
-       *
-       *          previousEntry = value
-       *          <<< INSERT BLANK LINE HERE >>>
-       *          ; Comment Block
-       *          ; Sticks to section below
-       *          [new section]
-       *
-       *  2. Exception on 1. for commented out definitions:
-       *     (Immediate nonwhitespace after ;)
-       *          [some section]
-       *          v1 = 1
-       *          ;v2 = 2   << NO EXTRA LINE >>
-       *          v3 = 3
-       *
-       *  3. Exception on 2. for ;; which certainly is a section comment
-       *          [some section]
-       *          definitions
-       *          <<< INSERT BLANK LINE HERE >>>
-       *          ;; block comment
-       *          [new section]
-       */
-      else if (e->comment)
+    }
+  _cfg_shrinkslab (pconfig);
+
+  /* the block array and the section index, if not shared */
+  if (pconfig->spineRefs == NULL)
+    {
+      if (pconfig->numSections && pconfig->maxSections > pconfig->numSections)
 	{
-	  if (skip && (iswhite (e->comment[0]) || e->comment[0] == ';'))
+	  if ((sections = (PCFGSECT *) realloc (pconfig->sections,
+		      pconfig->numSections * sizeof (PCFGSECT))) == NULL)
+	    rc = -1;
+	  else
 	    {
-	      for (j = 1; j <= i; j++)
-		{
-		  if (e[j].section)
-		    {
-		      fprintf (fd, "\n");
-		      skip = 0;
-		      break;
-		    }
-		  if (e[j].id || e[j].value)
-		    break;
-		}
+	      pconfig->sections = sections;
+	      pconfig->maxSections = pconfig->numSections;
 	    }
-	  fprintf (fd, ";%s", e->comment);
 	}
-      fprintf (fd, "\n");
-      e++;
+      for (n = 64; n < 2 * pconfig->numSections; n *= 2)
+	;
+      if (pconfig->sectSize > n)
+	{
+	  free (pconfig->sectIndex);
+	  pconfig->sectIndex = NULL;
+	  pconfig->sectSize = 0;
+	  for (pos = 1; pos < pconfig->numSections; pos++)
+	    _cfg_sectinsert (pconfig, pos);
+	}
     }
-}
-
-
-/*
- *  Write the changed file back
- */
-int
-cfg_commit (PCONFIG pconfig)
-{
-  FILE *fp;
-
-  if (!cfg_valid (pconfig))
-    return -1;
 
-  if (pconfig->dirty)
+  if (pconfig->maxChanges > pconfig->numChanges)
     {
-      if ((fp = fopen (pconfig->fileName, "w")) == NULL)
-	return -1;
-
-      _cfg_outputformatted (pconfig, fp);
-
-      fclose (fp);
-
-      pconfig->dirty = 0;
+      if (pconfig->numChanges == 0)
+	{
+	  free (pconfig->changes);
+	  pconfig->changes = NULL;
+	  pconfig->maxChanges = 0;
+	}
+      else if ((changes = (PCFGCHANGE) realloc (pconfig->changes,
+		  pconfig->numChanges * sizeof (TCFGCHANGE))) != NULL)
+	{
+	  pconfig->changes = changes;
+	  pconfig->maxChanges = pconfig->numChanges;
+	}
+    }
+  if (pconfig->maxOps > pconfig->numOps)
+    {
+      if (pconfig->numOps == 0)
+	{
+	  free (pconfig->ops);
+	  pconfig->ops = NULL;
+	  pconfig->maxOps = 0;
+	}
+      else if ((ops = (PCFGOP) realloc (pconfig->ops,
+		  pconfig->numOps * sizeof (TCFGOP))) != NULL)
+	{
+	  pconfig->ops = ops;
+	  pconfig->maxOps = pconfig->numOps;
+	}
     }
 
-  return 0;
+  return rc;
 }
 
 
@@ -1006,15 +7832,121 @@ list_entries (PCONFIG pCfg, const char * lpszSection, char * lpszRetBuffer, int
 
 int cfg_getstring (PCONFIG pconfig, char *section, char *id, char *valptr)
 {
+	const char *value;
+	size_t len;
+
 	if(!pconfig || !section || !id || !valptr) return -1;
+	if(pconfig->frozen)
+	{
+		/* leave the cursor alone: frozen lookups do not write */
+		if(cfg_getref(pconfig,section,id,&value,&len) == -1) return -1;
+		memcpy(valptr,value,len + 1);
+		return 0;
+	}
+	if(pconfig->locks)
+		return _cfg_lockedget(pconfig,section,id,valptr,(size_t) -1,NULL) == -1 ? -1 : 0;
 	if(cfg_find(pconfig,section,id) == -1) return -1;
 	strcpy(valptr,pconfig->value);
 	return 0;
 }
 
+/*
+ *  Borrow the value of section:id without copying it and without
+ *  moving the cursor
+ */
+static const char *
+_cfg_lookup (PCONFIG pconfig, const char *section, const char *id,
+    PCFGSECT *ps, PCFGENTRY *pe, size_t *pLen)
+{
+  PCFGSECT s;
+  PCFGENTRY e;
+  char *value, *scratch;
+
+  if (!cfg_valid (pconfig) || section == NULL || id == NULL)
+    return NULL;
+  if (pconfig->frozen)
+    {
+      /* no entry to hand out: the value lives in the snapshot */
+      if (ps)
+	*ps = NULL;
+      if (pe)
+	*pe = NULL;
+      return _cfg_frozenfind (pconfig->frozen, section, id, pLen);
+    }
+  if ((e = _cfg_findentry (pconfig, section, id, &s)) == NULL)
+    return NULL;
+  if ((value = _cfg_expand (pconfig, s, e, s->entries[0].section, 0,
+	      &scratch)) == NULL)
+    return NULL;
+
+  /* only a block shared with a clone leaves an uncached expansion */
+  if (scratch)
+    {
+      free (pconfig->scratch);
+      pconfig->scratch = scratch;
+    }
+
+  if (ps)
+    *ps = s;
+  if (pe)
+    *pe = e;
+  if (pLen)
+    *pLen = strlen (value);
+  return value;
+}
+
+int
+cfg_getref (PCONFIG pconfig, const char *section, const char *id,
+    const char **pValue, size_t *pLen)
+{
+  const char *value;
+
+  if ((value = _cfg_lookup (pconfig, section, id, NULL, NULL, pLen)) == NULL)
+    return -1;
+
+  if (pValue)
+    *pValue = value;
+  return 0;
+}
+
+
+/*
+ *  Copy the value of section:id into valptr of size bytes, truncated
+ *  and always terminated; returns the full length like snprintf
+ */
+int
+cfg_getstring_n (PCONFIG pconfig, const char *section, const char *id,
+    char *valptr, size_t size)
+{
+  const char *value;
+  size_t len, n;
+
+  if (pconfig && pconfig->locks && !pconfig->frozen)
+    return _cfg_lockedget (pconfig, section, id, valptr, size, NULL);
+  if (cfg_getref (pconfig, section, id, &value, &len) == -1)
+    return -1;
+  if (size)
+    {
+      n = len < size - 1 ? len : size - 1;
+      memcpy (valptr, value, n);
+      valptr[n] = 0;
+    }
+  return len > INT_MAX ? INT_MAX : (int) len;
+}
+
 int cfg_getlong (PCONFIG pconfig, char *section, char *id, long *valptr)
 {
+	const char *value;
+
 	if(!pconfig || !section || !id) return -1;
+	if(pconfig->frozen)
+	{
+		if(cfg_getref(pconfig,section,id,&value,NULL) == -1) return -1;
+		*valptr = atoi(value);
+		return 0;
+	}
+	if(pconfig->locks)
+		return _cfg_lockedget(pconfig,section,id,NULL,0,valptr) == -1 ? -1 : 0;
 	if(cfg_find(pconfig,section,id) == -1) return -1;
 	*valptr = atoi(pconfig->value);
 	return 0;
@@ -1022,16 +7954,20 @@ int cfg_getlong (PCONFIG pconfig, char *section, char *id, long *valptr)
 
 int cfg_getint (PCONFIG pconfig, char *section, char *id, int *valptr)
 {
-	return cfg_getlong(pconfig,section,id,(long *)valptr);
+	long value;
+
+	if(cfg_getlong(pconfig,section,id,&value) == -1) return -1;
+	*valptr = (int)value;
+	return 0;
 }
 
 int GetPrivateProfileString (char * lpszSection, char * lpszEntry,
     char * lpszDefault, char * lpszRetBuffer, int cbRetBuffer,
     char * lpszFilename)
 {
-  char *defval = (char *) lpszDefault, *value = NULL;
-  int len = 0;
-  PCONFIG pCfg;
+  const char *value;
+  size_t len;
+  PCONFIG pCfg = NULL;
 
   /*
    *  Sorry for this one -- Windows cannot handle a default value of
@@ -1039,30 +7975,24 @@ int GetPrivateProfileString (char * lpszSection, char * lpszEntry,
    */
   if (!lpszDefault || (lpszDefault[0] == '\0') || (lpszDefault[0] == ' ' && lpszDefault[1] == '\0')) value = "";
   else value = lpszDefault;
-  
-  strncpy (lpszRetBuffer, value, cbRetBuffer - 1);
 
-  /* If error during reading the file */
-  if (cfg_init (&pCfg, lpszFilename, 0))
+  /* the value, or on any error the default, is copied once */
+  if (cfg_init (&pCfg, lpszFilename, 0) == 0)
+    cfg_getref (pCfg, lpszSection, lpszEntry, &value, NULL);
+
+  len = strlen (value);
+  if (cbRetBuffer <= 0)
+    len = 0;
+  else
     {
-      goto fail;
+      if (len > (size_t) cbRetBuffer - 1)
+	len = cbRetBuffer - 1;
+      memcpy (lpszRetBuffer, value, len);
+      lpszRetBuffer[len] = 0;
     }
 
-  /*
-   *  Check whether someone else has modified the .ini file
-   */
-  cfg_refresh (pCfg);
-
-  if (!cfg_find (pCfg, (char *) lpszSection, (char *) lpszEntry)){
-    value = pCfg->value;
-    strncpy (lpszRetBuffer, value, cbRetBuffer - 1);
-  }
-
   cfg_done (pCfg);
-
-fail:
-  len = strlen (lpszRetBuffer);
-  return len;
+  return (int) len;
 }
 
 int GetPrivateProfileInt (char * lpszSection, char * lpszEntry,
@@ -1093,7 +8023,7 @@ int WritePrivateProfileString (char * lpszSection, char * lpszEntry,
   PCONFIG pCfg;
 
   /* If error during reading the file */
-  if (cfg_init (&pCfg, lpszFilename, 1))
+  if (cfg_open (&pCfg, lpszFilename, CFG_OPEN_CREATE | CFG_OPEN_OPTIMISTIC))
     {
       return -1;
     }
@@ -1120,11 +8050,21 @@ int cfg_get_item (PCONFIG pconfig, char *section, char *id, char * fmt, ...)
 int cfg_write_item(PCONFIG pconfig, char *section, char *id, char * fmt, ...)
 {
 	int ret;
-	char buf[CFG_MAX_LINE_LENGTH];
+	char buf[CFG_MAX_LINE_LENGTH], *value = buf;
 	va_list ap;
 	va_start(ap, fmt);
 	ret = vsnprintf(buf, CFG_MAX_LINE_LENGTH, fmt, ap);
 	va_end(ap);
 	if(ret < 0) return -1;
-	return cfg_write(pconfig,section,id,buf);
+	/* longer than the stack buffer: format it again, whole */
+	if(ret >= CFG_MAX_LINE_LENGTH)
+	{
+		if((value = (char *) malloc(ret + 1)) == NULL) return -1;
+		va_start(ap, fmt);
+		vsnprintf(value, ret + 1, fmt, ap);
+		va_end(ap);
+	}
+	ret = cfg_write(pconfig,section,id,value);
+	if(value != buf) free(value);
+	return ret;
 }
@@ -32,11 +32,15 @@ extern "C" {
 
 #include <fcntl.h>
 #include <stdarg.h>
+#include <stdint.h>
 #ifndef _MAC
 #include <sys/types.h>
 #endif
 
 #define CFG_MAX_LINE_LENGTH 1024
+#define CFG_MAX_EXPAND_DEPTH 32
+#define CFG_INDEX_MIN 8
+#define CFG_JOURNAL_LIMIT (64 * 1024)
 
 /* configuration file entry */
 typedef struct TCFGENTRY
@@ -45,32 +49,175 @@ typedef struct TCFGENTRY
     char *id;
     char *value;
     char *comment;
+    char *expanded;		/* Cached ${section:key} expansion */
+    struct TCFGLIST *list;	/* Cached split of the value (cfg_getlist) */
     unsigned short flags;
+    unsigned short source;	/* Fragment it came from + 1 (cfg_open_dir) */
+    unsigned int valueCap;	/* Bytes allocated for a value of its own,
+				   0 if not known */
   }
 TCFGENTRY, *PCFGENTRY;
 
+/* element of a list value, not terminated */
+typedef struct TCFGSPAN
+  {
+    const char *ptr;
+    size_t len;
+  }
+TCFGSPAN, *PCFGSPAN;
+
 /* values for flags */
 #define CFE_MUST_FREE_SECTION	0x8000
 #define CFE_MUST_FREE_ID	0x4000
 #define CFE_MUST_FREE_VALUE	0x2000
 #define CFE_MUST_FREE_COMMENT	0x1000
+#define CFE_PLAIN		0x0800	/* value has no ${...} references */
+#define CFE_EXPANDING		0x0400	/* expansion in progress */
+
+/* a [section] line and the entries up to the next one */
+typedef struct TCFGSECT
+  {
+    PCFGENTRY entries;		/* entries[0] is the [section] line, except
+				   in the block before the first section */
+    unsigned int numEntries;
+    unsigned int maxEntries;
+    unsigned int *keyIndex;	/* Open addressed: entry index + 1 */
+    unsigned int keySize;	/* Slots in keyIndex, 0 if not built */
+    unsigned int numKeys;	/* Keys in keyIndex */
+    unsigned int *keyOrder;	/* Entry indexes sorted by key, NULL if not
+				   built */
+    unsigned int numOrdered;
+    unsigned int orderGen;	/* Generation of keyOrder */
+    unsigned short flags;
+    char *body;			/* Lines not parsed yet (CFG_OPEN_LAZY) */
+    char *bodyEnd;
+    unsigned int refs;		/* Block arrays holding this block */
+  }
+TCFGSECT, *PCFGSECT;
+
+/* flags for TCFGSECT */
+#define CFS_SLAB	0x0001	/* entries live in the parse slab */
+
+/* dependency of a cached expansion on another key */
+typedef struct TCFGDEP
+  {
+    struct TCFGDEP *next;
+    unsigned int hash;
+    char *refSection;		/* referenced key */
+    char *refId;
+    char *section;		/* entry holding the reference */
+    char *id;
+  }
+TCFGDEP, *PCFGDEP;
+
+/* key changed by cfg_refresh */
+typedef struct TCFGCHANGE
+  {
+    char *section;
+    char *id;
+    int kind;			/* CFG_ADDED, CFG_REMOVED or CFG_MODIFIED */
+  }
+TCFGCHANGE, *PCFGCHANGE;
+
+/* pending cfg_write operation */
+typedef struct TCFGOP
+  {
+    char *section;
+    char *id;			/* NULL: delete the section */
+    char *value;		/* NULL: delete the key */
+  }
+TCFGOP, *PCFGOP;
+
+#define CFG_ADDED		1
+#define CFG_REMOVED		2
+#define CFG_MODIFIED		3
+
+struct TCFGDATA;
+struct TCFGSUBS;
+struct TCFGASYNC;
+struct TCFGDIR;
+struct TCFGLIST;
+struct TCFGFROZEN;
+struct TCFGLIVE;
+struct TCFGLOCKS;
+
+/* callback run after section:id changed */
+typedef void (*cfg_notify_t) (struct TCFGDATA *pconfig, const char *section,
+    const char *id, int kind, void *arg);
+
+/* callback run when an asynchronous commit is on disk; rc 0 or -1 */
+typedef void (*cfg_commit_t) (struct TCFGDATA *pconfig, int rc, void *arg);
+
+/* callback run for each section by cfg_for_each_section; non-zero stops */
+typedef int (*cfg_section_t) (struct TCFGDATA *pconfig, const char *section,
+    void *arg);
+
+#define CFG_SUB_PREFIX		0x0001	/* section is a prefix */
 
 /* configuration file */
 typedef struct TCFGDATA
   {
     char *fileName;		/* Current file name */
+    int openFlags;		/* CFG_OPEN_xxx */
 
     int dirty;			/* Did we make modifications? */
 
     char *image;		/* In-memory copy of the file */
     size_t size;		/* Size of this copy (excl. \0) */
+    size_t imageAlloc;		/* Bytes allocated for it */
     time_t mtime;		/* Modification time */
-
-    unsigned int numEntries;
-    unsigned int maxEntries;
-    PCFGENTRY entries;
+    long mtimeNsec;		/* Its nanoseconds */
+    unsigned long inode;	/* Inode of the file read */
+    unsigned int hash;		/* FNV-1a hash of the file read
+				   (CFG_OPEN_OPTIMISTIC) */
+
+    unsigned int numEntries;	/* Entries over all blocks */
+    PCFGSECT *sections;		/* Blocks in file order */
+    unsigned int numSections;	/* Including the block before the first
+				   section */
+    unsigned int maxSections;
+    unsigned int *sectIndex;	/* Open addressed: block position */
+    unsigned int sectSize;
+    unsigned int *sectOrder;	/* Block positions sorted by section name,
+				   NULL if not built */
+    unsigned int numSectOrder;
+    unsigned int sectOrderGen;	/* Generation of sectOrder */
+    PCFGENTRY slab;		/* Entries of the blocks read by _cfg_parse */
+    unsigned int slabSize;
+    unsigned int slabUsed;	/* Its high-water mark */
+    unsigned int *imageRefs;	/* Handles sharing image and slab (cfg_clone),
+				   NULL if not shared */
+    unsigned int *spineRefs;	/* Handles sharing sections and sectIndex */
+    char *scratch;		/* Expansion returned by cfg_find, if not
+				   cached on a shared block */
+    struct TCFGLIST *scratchList;	/* Split returned by cfg_getlist on a
+					   shared block */
+
+    PCFGDEP *depTable;		/* Expansion dependencies, by referenced key */
+    unsigned int depSize;
+    unsigned int numDeps;
+
+    PCFGCHANGE changes;		/* Keys changed by the last reload */
+    unsigned int numChanges;
+    unsigned int maxChanges;
+
+    struct TCFGSUBS *subs;	/* Change subscriptions */
+    struct TCFGASYNC *async;	/* Background commits (cfg_commit_async) */
+    struct TCFGDIR *dir;	/* Fragments merged by cfg_open_dir */
+    struct TCFGFROZEN *frozen;	/* Read only snapshot (cfg_freeze) */
+
+    char *journalName;		/* Sidecar log of committed writes */
+    size_t journalSize;		/* Size of the log when last read/written */
+    size_t journalValid;	/* Length of its intact records */
+    time_t journalMtime;
+    size_t journalLimit;	/* Compact when the log grows past this */
+    PCFGOP ops;			/* Writes not yet committed to the log or,
+				   with CFG_OPEN_OPTIMISTIC, to the file */
+    unsigned int numOps;
+    unsigned int maxOps;
 
     /* Compatibility */
+    unsigned int sectCursor;
     unsigned int cursor;
     char *section;
     char *id;
@@ -78,9 +225,62 @@ typedef struct TCFGDATA
     char *comment;
     unsigned short flags;
 
+    struct TCFGLIVE *live;	/* Entry in the list of live handles */
+
+    /* last: _cfg_reset clears what is above it, while other threads
+       may be waiting on these */
+    struct TCFGLOCKS *locks;	/* Section locks (CFG_OPEN_CONCURRENT) */
   }
 TCONFIG, *PCONFIG;
 
+/* walk over section names, the keys of one section or all entries,
+   held by the caller: any number of walks can run at once */
+typedef struct TCFGITER
+  {
+    PCONFIG pconfig;
+    unsigned int pos;		/* Block of the keys, 0 when walking sections */
+    unsigned int *order;	/* Order array walked, NULL in file order */
+    unsigned int cur;		/* Next slot in it, or next block/entry */
+    unsigned int end;
+    unsigned int gen;		/* Generation of the order array */
+    char *section;		/* Current section */
+    char *id;			/* Current key, NULL when walking sections */
+    char *value;		/* Its value, expanded like cfg_find */
+    unsigned short flags;	/* CFG_SECTION, CFG_DEFINE or CFG_CONTINUE,
+				   as with cfg_nextentry */
+    unsigned short walk;	/* What is walked in file order, 0 if sorted */
+  }
+TCFGITER, *PCFGITER;
+
+/* memory held by configurations, in bytes (cfg_memory_usage) */
+typedef struct TCFGMEM
+  {
+    size_t image;		/* File images */
+    size_t entries;		/* Entry arrays and parse slabs allocated */
+    size_t entriesUsed;		/* Of which holding entries */
+    size_t strings;		/* Sections, keys, values and comments
+				   allocated apart from the image */
+    size_t indexes;		/* Section and key indexes, order arrays,
+				   frozen snapshots */
+    size_t caches;		/* Expansions, lists, their dependencies and
+				   scratch results */
+    size_t other;		/* Handles, blocks, change sets, pending log
+				   writes, subscriptions, async commits */
+    size_t total;		/* All of the above */
+    size_t shared;		/* Part of total shared with a clone */
+    unsigned int handles;	/* Handles counted */
+  }
+TCFGMEM, *PCFGMEM;
+
+/* values for openFlags */
+#define CFG_OPEN_CREATE		0x0001	/* create the file if missing */
+#define CFG_OPEN_JOURNAL	0x0002	/* commit through a delta log */
+#define CFG_OPEN_LAZY		0x0004	/* parse sections on first use */
+#define CFG_OPEN_LEAN		0x0008	/* read only, comments dropped */
+#define CFG_OPEN_DIR		0x0010	/* fileName is a conf.d directory */
+#define CFG_OPEN_CONCURRENT	0x0020	/* writers in several threads */
+#define CFG_OPEN_OPTIMISTIC	0x0040	/* commits merge with other writers */
+
 #define CFG_VALID		0x8000
 #define CFG_EOF			0x4000
 
@@ -113,6 +313,130 @@ int cfg_file_exist (const char *filename);
  * */
 int cfg_init (PCONFIG * ppconf, const char *filename, int doCreate);
 
+/*
+ * Name    cfg_open
+ * Desc    ͬcfg_init, Ա־λָ򿪷ʽCFG_OPEN_JOURNAL: cfg_commitֻ
+ *           ύ޸׷ӵ <ļ>.journal, ʱԭļ֮طŸ־;
+ *           ־ journalLimit ԭļСеĽϴʱԶcfg_compact
+ *           CFG_OPEN_LAZY: ʱֻλ[section], sectionڵһ
+ *           ҡдʱŽ; ʱԻȫݡ
+ *           CFG_OPEN_LEAN: ֻ, עкע, ʵַ
+ *           յظƵһͷļӳ; cfg_write/cfg_commitȷ-1,
+ *           errnoΪEROFS
+ *           CFG_OPEN_CONCURRENT: ߳̿ͬʱԸþcfg_write
+ *           cfg_write_manycfg_getstringcfg_getstring_ncfg_getlong
+ *           cfg_getintcfg_refreshcfg_commit, ຯ֤߱ռ, ȡƶαꡣ
+ *           ÿsectionӳ䵽һ, ޸sectionеkeyʱֻ
+ *           section, ͬsectionд벢; ɾsection${}õkey
+ *           չ${}Ķȡסcfg_commitֻ
+ *           ȡһдʱƵĿ, д߼еͬʱѿдʱ
+ *           ļrename滻, ļύʱ̵һͼĻصڳʱ
+ *           , ٵøþCFG_OPEN_JOURNALCFG_OPEN_LEANá
+ *           CFG_OPEN_OPTIMISTIC: дͬһļʱʧ޸ġʱ¼ļ
+ *           inodeС뼶mtimeݹϣ, 汾δύд;
+ *           cfg_commitfcntlסļ, ļѱ滻, ļ
+ *           ֻطűд, پʱļrenameдء
+ *           cfg_commit_async־ͬύCFG_OPEN_JOURNAL
+ * param1  淵ص ļṹ 
+ * param2  Ҫʼ ļ
+ * param3  CFG_OPEN_CREATECFG_OPEN_JOURNALCFG_OPEN_LAZYCFG_OPEN_LEAN
+ *           CFG_OPEN_CONCURRENTCFG_OPEN_OPTIMISTIC
+ * */
+int cfg_open (PCONFIG * ppconf, const char *filename, int flags);
+
+/*
+ * Name    cfg_init_many
+ * Desc    nļLinuxͨio_uringһύļ
+ *           statxopenread, ÿļ꼴߳̽; ûio_uring
+ *           ʱ(ʱCFG_NO_URING)̳߳زеcfg_open
+ *           һļʧܷ-1, Ӧppconf[i]ΪNULL, ճ
+ * param1  淵صnļṹ
+ * param2  nļ
+ * param3  ļ
+ * param4  ͬcfg_openı־λ
+ * */
+int cfg_init_many (PCONFIG * ppconf, const char **paths, unsigned int n,
+    int flags);
+
+/*
+ * Name    cfg_open_dir
+ * Desc    conf.dĿ¼: ļֵĿ¼*.iniƬβн,
+ *           ϲΪһáͬsectionϲ, Ƭεͬkeyǰġ
+ *           ÿkey¼ԴƬ, cfg_commit޸дظƬ: keyд뺬
+ *           sectionһƬ, sectionдһƬ, ɾ
+ *           ƬΡcfg_refreshһƬλƬб仯ʱȫƬΡ
+ *           ֧cfg_clone; cfg_commit_async̺ͬûص
+ * param1  淵ص ļṹ
+ * param2  Ŀ¼
+ * param3  CFG_OPEN_CREATE(Ŀ¼ʱ)CFG_OPEN_JOURNAL(Ƭʹ
+ *           Լ־)CFG_OPEN_LEAN
+ * */
+int cfg_open_dir (PCONFIG * ppconf, const char *dirName, int flags);
+
+/*
+ * Name    cfg_source
+ * Desc    cfg_open_dir򿪵 section:id (򽫱д)Ƭļ,
+ *           ûиkeyĿ¼ʱNULL
+ * param1  ļṹ
+ * param2  section
+ * param3  key
+ * */
+const char *cfg_source (PCONFIG pconfig, const char *section, const char *id);
+
+/*
+ * Name    cfg_compact
+ * Desc    ־ϲļ: дʱļrenameԭ滻, ־
+ * param1  ļṹ
+ * */
+int cfg_compact (PCONFIG pconfig);
+
+/*
+ * Name    cfg_clone
+ * Desc    һþԭͨüļӳַ
+ *           sectionʵ, ʱļС޹; һcfg_writeʱֻƱ޸
+ *           section(Լsection)ԼĶĺͱ, cfg_doneͷ
+ * param1  ļṹ
+ * param2  淵صĸ
+ * */
+int cfg_clone (PCONFIG pconfig, PCONFIG * ppclone);
+
+/*
+ * Name   cfg_freeze
+ * Desc   öΪֻ: ȫsection:keyչֵһ
+ *          ڴ, Сϣ˺cfg_getref, cfg_getstring_n,
+ *          cfg_getstring, cfg_getlong, cfg_getint, cfg_getlongs
+ *          cfg_getdoublesֻһιϣһ̽һαȽ, ޸ľ,
+ *          ߳̿ɲͬʱáд뷵-1errnoΪEROFS,
+ *          cfg_refresh; ${ENV:xxx}ʱĻչ, óɻ
+ *          ֵҲcfg_nextentryȱʹԭʼ
+ * param1 ļṹ
+ * أ   0ɹ, -1ʧ
+ * */
+int cfg_freeze (PCONFIG pconfig);
+
+/*
+ * Name   cfg_memory_usage
+ * Desc   ͳռõڴ: ļӳʵʵʹá
+ *          ַͻȡpconfigNULLʱͳƸþ(cfg_open_dir򿪵
+ *          Ƭ), 븱Ĳּtotalshared;
+ *          pconfigΪNULLʱͳƽδcfg_doneľ, ֻһΡ
+ *          ͳʱȡ, ʱ̲߳޸ıͳƵľ
+ * param1 ļṹ, NULL
+ * param2 ͳƽ
+ * أ   0ɹ, -1ʧ
+ * */
+int cfg_memory_usage (PCONFIG pconfig, PCFGMEM pUsage);
+
+/*
+ * Name   cfg_shrink
+ * Desc   ͷŴ޸ĺ: Ѿռʵ顢sectionͱ
+ *          СʵʴС, ǰkeyؽ븱Ĳֲ䡣
+ *          ͬcfg_write, еcfg_sections/cfg_keys֮
+ * param1 ļṹ
+ * أ   0ɹ, -1ʧ
+ * */
+int cfg_shrink (PCONFIG pconfig);
+
 /*
  * Name   cfg_done
  * Desc   ͷкļصڴ
@@ -134,6 +458,15 @@ int cfg_freeimage (PCONFIG pconfig);
  * */
 int cfg_refresh (PCONFIG pconfig);
 
+/*
+ * Name   cfg_next_change
+ * Desc   һcfg_refreshʱɾ޸ĵ(section, ʵ)
+ *          ļδ仯(cfg_refresh0)ʱ仯Ϊ; NULL
+ * param1 ļṹ
+ * param2 λ, ɵ߱, 0ʼ
+ * */
+PCFGCHANGE cfg_next_change (PCONFIG pconfig, unsigned int *pos);
+
 int cfg_storeentry (PCONFIG pconfig, char *section, char *id,
     char *value, char *comment, int dynamic);
 
@@ -142,6 +475,106 @@ int cfg_nextentry (PCONFIG pconfig);
 int cfg_find (PCONFIG pconfig, char *section, char *id);
 int cfg_next_section (PCONFIG pconfig);
 
+/*
+ * Name   cfg_sections_range
+ * Desc   section(ִСд) [from, to) ڵsection״εʱ
+ *          , ֮ÿO(log n)λ; cfg_iter_nextȡ
+ *          ñдǰ
+ * param1 ļṹ
+ * param2 ṩĵ
+ * param3 ʼ(), NULLʾͷʼ
+ * param4 (), NULLʾĩβ
+ * */
+int cfg_sections_range (PCONFIG pconfig, PCFGITER it, const char *from,
+    const char *to);
+
+/*
+ * Name   cfg_sections_prefix
+ * Desc   prefixͷ(ִСд)section, "upstream-"
+ * param1 ļṹ
+ * param2 ṩĵ
+ * param3 ǰ׺
+ * */
+int cfg_sections_prefix (PCONFIG pconfig, PCFGITER it, const char *prefix);
+
+/*
+ * Name   cfg_keys_range
+ * Desc   keysection [from, to) ڵʵ, ͬkeyֻȡһ
+ * param1 ļṹ
+ * param2 ṩĵ
+ * param3 section, ʱ-1
+ * param4 ʼkey(), NULLʾͷʼ
+ * param5 key(), NULLʾĩβ
+ * */
+int cfg_keys_range (PCONFIG pconfig, PCFGITER it, const char *section,
+    const char *from, const char *to);
+
+/*
+ * Name   cfg_keys_prefix
+ * Desc   sectionkeyprefixͷʵ, "pool.db."
+ * param1 ļṹ
+ * param2 ṩĵ
+ * param3 section, ʱ-1
+ * param4 keyǰ׺
+ * */
+int cfg_keys_prefix (PCONFIG pconfig, PCFGITER it, const char *section,
+    const char *prefix);
+
+/*
+ * Name   cfg_sections_begin
+ * Desc   ļ˳section, ͬsectionһ; cfg_iter_next
+ *          ȡɵ߳, ƶα, Ƕ
+ *          ͬʱ, ҲӰcfg_findñд, ļ˳
+ *          ظһЩ, Խ
+ * param1 ļṹ
+ * param2 ṩĵ
+ * */
+int cfg_sections_begin (PCONFIG pconfig, PCFGITER it);
+
+/*
+ * Name   cfg_keys_begin
+ * Desc   ļ˳sectionеʵ, ͬkey
+ * param1 ļṹ
+ * param2 ṩĵ
+ * param3 section, ʱ-1
+ * */
+int cfg_keys_begin (PCONFIG pconfig, PCFGITER it, const char *section);
+
+/*
+ * Name   cfg_entries_begin
+ * Desc   ļ˳ȫ, cfg_rewind/cfg_nextentryȡõͬ:
+ *          it->flagsΪCFG_SECTIONCFG_DEFINECFG_CONTINUE, 
+ *          cfg_section(it)ж; it->valueΪδչԭʼֵ
+ * param1 ļṹ
+ * param2 ṩĵ
+ * */
+int cfg_entries_begin (PCONFIG pconfig, PCFGITER it);
+
+/*
+ * Name   cfg_iter_next
+ * Desc   ȡһ: ɹ0it->section, keyʱit->id
+ *          it->value(cfg_findͬչ, ´βǰЧ); -1
+ * param1 
+ * */
+int cfg_iter_next (PCFGITER it);
+
+/*
+ * Name   cfg_for_each_section
+ * Desc   Ѹsectionָ߳, ÿsectionһfn, У顢
+ *          ֻı߳Ҳ; ÿ߳ʹþһ¡
+ *          (cfg_clone), fnյpconfig̵߳ľ, cfg_getstring
+ *          cfg_getrefcfg_keys_begincfg_keys_rangeȶȡ, Ӧд롣
+ *          ĸ̡߳ʲô˳ĸsectionȷfnط0ʱ
+ *          µsection, ظֵ; ȫɹ0, 󷵻-1
+ *          ڼ̲߳ʹøþ
+ * param1 ļṹ
+ * param2 ÿsectionõĺ
+ * param3 fnĲ
+ * param4 ߳(߳), 0ʾCPU
+ * */
+int cfg_for_each_section (PCONFIG pconfig, cfg_section_t fn, void *arg,
+    int numThreads);
+
 /*
  * Name   cfg_write
  * Desc   Դ򿪵ýṹдһʵ(һü¼)ֻд뵽ýṹδ 
@@ -152,6 +585,77 @@ int cfg_next_section (PCONFIG pconfig);
  * */
 int cfg_write (PCONFIG pconfig, char *section, char *id, char *value);
 
+/*
+ * Name   cfg_subscribe
+ * Desc   Ǽ޸֪ͨ: cfg_write޸Ļcfg_refresh, ÿ仯
+ *          ʵһfn(kindΪCFG_ADDED/CFG_REMOVED/CFG_MODIFIED)
+ *          ̵߳ǼǺע; fn޸õ߳Сʱ
+ * param1 ļṹ
+ * param2 section; flagsCFG_SUB_PREFIXʱΪsectionǰ׺
+ * param3 ʵ; NULLʾsectionʵ
+ * param4 0  CFG_SUB_PREFIX
+ * param5 ص
+ * param6 صĲ
+ * أ   ǼǺ(>0), ʧܷ-1
+ * */
+int cfg_subscribe (PCONFIG pconfig, const char *section, const char *id,
+    int flags, cfg_notify_t fn, void *arg);
+
+/*
+ * Name   cfg_unsubscribe
+ * Desc   עcfg_subscribeĵǼǡڽе֪ͨԿܵһfn
+ * param1 ļṹ
+ * param2 cfg_subscribeصĵǼǺ
+ * */
+int cfg_unsubscribe (PCONFIG pconfig, int handle);
+
+/*
+ * Name   cfg_write_many
+ * Desc   д: ɾsectionĲ˳ִ, д밴section
+ *          ÿsectionһ, ÿsectionһΡ밴˳
+ *          cfg_writeͬ; ʱ-1, ֮ǰĲѾЧ
+ * param1 ļṹ
+ * param2 , ÿΪ(section, ʵ, ʵֵ): ֵΪNULLɾʵ,
+ *          ʵΪNULLɾsection
+ * param3 
+ * */
+int cfg_write_many (PCONFIG pconfig, PCFGOP ops, unsigned int numOps);
+
+/*
+ * Name   cfg_write_int64
+ * Desc   дΪʵֵ, ʽͬcfg_write, дֵԼ
+ *          , ֮µֵŵʱֱӸ, ٷڴ
+ * param1 ļṹ
+ * param2 section
+ * param3 ʵ
+ * param4 ʵֵ
+ * */
+int cfg_write_int64 (PCONFIG pconfig, const char *section, const char *id,
+    int64_t value);
+
+/*
+ * Name   cfg_write_uint64
+ * Desc   ͬcfg_write_int64, д޷
+ * */
+int cfg_write_uint64 (PCONFIG pconfig, const char *section, const char *id,
+    uint64_t value);
+
+/*
+ * Name   cfg_write_double
+ * Desc   ͬcfg_write_int64, д븡: Ҫָʱȡʱܵõͬһֵ
+ *          ʮС; ܴ󡢺СλֵܶöʱõͬһֵС
+ *          N%.Ng(NΪ17), дΪnaninf
+ * */
+int cfg_write_double (PCONFIG pconfig, const char *section, const char *id,
+    double value);
+
+/*
+ * Name   cfg_write_bool
+ * Desc   ͬcfg_write_int64, value0дΪ1, дΪ0, cfg_getint
+ * */
+int cfg_write_bool (PCONFIG pconfig, const char *section, const char *id,
+    int value);
+
 /*
  * Name   cfg_commit
  * Desc   ýṹедӲļ() 
@@ -159,6 +663,34 @@ int cfg_write (PCONFIG pconfig, char *section, char *id, char *value);
  * */
 int cfg_commit (PCONFIG pconfig);
 
+/*
+ * Name   cfg_commit_async
+ * Desc   첽: ڵ̰߳ѵǰлڴ, ɺ̨д߳
+ *          дʱļrename滻(־ģʽ־)дδʼǰٴ
+ *          ύݻϲ, ֻдµһݡcfg_commitcfg_compact
+ *          cfg_refreshcfg_doneȵȴδɵ첽д
+ * param1 ļṹ
+ * param2 дɺں̵̨߳õĻص, ΪNULL; ûддʱڵ
+ *          ߳
+ * param3 صĲ
+ * */
+int cfg_commit_async (PCONFIG pconfig, cfg_commit_t fn, void *arg);
+
+/*
+ * Name   cfg_flush
+ * Desc   ȴþ첽, һдĽ(0-1)
+ * param1 ļṹ
+ * */
+int cfg_flush (PCONFIG pconfig);
+
+/*
+ * ֵпʵ: ${section:key} ͬһеʵֵ, ${ENV:NAME}
+ * û, $${ ʾ ${ ڵһζȡ(cfg_findϲ㺯)
+ * ʱչʵ; cfg_write ֻڱ޸ʵĻ, cfg_refresh
+ * ʱȫ档ѭûǶ׳ CFG_MAX_EXPAND_DEPTH ʱ
+ * ʧ, -1  errno Ϊ ELOOPcfg_nextentry  cfg_commit ʹԭʼֵ
+ */
+
 /*
  * Name   cfg_getstring
  * Desc   ȡļеʵֵ 
@@ -169,6 +701,80 @@ int cfg_commit (PCONFIG pconfig);
  * */
 int cfg_getstring (PCONFIG pconfig, char *section, char *id, char *valptr);
 
+/*
+ * Name   cfg_getref
+ * Desc   Ƶȡʵֵ(${}չ)ָͳ, ƶcfg_nextentry
+ *          αꡣָָڲ, һдácfg_refresh
+ *          cfg_done֮ǰЧ; : ¡sectionк${}
+ *          ֵ, ֻ֤һڸþϲΪֹ
+ * param1 ļṹ
+ * param2 section
+ * param3 ʵ
+ * param4 ֵָ, ΪNULL
+ * param5 ֵĳ('\0'), ΪNULL
+ * أ   0ɹ, -1
+ * */
+int cfg_getref (PCONFIG pconfig, const char *section, const char *id,
+    const char **pValue, size_t *pLen);
+
+/*
+ * Name   cfg_getstring_n
+ * Desc   ͬcfg_getstring, дsizeֽ('\0'β); snprintf
+ *          һֵ, ڵsizeʾض
+ * param1 ļṹ
+ * param2 section
+ * param3 ʵ
+ * param4 صʵֵĴλ
+ * param5 valptrĴС
+ * أ   ֵĳ, ڷ-1
+ * */
+int cfg_getstring_n (PCONFIG pconfig, const char *section, const char *id,
+    char *valptr, size_t size);
+
+/*
+ * Name   cfg_getlist
+ * Desc   ʵֵָsepзΪԪ, Ԫ˵Ŀհױȥ; sepΪ0ʱ
+ *          հз֡зֽʵ, ٴͬһsepȡз֡
+ *          Ԫָڲ, Чͬcfg_getref; ֵûԪ
+ * param1 ļṹ
+ * param2 section
+ * param3 ʵ
+ * param4 ָ, ','
+ * param5 صԪ, ΪNULL
+ * أ   Ԫظ, ڷ-1
+ * */
+int cfg_getlist (PCONFIG pconfig, const char *section, const char *id,
+    int sep, const TCFGSPAN **pItems);
+
+/*
+ * Name   cfg_getlongs
+ * Desc   Ѱsepָбһν뵽vals, n; sepͬcfg_getlist
+ * param1 ļṹ
+ * param2 section
+ * param3 ʵ
+ * param4 ָ
+ * param5 صĴλ
+ * param6 vals
+ * أ   бԪظ(ܴn), ڷ-1; Ԫزʮ-1
+ *          errnoΪEINVAL, longķΧERANGE
+ * */
+int cfg_getlongs (PCONFIG pconfig, const char *section, const char *id,
+    int sep, long *vals, unsigned int n);
+
+/*
+ * Name   cfg_getdoubles
+ * Desc   ͬcfg_getlongs, 븡б
+ * param1 ļṹ
+ * param2 section
+ * param3 ʵ
+ * param4 ָ
+ * param5 صĸĴλ
+ * param6 vals
+ * أ   бԪظ(ܴn), -1errno
+ * */
+int cfg_getdoubles (PCONFIG pconfig, const char *section, const char *id,
+    int sep, double *vals, unsigned int n);
+
 /*
  * Name   cfg_getlong
  * Desc   ȡlongֵ 
@@ -202,7 +808,7 @@ int cfg_get_item (PCONFIG pconfig, char *section, char *id, char * fmt, ...);
 
 /*
  * Name   cfg_write_item
- * Desc   param4ָĸʽдļʵֵ 
+ * Desc   param4ָĸʽдļʵֵ, ȲCFG_MAX_LINE_LENGTH
  * param1 ļṹ
  * param2 section
  * param3 ʵ
@@ -222,7 +828,8 @@ int GetPrivateProfileInt (char * lpszSection, char * lpszEntry,
 
 /*
  * Name   WritePrivateProfileString
- * Desc   ڲȵcfg_initɳʼcfg_writeдݣԼ̵cfg_commitڴͷcfg_done 
+ * Desc   ڲCFG_OPEN_OPTIMISTICcfg_openɳʼcfg_writeдݣԼ̵cfg_commitڴͷcfg_done;
+ *          ͬʱдͬһļʱԵ޸Ķᱣ
  * param1 section
  * param2 ʵ
  * param3 ָҪдʵĸʽ 
@@ -0,0 +1,856 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "inifile.h"
+
+#define BASE_FILE	"check_base.ini"
+#define NUM_STEPS	80
+#define COMMIT_EVERY	25	// ÿôಽύһ
+#define MAX_VALUE	4096
+
+// һ: д롢ɾkeyɾsection
+enum { STEP_WRITE, STEP_DELKEY, STEP_DELSECT, STEP_GET };
+
+typedef struct {
+    int kind;
+    TCFGOP op;
+} STEP;
+
+// ģ: ֻsectionkey, cfg_writeĹ޸
+typedef struct {
+    char *id;
+    char *value;
+} MKEY;
+
+typedef struct {
+    char *name;			// 0(һsection֮ǰ)ΪNULL
+    MKEY *keys;
+    int numKeys, maxKeys;
+} MSECT;
+
+typedef struct {
+    MSECT *sects;
+    int numSects, maxSects;
+} MODEL;
+
+// 򿪷ʽ: ҪõĬϷʽͬĽ
+enum { MODE_DEFAULT, MODE_LAZY, MODE_CONCURRENT, MODE_OPTIMISTIC,
+    MODE_CLONE, MODE_JOURNAL, NUM_MODES };
+
+static const char *modeNames[] = { "default", "lazy", "concurrent",
+    "optimistic", "clone", "journal" };
+static const int modeFlags[] = { 0, CFG_OPEN_LAZY, CFG_OPEN_CONCURRENT,
+    CFG_OPEN_OPTIMISTIC, 0, CFG_OPEN_JOURNAL };
+
+static const char *sectNames[] = { "a", "A", "b", "c", "D", "e" };
+static const char *keyNames[] = { "k1", "k2", "K3", "k4", "k5", "k6", "k7",
+    "k8", "k9", "k10", "k11" };
+
+#define NUM_SECTS	(int) (sizeof (sectNames) / sizeof (sectNames[0]))
+#define NUM_KEYS	(int) (sizeof (keyNames) / sizeof (keyNames[0]))
+
+static unsigned long long state;
+static unsigned int seed;
+static int failures;
+
+static unsigned int rnd (void)
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int) (state >> 33);
+}
+
+static void expect (int ok, const char *area, const char *what)
+{
+    if (ok)
+        return;
+    if (failures++ < 20)
+        printf ("FAIL seed %u %s: %s\n", seed, area, what);
+}
+
+static int same (const char *a, const char *b)
+{
+    return a && b && strcmp (a, b) == 0;
+}
+
+/*** ļͲ ***/
+
+// ע͡СظsectionkeyβעͶ
+static void make_file (const char *name)
+{
+    FILE *fp;
+    int i, j, n, t;
+
+    if ((fp = fopen (name, "w")) == NULL) {
+        perror (name);
+        exit (2);
+    }
+    fputs (";top\n; sticky top\n", fp);
+    n = rnd () % 6;
+    for (i = 0; i < n; i++) {
+        if (rnd () % 3 == 0)
+            fprintf (fp, "; sticky %d\n", i);
+        if (rnd () % 4 == 0)
+            fputs (";nonsticky\n", fp);
+        fprintf (fp, "[%s]%s\n", sectNames[rnd () % NUM_SECTS],
+            rnd () % 5 == 0 ? " ; hc" : "");
+        for (j = rnd () % 14; j > 0; j--) {
+            t = rnd () % 10;
+            if (t == 0)
+                fprintf (fp, "  cont%d\n", j);
+            else if (t == 1)
+                fprintf (fp, "; c%d\n", j);
+            else if (t == 2)
+                fprintf (fp, ";cc%d\n", j);
+            else
+                fprintf (fp, "%s = v%d%s\n", keyNames[rnd () % NUM_KEYS], j,
+                    t == 3 ? " ; cm" : "");
+        }
+    }
+    fclose (fp);
+}
+
+static void copy_file (const char *from, const char *to)
+{
+    char buf[4096];
+    FILE *in, *out;
+    size_t n;
+
+    if ((in = fopen (from, "rb")) == NULL || (out = fopen (to, "wb")) == NULL) {
+        perror (to);
+        exit (2);
+    }
+    while ((n = fread (buf, 1, sizeof (buf), in)) > 0)
+        fwrite (buf, 1, n, out);
+    fclose (in);
+    fclose (out);
+}
+
+static char *read_file (const char *name)
+{
+    FILE *fp;
+    char *buf;
+    long size;
+
+    if ((fp = fopen (name, "rb")) == NULL)
+        return strdup ("");
+    fseek (fp, 0, SEEK_END);
+    size = ftell (fp);
+    rewind (fp);
+    buf = (char *) malloc (size + 1);
+    buf[fread (buf, 1, size, fp)] = 0;
+    fclose (fp);
+    return buf;
+}
+
+// ֵֻöʱַ, żCFG_MAX_LINE_LENGTH
+static char *make_value (int n)
+{
+    char *v;
+    int len, i;
+
+    if (rnd () % 20 == 0) {
+        len = CFG_MAX_LINE_LENGTH + rnd () % 1000;
+        v = (char *) malloc (len + 1);
+        for (i = 0; i < len; i++)
+            v[i] = 'a' + (i + n) % 26;
+        v[len] = 0;
+        return v;
+    }
+    v = (char *) malloc (32);
+    sprintf (v, rnd () % 4 ? "w%d" : "w %d.x", n);
+    return v;
+}
+
+static void make_steps (STEP *steps, int n)
+{
+    STEP *s;
+    int i, t;
+
+    for (i = 0; i < n; i++) {
+        s = &steps[i];
+        t = rnd () % 10;
+        s->op.section = strdup (sectNames[rnd () % NUM_SECTS]);
+        s->op.id = strdup (keyNames[rnd () % NUM_KEYS]);
+        s->op.value = NULL;
+        if (t < 4) {
+            s->kind = STEP_WRITE;
+            s->op.value = make_value (i);
+        }
+        else if (t < 6)
+            s->kind = STEP_DELKEY;
+        else if (t == 6) {
+            s->kind = STEP_DELSECT;
+            free (s->op.id);
+            s->op.id = NULL;
+        }
+        else
+            s->kind = STEP_GET;
+    }
+}
+
+static void free_steps (STEP *steps, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        free (steps[i].op.section);
+        free (steps[i].op.id);
+        free (steps[i].op.value);
+    }
+}
+
+/*** ģ ***/
+
+static MSECT *model_add (MODEL *m, const char *name)
+{
+    MSECT *s;
+
+    if (m->numSects == m->maxSects) {
+        m->maxSects = m->maxSects ? m->maxSects * 2 : 8;
+        m->sects = (MSECT *) realloc (m->sects, m->maxSects * sizeof (MSECT));
+    }
+    s = &m->sects[m->numSects++];
+    memset (s, 0, sizeof (MSECT));
+    s->name = name ? strdup (name) : NULL;
+    return s;
+}
+
+static void model_addkey (MSECT *s, const char *id, const char *value)
+{
+    if (s->numKeys == s->maxKeys) {
+        s->maxKeys = s->maxKeys ? s->maxKeys * 2 : 8;
+        s->keys = (MKEY *) realloc (s->keys, s->maxKeys * sizeof (MKEY));
+    }
+    s->keys[s->numKeys].id = strdup (id);
+    s->keys[s->numKeys++].value = strdup (value);
+}
+
+static void model_freesect (MSECT *s)
+{
+    int i;
+
+    for (i = 0; i < s->numKeys; i++) {
+        free (s->keys[i].id);
+        free (s->keys[i].value);
+    }
+    free (s->keys);
+    free (s->name);
+}
+
+static void model_free (MODEL *m)
+{
+    int i;
+
+    for (i = 0; i < m->numSects; i++)
+        model_freesect (&m->sects[i]);
+    free (m->sects);
+}
+
+// ȡǰsectionkeyΪ
+static void model_load (MODEL *m, PCONFIG p)
+{
+    MSECT *s;
+
+    memset (m, 0, sizeof (MODEL));
+    s = model_add (m, NULL);
+    cfg_rewind (p);
+    while (cfg_nextentry (p) == 0) {
+        if (cfg_section (p))
+            s = model_add (m, p->section);
+        else if (cfg_define (p))
+            model_addkey (s, p->id, p->value);
+    }
+}
+
+// ͬsectionkeyֻϵһ, Ͳһ
+static int model_sect (MODEL *m, const char *name)
+{
+    int i;
+
+    for (i = 1; i < m->numSects; i++)
+        if (strcasecmp (m->sects[i].name, name) == 0)
+            return i;
+    return 0;
+}
+
+static int model_key (MSECT *s, const char *id)
+{
+    int i;
+
+    for (i = 0; i < s->numKeys; i++)
+        if (strcasecmp (s->keys[i].id, id) == 0)
+            return i;
+    return -1;
+}
+
+static void model_write (MODEL *m, const TCFGOP *op)
+{
+    MSECT *s;
+    int pos, idx;
+
+    if ((pos = model_sect (m, op->section)) == 0) {
+        if (op->id == NULL || op->value == NULL)
+            return;
+        model_add (m, op->section);
+        pos = m->numSects - 1;
+    }
+    s = &m->sects[pos];
+    if (op->id == NULL) {
+        model_freesect (s);
+        memmove (s, s + 1, (m->numSects - pos - 1) * sizeof (MSECT));
+        m->numSects--;
+        return;
+    }
+    idx = model_key (s, op->id);
+    if (op->value == NULL) {
+        if (idx >= 0) {
+            free (s->keys[idx].id);
+            free (s->keys[idx].value);
+            memmove (&s->keys[idx], &s->keys[idx + 1],
+                (s->numKeys - idx - 1) * sizeof (MKEY));
+            s->numKeys--;
+        }
+    }
+    else if (idx < 0)
+        model_addkey (s, op->id, op->value);
+    else {
+        free (s->keys[idx].value);
+        s->keys[idx].value = strdup (op->value);
+    }
+}
+
+static const char *model_get (MODEL *m, const char *section, const char *id)
+{
+    int pos, idx;
+
+    if ((pos = model_sect (m, section)) == 0
+        || (idx = model_key (&m->sects[pos], id)) < 0)
+        return NULL;
+    return m->sects[pos].keys[idx].value;
+}
+
+static char *model_trace (MODEL *m)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream (&buf, &size);
+    int i, j;
+
+    for (i = 0; i < m->numSects; i++) {
+        if (m->sects[i].name)
+            fprintf (fp, "[%s]\n", m->sects[i].name);
+        for (j = 0; j < m->sects[i].numKeys; j++)
+            fprintf (fp, "%s=%s\n", m->sects[i].keys[j].id,
+                m->sects[i].keys[j].value);
+    }
+    fclose (fp);
+    return buf;
+}
+
+/***  ***/
+
+// ֻsectionkey, model_traceͬһʽ
+static char *keys_trace (PCONFIG p)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream (&buf, &size);
+
+    cfg_rewind (p);
+    while (cfg_nextentry (p) == 0) {
+        if (cfg_section (p))
+            fprintf (fp, "[%s]\n", p->section);
+        else if (cfg_define (p))
+            fprintf (fp, "%s=%s\n", p->id, p->value);
+    }
+    fclose (fp);
+    return buf;
+}
+
+// cfg_nextentryȡõȫ
+static char *full_trace (PCONFIG p)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream (&buf, &size);
+
+    cfg_rewind (p);
+    while (cfg_nextentry (p) == 0)
+        fprintf (fp, "%x %s %s %s\n", p->flags & CFG_TYPEMASK,
+            cfg_section (p) ? p->section : "-", p->id ? p->id : "-",
+            p->value ? p->value : "-");
+    fclose (fp);
+    return buf;
+}
+
+static char *reopen_trace (const char *name, int flags)
+{
+    PCONFIG p;
+    char *trace;
+
+    if (cfg_open (&p, name, flags) == -1)
+        return strdup ("open failed");
+    trace = full_trace (p);
+    cfg_done (p);
+    return trace;
+}
+
+/*** ִ򿪷ʽ ***/
+
+// steps޸һ, ģͶ
+static void apply_steps (PCONFIG p, MODEL *m, STEP *steps, int n,
+    const char *area)
+{
+    static char buf[MAX_VALUE];
+    const char *want;
+    char *trace, *keys;
+    int i, rc;
+
+    for (i = 0; i < n; i++) {
+        if (steps[i].kind == STEP_GET) {
+            want = model_get (m, steps[i].op.section, steps[i].op.id);
+            rc = cfg_getstring_n (p, steps[i].op.section, steps[i].op.id,
+                buf, sizeof (buf));
+            expect (want ? rc >= 0 && same (buf, want) : rc == -1, area,
+                "lookup differs from the model");
+        }
+        else {
+            expect (cfg_write (p, steps[i].op.section, steps[i].op.id,
+                steps[i].op.value) == 0, area, "cfg_write failed");
+            model_write (m, &steps[i].op);
+        }
+        if ((i + 1) % COMMIT_EVERY == 0)
+            expect (cfg_commit (p) == 0, area, "cfg_commit failed");
+    }
+    trace = model_trace (m);
+    keys = keys_trace (p);
+    expect (same (keys, trace), area, "keys differ from the model");
+    free (trace);
+    free (keys);
+}
+
+// ύļ, *pTraceΪύǰcfg_nextentryĽ
+static char *run_mode (int mode, STEP *steps, int n, char **pTrace)
+{
+    const char *area = modeNames[mode];
+    char name[64], journal[80], *parentTrace = NULL, *trace, *file;
+    PCONFIG p, parent = NULL, q;
+    MODEL m;
+    FILE *fp;
+
+    sprintf (name, "check_%s.ini", area);
+    sprintf (journal, "%s.journal", name);
+    copy_file (BASE_FILE, name);
+    remove (journal);
+
+    if (mode == MODE_CLONE) {
+        if (cfg_open (&parent, name, 0) == -1 || cfg_clone (parent, &p) == -1) {
+            expect (0, area, "cannot clone");
+            exit (2);
+        }
+        parentTrace = full_trace (parent);
+    }
+    else if (cfg_open (&p, name, modeFlags[mode]) == -1) {
+        expect (0, area, "cannot open");
+        exit (2);
+    }
+
+    model_load (&m, p);
+    apply_steps (p, &m, steps, n, area);
+    *pTrace = full_trace (p);
+    expect (cfg_commit (p) == 0, area, "cfg_commit failed");
+
+    if (mode == MODE_JOURNAL) {
+        // ط־õͬ, ϲļʽļͬ
+        trace = reopen_trace (name, CFG_OPEN_JOURNAL);
+        expect (same (trace, *pTrace), area, "replay differs");
+        free (trace);
+        expect (cfg_compact (p) == 0, area, "cfg_compact failed");
+        file = read_file (name);
+
+        // ־ĩβдһļ¼: طʱ, ´ύʱص
+        fp = fopen (journal, "a");
+        fputs ("W 1 2 3 0000beef\nab", fp);
+        fclose (fp);
+        if (cfg_open (&q, name, CFG_OPEN_JOURNAL) == 0) {
+            trace = full_trace (q);
+            expect (same (trace, *pTrace), area, "torn tail was replayed");
+            free (trace);
+            cfg_write (q, "torn", "k", "v");
+            expect (cfg_commit (q) == 0, area, "commit after torn tail");
+            trace = full_trace (q);
+            free (parentTrace);
+            parentTrace = reopen_trace (name, CFG_OPEN_JOURNAL);
+            expect (same (parentTrace, trace), area,
+                "record after torn tail lost");
+            free (trace);
+            cfg_done (q);
+        }
+        else
+            expect (0, area, "cannot reopen after torn tail");
+    }
+    else {
+        // ļٶύǰͬ
+        file = read_file (name);
+        trace = reopen_trace (name, 0);
+        expect (same (trace, *pTrace), area, "committed file reads back different");
+        free (trace);
+    }
+
+    if (parent) {
+        trace = full_trace (parent);
+        expect (same (trace, parentTrace), area, "writes reached the original");
+        free (trace);
+        cfg_done (parent);
+    }
+    free (parentTrace);
+    model_free (&m);
+    cfg_done (p);
+    remove (name);
+    remove (journal);
+    return file;
+}
+
+// ַʽĬϷʽõͬݺļ
+static void check_modes (STEP *steps, int n)
+{
+    char *trace[NUM_MODES], *file[NUM_MODES], what[64];
+    int i;
+
+    for (i = 0; i < NUM_MODES; i++)
+        file[i] = run_mode (i, steps, n, &trace[i]);
+    for (i = 1; i < NUM_MODES; i++) {
+        sprintf (what, "trace differs from %s", modeNames[0]);
+        expect (same (trace[i], trace[0]), modeNames[i], what);
+        sprintf (what, "file differs from %s", modeNames[0]);
+        expect (same (file[i], file[0]), modeNames[i], what);
+    }
+    for (i = 0; i < NUM_MODES; i++) {
+        free (trace[i]);
+        free (file[i]);
+    }
+}
+
+/*** cfg_write_many ***/
+
+// ֳɼcfg_write_many, cfg_writeͬ
+static void check_many (STEP *steps, int n)
+{
+    TCFGOP ops[NUM_STEPS];
+    PCONFIG one, many;
+    char *a, *b;
+    int i, k, numOps = 0;
+
+    copy_file (BASE_FILE, "check_one.ini");
+    copy_file (BASE_FILE, "check_many.ini");
+    if (cfg_open (&one, "check_one.ini", 0) == -1
+        || cfg_open (&many, "check_many.ini", 0) == -1) {
+        expect (0, "write_many", "cannot open");
+        exit (2);
+    }
+    for (i = 0; i < n; i++)
+        if (steps[i].kind != STEP_GET) {
+            ops[numOps++] = steps[i].op;
+            cfg_write (one, steps[i].op.section, steps[i].op.id,
+                steps[i].op.value);
+        }
+    for (i = 0; i < numOps; i += k) {
+        k = 1 + rnd () % 30;
+        if (k > numOps - i)
+            k = numOps - i;
+        expect (cfg_write_many (many, ops + i, k) == 0, "write_many",
+            "cfg_write_many failed");
+    }
+
+    a = full_trace (one);
+    b = full_trace (many);
+    expect (same (a, b), "write_many", "trace differs from cfg_write");
+    free (a);
+    free (b);
+    cfg_commit (one);
+    cfg_commit (many);
+    a = read_file ("check_one.ini");
+    b = read_file ("check_many.ini");
+    expect (same (a, b), "write_many", "file differs from cfg_write");
+    free (a);
+    free (b);
+    cfg_done (one);
+    cfg_done (many);
+    remove ("check_one.ini");
+    remove ("check_many.ini");
+}
+
+/*** ֹύ ***/
+
+// ͬһ汾дһ, Ⱥύ; ύļԼ
+// ޸, һȫ޸ͬ
+static void check_merge (STEP *steps, int n)
+{
+    PCONFIG first, second, seq;
+    char *a, *b;
+    int i;
+
+    copy_file (BASE_FILE, "check_merge.ini");
+    copy_file (BASE_FILE, "check_seq.ini");
+    if (cfg_open (&first, "check_merge.ini", CFG_OPEN_OPTIMISTIC) == -1
+        || cfg_open (&second, "check_merge.ini", CFG_OPEN_OPTIMISTIC) == -1
+        || cfg_open (&seq, "check_seq.ini", 0) == -1) {
+        expect (0, "merge", "cannot open");
+        exit (2);
+    }
+    for (i = 0; i < n; i++)
+        if (steps[i].kind != STEP_GET) {
+            cfg_write (i < n / 2 ? first : second, steps[i].op.section,
+                steps[i].op.id, steps[i].op.value);
+            cfg_write (seq, steps[i].op.section, steps[i].op.id,
+                steps[i].op.value);
+        }
+    expect (cfg_commit (first) == 0, "merge", "first commit failed");
+    expect (cfg_commit (second) == 0, "merge", "second commit failed");
+    cfg_commit (seq);
+
+    a = full_trace (second);
+    b = full_trace (seq);
+    expect (same (a, b), "merge", "merged handle differs");
+    free (a);
+    free (b);
+    a = read_file ("check_merge.ini");
+    b = read_file ("check_seq.ini");
+    expect (same (a, b), "merge", "merged file differs");
+    free (a);
+    free (b);
+    cfg_done (first);
+    cfg_done (second);
+    cfg_done (seq);
+    remove ("check_merge.ini");
+    remove ("check_seq.ini");
+}
+
+/*** ־ ***/
+
+// ־дһβύ, мһϲ־; ϲ
+// õļһȫ޸ͬ, ˭ļ¼
+static void check_journals (STEP *steps, int n)
+{
+    PCONFIG h[2], seq;
+    char *a, *b;
+    int i, k, turn = 0;
+
+    copy_file (BASE_FILE, "check_jnl.ini");
+    copy_file (BASE_FILE, "check_seq.ini");
+    remove ("check_jnl.ini.journal");
+    if (cfg_open (&h[0], "check_jnl.ini", CFG_OPEN_JOURNAL) == -1
+        || cfg_open (&h[1], "check_jnl.ini", CFG_OPEN_JOURNAL) == -1
+        || cfg_open (&seq, "check_seq.ini", 0) == -1) {
+        expect (0, "journals", "cannot open");
+        exit (2);
+    }
+    for (i = 0; i < n; turn ^= 1) {
+        for (k = 1 + rnd () % 10; k > 0 && i < n; i++)
+            if (steps[i].kind != STEP_GET) {
+                cfg_write (h[turn], steps[i].op.section, steps[i].op.id,
+                    steps[i].op.value);
+                cfg_write (seq, steps[i].op.section, steps[i].op.id,
+                    steps[i].op.value);
+                k--;
+            }
+        if (rnd () % 4 == 0)
+            expect (cfg_compact (h[turn]) == 0, "journals", "cfg_compact failed");
+        else
+            expect (cfg_commit (h[turn]) == 0, "journals", "cfg_commit failed");
+    }
+    expect (cfg_compact (h[turn]) == 0, "journals", "cfg_compact failed");
+    cfg_commit (seq);
+
+    a = full_trace (h[turn]);
+    b = full_trace (seq);
+    expect (same (a, b), "journals", "compacting handle differs");
+    free (a);
+    free (b);
+    a = read_file ("check_jnl.ini");
+    b = read_file ("check_seq.ini");
+    expect (same (a, b), "journals", "compacted file differs");
+    free (a);
+    free (b);
+    cfg_done (h[0]);
+    cfg_done (h[1]);
+    cfg_done (seq);
+    remove ("check_jnl.ini");
+    remove ("check_jnl.ini.journal");
+    remove ("check_seq.ini");
+}
+
+/*** ڴͳ ***/
+
+// ɾּӻͬһkey: ʵʹ, cfg_shrinkֻ
+// Сʵ, Ҳı
+static void check_shrink (STEP *steps, int n)
+{
+    TCFGMEM before, after;
+    PCONFIG p;
+    char *a, *b;
+    int round, i;
+
+    copy_file (BASE_FILE, "check_shrink.ini");
+    if (cfg_open (&p, "check_shrink.ini", 0) == -1) {
+        expect (0, "shrink", "cannot open");
+        exit (2);
+    }
+    for (round = 0; round < 50; round++)
+        for (i = 0; i < n; i++)
+            if (steps[i].kind == STEP_DELKEY) {
+                cfg_write (p, steps[i].op.section, steps[i].op.id, "x");
+                cfg_write (p, steps[i].op.section, steps[i].op.id, NULL);
+            }
+            else if (steps[i].kind == STEP_WRITE && round == 0)
+                cfg_write (p, steps[i].op.section, steps[i].op.id,
+                    steps[i].op.value);
+
+    a = full_trace (p);
+    cfg_memory_usage (p, &before);
+    expect (before.entriesUsed <= before.entries, "shrink",
+        "more entries used than allocated");
+    expect (cfg_shrink (p) == 0, "shrink", "cfg_shrink failed");
+    cfg_memory_usage (p, &after);
+    expect (after.entries <= before.entries, "shrink",
+        "cfg_shrink grew the entry arrays");
+    expect (after.entriesUsed <= after.entries, "shrink",
+        "more entries used than allocated after cfg_shrink");
+    b = full_trace (p);
+    expect (same (a, b), "shrink", "cfg_shrink changed the content");
+    free (a);
+    free (b);
+    cfg_done (p);
+    remove ("check_shrink.ini");
+}
+
+/*** ͻд ***/
+
+// Чָ, ƿͷĩβ0
+static int digits (const char *s)
+{
+    const char *end = strpbrk (s, "eE"), *first = NULL, *last = NULL;
+    int n = 0;
+
+    if (end == NULL)
+        end = s + strlen (s);
+    for (; s < end; s++)
+        if (*s >= '1' && *s <= '9') {
+            if (first == NULL)
+                first = s;
+            last = s;
+        }
+    for (s = first; first && s <= last; s++)
+        n += *s >= '0' && *s <= '9';
+    return n;
+}
+
+static double random_double (void)
+{
+    uint64_t bits;
+    double v;
+
+    switch (rnd () % 4) {
+    case 0:
+        // λģʽ
+        do {
+            bits = (uint64_t) rnd () << 32 | rnd ();
+            memcpy (&v, &bits, sizeof (v));
+        } while (isnan (v) || isinf (v));
+        return v;
+    case 1:
+        return (double) (rnd () % 100000000) / 1000 * (rnd () & 1 ? -1 : 1);
+    case 2:
+        return (double) (rnd () % 1000000) / 100000;
+    default:
+        return rnd () & 1 ? -0.0 : (double) (int) rnd ();
+    }
+}
+
+// дַ, õԭֵ; ȡ̵д, 㱣
+static void check_typed (PCONFIG p, int n)
+{
+    char buf[64], ref[64];
+    int64_t i64;
+    uint64_t u64;
+    double d;
+    int i, prec, b;
+
+    for (i = 0; i < n; i++) {
+        i64 = (int64_t) ((uint64_t) rnd () << 32 | rnd ());
+        u64 = (uint64_t) rnd () << 32 | rnd ();
+        if (i % 16 == 0) {
+            i64 = i % 32 ? INT64_MIN : INT64_MAX;
+            u64 = i % 32 ? 0 : UINT64_MAX;
+        }
+        cfg_write_int64 (p, "typed", "i64", i64);
+        cfg_write_uint64 (p, "typed", "u64", u64);
+        expect (cfg_getstring (p, "typed", "i64", buf) == 0
+            && strtoll (buf, NULL, 10) == i64, "typed", "int64 differs");
+        expect (cfg_getstring (p, "typed", "u64", buf) == 0
+            && strtoull (buf, NULL, 10) == u64, "typed", "uint64 differs");
+
+        d = random_double ();
+        cfg_write_double (p, "typed", "double", d);
+        for (prec = 1; prec <= 17; prec++) {
+            snprintf (ref, sizeof (ref), "%.*g", prec, d);
+            if (strtod (ref, NULL) == d)
+                break;
+        }
+        if (cfg_getstring (p, "typed", "double", buf) == 0) {
+            expect (strtod (buf, NULL) == d
+                && !signbit (strtod (buf, NULL)) == !signbit (d), "typed",
+                "double does not read back");
+            expect (digits (buf) <= digits (ref), "typed",
+                "double has more digits than needed");
+            expect (strchr (buf, '.') == NULL || strpbrk (buf, "eE")
+                || buf[strlen (buf) - 1] != '0', "typed",
+                "double has trailing zeros");
+        }
+        else
+            expect (0, "typed", "double not written");
+
+        cfg_write_bool (p, "typed", "bool", i & 1);
+        expect (cfg_getint (p, "typed", "bool", &b) == 0 && b == (i & 1),
+            "typed", "bool differs");
+    }
+}
+
+// ÷: check_diff [Ӹ] [һ]
+int main (int argc, char *argv[])
+{
+    unsigned int numSeeds = argc > 1 ? atoi (argv[1]) : 200;
+    unsigned int first = argc > 2 ? atoi (argv[2]) : 1;
+    STEP steps[NUM_STEPS];
+    PCONFIG typed;
+
+    for (seed = first; seed < first + numSeeds; seed++) {
+        state = seed;
+        make_file (BASE_FILE);
+        make_steps (steps, NUM_STEPS);
+        check_modes (steps, NUM_STEPS);
+        check_many (steps, NUM_STEPS);
+        check_merge (steps, NUM_STEPS);
+        check_journals (steps, NUM_STEPS);
+        check_shrink (steps, NUM_STEPS);
+        free_steps (steps, NUM_STEPS);
+    }
+
+    seed = 0;
+    state = first;
+    if (cfg_open (&typed, "check_typed.ini", CFG_OPEN_CREATE) == -1) {
+        expect (0, "typed", "cannot open");
+        return 2;
+    }
+    check_typed (typed, 20000 * (numSeeds < 10 ? 1 : numSeeds / 10));
+    cfg_done (typed);
+    remove ("check_typed.ini");
+    remove (BASE_FILE);
+
+    printf ("%u seeds, %d failures\n", numSeeds, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+
+#include "inifile.h"
+
+// ÷: cfg2hpp [-n ֿռ] input.ini [output.hpp]
+//
+// ʱͬĽ(cfg_open)ini, C++17ͷļ:
+//   - section:keyconstexpr, ԼڼõСϣ,
+//     ΪһιϣһαȽ, ڴ, ʱ;
+//   - PCONFIGͬĲҽӿ(cfg_getref/cfg_getstring/cfg_getstring_n/
+//     cfg_getlong/cfg_getint), һΪ ֿռ::config, ADLҵ,
+//     ͬһݴȿʱPCONFIGҲɵı;
+//   - ֿռ::values::section::key ʽͻ(long, double
+//     std::string_view)
+// ֵе${section:key}ʱչ, ${ENV:xxx}ȡʱĻ
+// ʱҲظsection/keyС
+
+#define MAX_SEEDS	64
+#define MAX_DISP	(1U << 24)
+
+typedef struct {
+    const char *section;
+    const char *id;
+    const char *value;
+    size_t len;
+    uint32_t h1, h2;
+    unsigned int order;		// ļеĴ
+} KEY;
+
+static const char *keywords[] = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor",
+    "bool", "break", "case", "catch", "char", "char16_t", "char32_t",
+    "class", "compl", "const", "const_cast", "constexpr", "continue",
+    "decltype", "default", "delete", "do", "double", "dynamic_cast", "else",
+    "enum", "explicit", "export", "extern", "false", "float", "for",
+    "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace",
+    "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+    "or_eq", "private", "protected", "public", "register",
+    "reinterpret_cast", "return", "short", "signed", "sizeof", "static",
+    "static_assert", "static_cast", "struct", "switch", "template", "this",
+    "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+    "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t",
+    "while", "xor", "xor_eq", NULL
+};
+
+// ϣɵͷļе _cfg_fnv/_cfg_mix λһ
+static uint32_t mix (uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+// FNV-1a, ASCIIСд, ʱstrcasecmpһ
+static void fnv (uint32_t *h1, uint32_t *h2, const char *s, size_t n)
+{
+    size_t i;
+    unsigned char c;
+
+    for (i = 0; i < n; i++) {
+        c = (unsigned char) s[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        *h1 = (*h1 ^ c) * 16777619U;
+        *h2 = (*h2 ^ c) * 16777619U;
+    }
+}
+
+static void hash_key (KEY *k, uint32_t seed)
+{
+    k->h1 = 2166136261U ^ seed;
+    k->h2 = mix (seed) ^ 0x9747b28cU;
+    fnv (&k->h1, &k->h2, k->section, strlen (k->section));
+    fnv (&k->h1, &k->h2, "", 1);
+    fnv (&k->h1, &k->h2, k->id, strlen (k->id));
+}
+
+static uint32_t slot_of (const KEY *k, uint32_t d, unsigned int n)
+{
+    return mix (k->h2 + d * 0x9E3779B9U) % n;
+}
+
+static int by_name (const void *a, const void *b)
+{
+    const KEY *x = (const KEY *) a, *y = (const KEY *) b;
+    int rc;
+
+    if ((rc = strcasecmp (x->section, y->section)) == 0
+        && (rc = strcasecmp (x->id, y->id)) == 0)
+        rc = x->order < y->order ? -1 : x->order > y->order;
+    return rc;
+}
+
+static int by_order (const void *a, const void *b)
+{
+    const KEY *x = (const KEY *) a, *y = (const KEY *) b;
+
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static unsigned int *bucket_of;	// ÿkeyͰ
+static unsigned int *bucket_size;
+
+// ͰĴСӴС, Ͱȷ
+static int by_bucket (const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+    if (bucket_size[x] != bucket_size[y])
+        return bucket_size[x] > bucket_size[y] ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+// ϣ-λ(CHD): nkeyn, Ͱbڵkey mix(h2 + disp[b]*) % n
+// ɹ0, keysۺ, dispΪÿͰλ
+static int build_hash (KEY *keys, unsigned int n, unsigned int numBuckets,
+    uint32_t seed, uint32_t *disp)
+{
+    unsigned int *order, *members, *start, *taken, *place, b, i, j, k;
+    uint32_t d, s;
+    KEY *sorted;
+    int rc = -1;
+
+    order = (unsigned int *) malloc (numBuckets * sizeof (unsigned int));
+    members = (unsigned int *) malloc (n * sizeof (unsigned int));
+    start = (unsigned int *) calloc (numBuckets + 1, sizeof (unsigned int));
+    taken = (unsigned int *) calloc (n, sizeof (unsigned int));
+    place = (unsigned int *) malloc (n * sizeof (unsigned int));
+    bucket_of = (unsigned int *) malloc (n * sizeof (unsigned int));
+    bucket_size = (unsigned int *) calloc (numBuckets, sizeof (unsigned int));
+    sorted = (KEY *) malloc (n * sizeof (KEY));
+    if (!order || !members || !start || !taken || !place || !bucket_of
+        || !bucket_size || !sorted)
+        goto done;
+
+    for (i = 0; i < n; i++) {
+        hash_key (&keys[i], seed);
+        bucket_of[i] = keys[i].h1 % numBuckets;
+        bucket_size[bucket_of[i]]++;
+    }
+    for (b = 0; b < numBuckets; b++) {
+        start[b + 1] = start[b] + bucket_size[b];
+        order[b] = b;
+    }
+    for (i = 0; i < n; i++)
+        members[start[bucket_of[i]]++] = i;
+    for (b = 0; b < numBuckets; b++)
+        start[b] -= bucket_size[b];
+    qsort (order, numBuckets, sizeof (unsigned int), by_bucket);
+
+    for (i = 0; i < numBuckets; i++) {
+        b = order[i];
+        disp[b] = 0;
+        if (bucket_size[b] == 0)
+            continue;
+        for (d = 0; d < MAX_DISP; d++) {
+            // Ͱkeyڿղһͬ; takeni+1ǱͰԷ
+            for (j = 0; j < bucket_size[b]; j++) {
+                k = members[start[b] + j];
+                s = slot_of (&keys[k], d, n);
+                if (taken[s])
+                    break;
+                taken[s] = n + 1;
+                place[k] = s;
+            }
+            if (j == bucket_size[b])
+                break;
+            while (j-- > 0)
+                taken[place[members[start[b] + j]]] = 0;
+        }
+        if (d == MAX_DISP)
+            goto done;
+        disp[b] = d;
+        for (j = 0; j < bucket_size[b]; j++)
+            taken[place[members[start[b] + j]]] = 1;
+    }
+
+    for (i = 0; i < n; i++)
+        sorted[place[i]] = keys[i];
+    memcpy (keys, sorted, n * sizeof (KEY));
+    rc = 0;
+
+done:
+    free (order);
+    free (members);
+    free (start);
+    free (taken);
+    free (place);
+    free (bucket_of);
+    free (bucket_size);
+    free (sorted);
+    return rc;
+}
+
+// C++ַ; ɴӡַ3λ˽, һ
+static void put_string (FILE *fp, const char *s, size_t n)
+{
+    size_t i;
+    unsigned char c;
+
+    fputc ('"', fp);
+    for (i = 0; i < n; i++) {
+        c = (unsigned char) s[i];
+        if (c == '"' || c == '\\')
+            fprintf (fp, "\\%c", c);
+        else if (c == '?')
+            fputs ("\\?", fp);	// ַ
+        else if (c < 0x20 || c >= 0x7f)
+            fprintf (fp, "\\%03o", c);
+        else
+            fputc (c, fp);
+    }
+    fputc ('"', fp);
+}
+
+// keyȥźĸ: ͷ, һΪֹ, ʱ
+// _cfg_idcmpcfg_freezeһ
+static char *unquote (const char *id)
+{
+    size_t len;
+    char *cp;
+
+    while (*id == '\'' || *id == '"')
+        id++;
+    for (len = 0; id[len] && id[len] != '\'' && id[len] != '"'; len++)
+        ;
+    if ((cp = (char *) malloc (len + 1)) == NULL)
+        return NULL;
+    memcpy (cp, id, len);
+    cp[len] = 0;
+    return cp;
+}
+
+// ֱΪC++ʶ, дbuf( 2*strlen(name)+2 ֽ)
+static void make_ident (char *buf, const char *name)
+{
+    char *cp = buf;
+    const char **kw;
+
+    if (*name >= '0' && *name <= '9')
+        *cp++ = '_';
+    for (; *name; name++)
+        *cp++ = (*name >= 'a' && *name <= 'z') || (*name >= 'A' && *name <= 'Z')
+            || (*name >= '0' && *name <= '9') ? *name : '_';
+    if (cp == buf)
+        *cp++ = '_';
+    *cp = 0;
+    for (kw = keywords; *kw; kw++)
+        if (!strcmp (buf, *kw)) {
+            strcat (buf, "_");
+            break;
+        }
+}
+
+// ɵĲҴ, fnv/mix/slot_ofλһ
+static const char *lookup_code =
+"constexpr std::uint32_t\n"
+"_cfg_mix (std::uint32_t h) noexcept\n"
+"{\n"
+"  h ^= h >> 16;\n"
+"  h *= 0x85ebca6bU;\n"
+"  h ^= h >> 13;\n"
+"  h *= 0xc2b2ae35U;\n"
+"  h ^= h >> 16;\n"
+"  return h;\n"
+"}\n"
+"\n"
+"constexpr void\n"
+"_cfg_fnv (std::uint32_t &h1, std::uint32_t &h2, std::string_view s) noexcept\n"
+"{\n"
+"  for (char ch : s)\n"
+"    {\n"
+"      std::uint32_t c = static_cast<unsigned char> (ch);\n"
+"      if (c >= 'A' && c <= 'Z')\n"
+"\tc += 'a' - 'A';\n"
+"      h1 = (h1 ^ c) * 16777619U;\n"
+"      h2 = (h2 ^ c) * 16777619U;\n"
+"    }\n"
+"}\n"
+"\n"
+"constexpr bool\n"
+"_cfg_ieq (std::string_view a, std::string_view b) noexcept\n"
+"{\n"
+"  if (a.size () != b.size ())\n"
+"    return false;\n"
+"  for (std::size_t i = 0; i < a.size (); i++)\n"
+"    {\n"
+"      char x = a[i], y = b[i];\n"
+"      if (x >= 'A' && x <= 'Z')\n"
+"\tx += 'a' - 'A';\n"
+"      if (y >= 'A' && y <= 'Z')\n"
+"\ty += 'a' - 'A';\n"
+"      if (x != y)\n"
+"\treturn false;\n"
+"    }\n"
+"  return true;\n"
+"}\n"
+"\n"
+"/* id without its quotes, as the runtime lookup compares it */\n"
+"constexpr std::string_view\n"
+"_cfg_unquote (std::string_view id) noexcept\n"
+"{\n"
+"  std::size_t i = 0, j = 0;\n"
+"\n"
+"  while (i < id.size () && (id[i] == '\\'' || id[i] == '\"'))\n"
+"    i++;\n"
+"  for (j = i; j < id.size () && id[j] != '\\'' && id[j] != '\"'; j++)\n"
+"    ;\n"
+"  return id.substr (i, j - i);\n"
+"}\n"
+"\n"
+"/* section:id, case insensitive like the runtime lookup; nullptr if absent */\n"
+"constexpr const cfg_entry *\n"
+"find (std::string_view section, std::string_view id) noexcept\n"
+"{\n"
+"  if (count == 0)\n"
+"    return nullptr;\n"
+"  id = _cfg_unquote (id);\n"
+"  std::uint32_t h1 = 2166136261U ^ seed, h2 = _cfg_mix (seed) ^ 0x9747b28cU;\n"
+"  _cfg_fnv (h1, h2, section);\n"
+"  _cfg_fnv (h1, h2, std::string_view (\"\", 1));\n"
+"  _cfg_fnv (h1, h2, id);\n"
+"  const cfg_entry &e = entries[_cfg_mix (h2 + disp[h1 % num_buckets]\n"
+"      * 0x9E3779B9U) % (count ? count : 1)];\n"
+"  return _cfg_ieq (e.section, section) && _cfg_ieq (e.id, id) ? &e : nullptr;\n"
+"}\n"
+"\n"
+"/* the PCONFIG lookup interface, found by ADL on config */\n"
+"\n"
+"constexpr int\n"
+"cfg_getref (table, const char *section, const char *id,\n"
+"    const char **pValue, std::size_t *pLen) noexcept\n"
+"{\n"
+"  const cfg_entry *e = nullptr;\n"
+"\n"
+"  if (section == nullptr || id == nullptr\n"
+"      || (e = find (section, id)) == nullptr)\n"
+"    return -1;\n"
+"  if (pValue)\n"
+"    *pValue = e->value.data ();\n"
+"  if (pLen)\n"
+"    *pLen = e->value.size ();\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"inline int\n"
+"cfg_getstring_n (table t, const char *section, const char *id,\n"
+"    char *valptr, std::size_t size) noexcept\n"
+"{\n"
+"  const char *value;\n"
+"  std::size_t len, n;\n"
+"\n"
+"  if (cfg_getref (t, section, id, &value, &len) == -1)\n"
+"    return -1;\n"
+"  if (size)\n"
+"    {\n"
+"      n = len < size - 1 ? len : size - 1;\n"
+"      std::memcpy (valptr, value, n);\n"
+"      valptr[n] = 0;\n"
+"    }\n"
+"  return static_cast<int> (len);\n"
+"}\n"
+"\n"
+"inline int\n"
+"cfg_getstring (table t, const char *section, const char *id,\n"
+"    char *valptr) noexcept\n"
+"{\n"
+"  const char *value;\n"
+"  std::size_t len;\n"
+"\n"
+"  if (valptr == nullptr || cfg_getref (t, section, id, &value, &len) == -1)\n"
+"    return -1;\n"
+"  std::memcpy (valptr, value, len + 1);\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* like the runtime, the leading decimal number as atoi reads it */\n"
+"constexpr int\n"
+"cfg_getlong (table t, const char *section, const char *id,\n"
+"    long *valptr) noexcept\n"
+"{\n"
+"  const char *cp = nullptr;\n"
+"  long v = 0;\n"
+"  bool neg = false, over = false;\n"
+"\n"
+"  if (valptr == nullptr || cfg_getref (t, section, id, &cp, nullptr) == -1)\n"
+"    return -1;\n"
+"  while (*cp == ' ' || (*cp >= '\\t' && *cp <= '\\r'))\n"
+"    cp++;\n"
+"  if (*cp == '-' || *cp == '+')\n"
+"    neg = *cp++ == '-';\n"
+"  for (; *cp >= '0' && *cp <= '9' && !over; cp++)\n"
+"    if (v > (LONG_MAX - (*cp - '0')) / 10)\n"
+"      over = true;\n"
+"    else\n"
+"      v = v * 10 + (*cp - '0');\n"
+"  if (over)\n"
+"    v = neg ? LONG_MIN : LONG_MAX;\n"
+"  else if (neg)\n"
+"    v = -v;\n"
+"  /* atoi: strtol narrowed to int */\n"
+"  *valptr = static_cast<int> (v);\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"constexpr int\n"
+"cfg_getint (table t, const char *section, const char *id,\n"
+"    int *valptr) noexcept\n"
+"{\n"
+"  long v = 0;\n"
+"\n"
+"  if (valptr == nullptr || cfg_getlong (t, section, id, &v) == -1)\n"
+"    return -1;\n"
+"  *valptr = static_cast<int> (v);\n"
+"  return 0;\n"
+"}\n";
+
+static char **names;		// valuesµ section::key ʶ
+
+static int by_ident (const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+    int rc;
+
+    if ((rc = strcmp (names[x], names[y])) == 0)
+        rc = x < y ? -1 : x > y;
+    return rc;
+}
+
+// ֿռvaluesµͻ; ʶǰkeyֻͬдע
+static void put_values (FILE *fp, PCONFIG pconfig, KEY *keys, unsigned int n)
+{
+    char *sect, *id, *prev = NULL;
+    unsigned int *order, i;
+    unsigned char *clash;
+    long lv;
+    double dv;
+
+    names = (char **) calloc (n ? n : 1, sizeof (char *));
+    order = (unsigned int *) malloc ((n ? n : 1) * sizeof (unsigned int));
+    clash = (unsigned char *) calloc (n ? n : 1, 1);
+    if (!names || !order || !clash)
+        goto nomem;
+    for (i = 0; i < n; i++) {
+        names[i] = (char *) malloc (2 * strlen (keys[i].section)
+            + 2 * strlen (keys[i].id) + 6);
+        if (names[i] == NULL)
+            goto nomem;
+        make_ident (names[i], keys[i].section);
+        strcat (names[i], "::");
+        make_ident (names[i] + strlen (names[i]), keys[i].id);
+        order[i] = i;
+    }
+    qsort (order, n, sizeof (unsigned int), by_ident);
+    for (i = 1; i < n; i++)
+        if (!strcmp (names[order[i - 1]], names[order[i]]))
+            clash[order[i]] = 1;
+
+    fprintf (fp, "namespace values\n{\n");
+    for (i = 0; i < n; i++) {
+        sect = names[i];
+        id = strstr (sect, "::");
+        *id = 0;
+        id += 2;
+
+        if (prev == NULL || strcmp (prev, sect)) {
+            if (prev)
+                fprintf (fp, "}\n\n");
+            fprintf (fp, "namespace %s\n{\n", sect);
+        }
+        prev = sect;
+
+        errno = 0;
+        if (clash[i])
+            fprintf (fp, "/* %s: same identifier as an earlier key */\n", id);
+        else if (cfg_getlongs (pconfig, keys[i].section, keys[i].id, 0,
+                &lv, 1) == 1)
+            fprintf (fp, "inline constexpr long %s = %ldL;\n", id, lv);
+        // longdouble, ⶪʧ
+        else if (errno != ERANGE
+            && cfg_getdoubles (pconfig, keys[i].section, keys[i].id, 0,
+                &dv, 1) == 1 && isfinite (dv))
+            fprintf (fp, "inline constexpr double %s = %.17g;\n", id, dv);
+        else {
+            fprintf (fp, "inline constexpr std::string_view %s = ", id);
+            put_string (fp, keys[i].value, keys[i].len);
+            fprintf (fp, ";\n");
+        }
+    }
+    if (prev)
+        fprintf (fp, "}\n");
+    fprintf (fp, "}\n\n");
+
+    for (i = 0; i < n; i++)
+        free (names[i]);
+    free (names);
+    free (order);
+    free (clash);
+    return;
+
+nomem:
+    fprintf (stderr, "cfg2hpp: out of memory\n");
+    exit (1);
+}
+
+static void usage (void)
+{
+    fprintf (stderr, "usage: cfg2hpp [-n namespace] input.ini [output.hpp]\n");
+    exit (2);
+}
+
+int main (int argc, char **argv)
+{
+    PCONFIG pconfig;
+    KEY *keys = NULL, *sorted;
+    unsigned int n = 0, max = 0, i, numBuckets, numSeeds;
+    uint32_t *disp, seed;
+    const char *input, *output = NULL, *base, *section;
+    char *ns = NULL, *guard, *cp;
+    FILE *fp = stdout;
+    int argi = 1;
+
+    if (argi + 1 < argc && !strcmp (argv[argi], "-n")) {
+        ns = argv[argi + 1];
+        argi += 2;
+    }
+    if (argi >= argc || argc - argi > 2)
+        usage ();
+    input = argv[argi];
+    if (argc - argi == 2)
+        output = argv[argi + 1];
+
+    if (cfg_open (&pconfig, input, CFG_OPEN_LEAN) == -1) {
+        fprintf (stderr, "cfg2hpp: cannot read %s\n", input);
+        return 1;
+    }
+
+    // ֿռĬȡļ
+    if ((base = strrchr (input, '/')) != NULL)
+        base++;
+    else
+        base = input;
+    cp = (char *) malloc (2 * strlen (ns ? ns : base) + 2);
+    guard = (char *) malloc (2 * strlen (ns ? ns : base) + 16);
+    if (cp == NULL || guard == NULL)
+        goto nomem;
+    if (ns == NULL) {
+        make_ident (cp, base);
+        if ((ns = strstr (cp, "_ini")) != NULL && ns[4] == 0)
+            *ns = 0;
+    }
+    else
+        make_ident (cp, ns);
+    ns = cp;
+    sprintf (guard, "CFG2HPP_%s_HPP", ns);
+    for (cp = guard; *cp; cp++)
+        if (*cp >= 'a' && *cp <= 'z')
+            *cp += 'A' - 'a';
+
+    // ļռsection:key, ֵȡʱҵĽ(չ${})
+    // һsection֮ǰkeyʱҲ
+    cfg_rewind (pconfig);
+    section = NULL;
+    while (cfg_nextentry (pconfig) == 0) {
+        if (cfg_section (pconfig))
+            section = pconfig->section;
+        if (!cfg_define (pconfig) || section == NULL)
+            continue;
+        if (n == max) {
+            max = max ? max * 2 : 64;
+            if ((sorted = (KEY *) realloc (keys, max * sizeof (KEY))) == NULL)
+                goto nomem;
+            keys = sorted;
+        }
+        keys[n].section = section;
+        if ((keys[n].id = unquote (pconfig->id)) == NULL)
+            goto nomem;
+        keys[n].order = n;
+        n++;
+    }
+
+    // ԴСдȥ, ȳֵ; ʱҲҲȥ
+    if (n)
+        qsort (keys, n, sizeof (KEY), by_name);
+    for (i = 0, max = 0; i < n; i++) {
+        if ((max && !strcasecmp (keys[max - 1].section, keys[i].section)
+                && !strcasecmp (keys[max - 1].id, keys[i].id))
+            || cfg_getref (pconfig, keys[i].section, keys[i].id,
+                &keys[i].value, &keys[i].len) == -1) {
+            free ((char *) keys[i].id);
+            continue;
+        }
+        // cfg_getrefָ´βʱʧЧ, һ
+        if ((keys[i].value = strdup (keys[i].value)) == NULL)
+            goto nomem;
+        keys[max++] = keys[i];
+    }
+    n = max;
+    if (n)
+        qsort (keys, n, sizeof (KEY), by_order);
+
+    numBuckets = n / 4 + 1;
+    if ((disp = (uint32_t *) calloc (numBuckets, sizeof (uint32_t))) == NULL)
+        goto nomem;
+    for (seed = 0, numSeeds = 0; n && numSeeds < MAX_SEEDS; numSeeds++) {
+        seed = mix (numSeeds + 1);
+        if (build_hash (keys, n, numBuckets, seed, disp) == 0)
+            break;
+    }
+    if (numSeeds == MAX_SEEDS) {
+        fprintf (stderr, "cfg2hpp: no perfect hash found for %s\n", input);
+        return 1;
+    }
+
+    if (output && (fp = fopen (output, "w")) == NULL) {
+        fprintf (stderr, "cfg2hpp: cannot write %s\n", output);
+        return 1;
+    }
+
+    fprintf (fp, "/* Generated by cfg2hpp from %s -- do not edit */\n\n", base);
+    fprintf (fp, "#ifndef %s\n#define %s\n\n", guard, guard);
+    fprintf (fp, "#include <climits>\n#include <cstddef>\n#include <cstdint>\n#include <cstring>\n"
+        "#include <string_view>\n\n");
+    fprintf (fp, "namespace %s\n{\n\n", ns);
+    fprintf (fp, "struct cfg_entry\n{\n  std::string_view section;\n"
+        "  std::string_view id;\n  std::string_view value;\n};\n\n");
+    fprintf (fp, "/* passed where a PCONFIG would be */\nstruct table\n{\n};\n"
+        "inline constexpr table config {};\n\n");
+    fprintf (fp, "inline constexpr std::size_t count = %u;\n", n);
+    fprintf (fp, "inline constexpr std::uint32_t num_buckets = %u;\n",
+        numBuckets);
+    fprintf (fp, "inline constexpr std::uint32_t seed = 0x%08xU;\n\n", seed);
+
+    // ձҲҪǺϷ
+    fprintf (fp, "/* in hash slot order */\n"
+        "inline constexpr cfg_entry entries[%u] =\n{\n", n ? n : 1);
+    for (i = 0; i < n; i++) {
+        fprintf (fp, "  { ");
+        put_string (fp, keys[i].section, strlen (keys[i].section));
+        fprintf (fp, ", ");
+        put_string (fp, keys[i].id, strlen (keys[i].id));
+        fprintf (fp, ", std::string_view (");
+        put_string (fp, keys[i].value, keys[i].len);
+        fprintf (fp, ", %lu) },\n", (unsigned long) keys[i].len);
+    }
+    if (n == 0)
+        fprintf (fp, "  { }\n");
+    fprintf (fp, "};\n\n");
+
+    fprintf (fp, "inline constexpr std::uint32_t disp[%u] =\n{", numBuckets);
+    for (i = 0; i < numBuckets; i++)
+        fprintf (fp, "%s%u,", i % 8 ? " " : "\n  ", disp[i]);
+    fprintf (fp, "\n};\n\n");
+
+    fputs (lookup_code, fp);
+    fprintf (fp, "\n");
+
+    if (n)
+        qsort (keys, n, sizeof (KEY), by_order);
+    put_values (fp, pconfig, keys, n);
+
+    fprintf (fp, "} /* namespace %s */\n\n#endif /* %s */\n", ns, guard);
+
+    if (ferror (fp) || (output && fclose (fp))) {
+        fprintf (stderr, "cfg2hpp: cannot write %s\n", output ? output : "output");
+        if (output)
+            remove (output);
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        free ((char *) keys[i].id);
+        free ((char *) keys[i].value);
+    }
+    free (keys);
+    free (disp);
+    free (ns);
+    free (guard);
+    cfg_done (pconfig);
+    return 0;
+
+nomem:
+    fprintf (stderr, "cfg2hpp: out of memory\n");
+    return 1;
+}